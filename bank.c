@@ -1,27 +1,486 @@
+#ifdef _WIN32
+#define _CRT_RAND_S                 // rand_s() for password salts
+#else
+#define _XOPEN_SOURCE 700           // POSIX.1-2008 (pread, pwrite, mkdtemp) under -std=c99/c11
+#define _DARWIN_C_SOURCE            // macOS hides _SC_NPROCESSORS_ONLN once _XOPEN_SOURCE is set
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <conio.h>
 #include <ctype.h>
+#include <stddef.h>
+
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#include <io.h>
+#include <direct.h>
+#include <conio.h>
+#else
+#include <unistd.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STATS_AVX2 1                // AVX2 statistics kernel, picked at runtime
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Threads, locks and sockets
+#ifdef _WIN32
+typedef CRITICAL_SECTION bank_mutex;
+typedef CONDITION_VARIABLE bank_cond;
+typedef HANDLE bank_thread;
+typedef SOCKET bank_socket;
+#define THREAD_FUNC DWORD WINAPI
+#define mutex_init(m) InitializeCriticalSection(m)
+#define mutex_lock(m) EnterCriticalSection(m)
+#define mutex_unlock(m) LeaveCriticalSection(m)
+#define cond_init(c) InitializeConditionVariable(c)
+#define cond_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define cond_broadcast(c) WakeAllConditionVariable(c)
+#define cond_destroy(c) ((void)0)
+#define mutex_trylock(m) TryEnterCriticalSection(m)
+#define thread_yield() SwitchToThread()
+#define thread_start(t, fn, arg) ((*(t) = CreateThread(NULL, 0, fn, arg, 0, NULL)) != NULL)
+#define thread_join(t) (WaitForSingleObject(t, INFINITE), CloseHandle(t))
+#define thread_detach(t) CloseHandle(t)
+#define thread_sleep(seconds) Sleep((seconds) * 1000)
+#else
+typedef pthread_mutex_t bank_mutex;
+typedef pthread_cond_t bank_cond;
+typedef pthread_t bank_thread;
+typedef int bank_socket;
+#define THREAD_FUNC void*
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#define mutex_init(m) pthread_mutex_init(m, NULL)
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#define cond_init(c) pthread_cond_init(c, NULL)
+#define cond_wait(c, m) pthread_cond_wait(c, m)
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+#define cond_destroy(c) pthread_cond_destroy(c)
+#define mutex_trylock(m) (pthread_mutex_trylock(m) == 0)
+#define thread_yield() sched_yield()
+#define thread_start(t, fn, arg) (pthread_create(t, NULL, fn, arg) == 0)
+#define thread_join(t) pthread_join(t, NULL)
+#define thread_detach(t) pthread_detach(t)
+#define thread_sleep(seconds) sleep(seconds)
+#endif
 
 #define MAX_NAME_LEN 50
 #define MAX_USERNAME_LEN 20
 #define MAX_PASSWORD_LEN 20
-#define MAX_ACCOUNTS 1000
 #define MIN_BALANCE 500
-#define MAX_TRANSACTIONS 100
+#define MAX_TRANSACTIONS 100       // history slots per account in the legacy layout
+#define MINOR_UNITS 100             // paise per rupee
+#define MAX_AMOUNT (1000000LL * MINOR_UNITS)
+#define MONEY_BUFFER_SIZE 24
+#define ACCOUNT_SEQUENCE_FIRST 100000000 // account numbers are SAR, a 9-digit sequence and a check digit
+#define ACCOUNT_SEQUENCE_LAST 999999999
+#define PASSWORD_HASH_PREFIX "$p$"  // "$p$<cost>$<salt>$<key>", base64 salt and key
+#define PASSWORD_KDF_COST 14        // log2 of the PBKDF2-HMAC-SHA256 iterations
+#define PASSWORD_SALT_BYTES 12
+#define PASSWORD_KEY_BYTES 18
+#define MAX_LOGIN_ATTEMPTS 3
+#define AUTH_CACHE_SIZE 1024        // session-token cache slots, a power of two >= LOCK_STRIPES
+#define LOGIN_BENCH_ACCOUNTS 64     // accounts created in memory by --login-bench
+#define LOGIN_BENCH_KDF_LOGINS 16   // full-cost logins per thread in --login-bench
+#define LOGIN_BENCH_CACHED_LOGINS 100000
+
+#define ACCOUNTS_FILE "accounts.dat"
+#define JOURNAL_FILE "accounts.jnl"
+#define JOURNAL_MAGIC 0x344E524A    // "JRN4"
+#define JOURNAL_MAGIC_V3 0x334E524A // "JRN3", no transaction ids
+#define JOURNAL_MAGIC_V2 0x324E524A // "JRN2", transactions not yet timestamped
+#define JOURNAL_MAGIC_V1 0x4C4E524A // "JRNL", amounts still doubles
+#define JOURNAL_BUFFER_SIZE 65536
+#define JOURNAL_CHECKPOINT_RECORDS 1024
+#define INDEX_MIN_CAPACITY 1024
+#define SNAPSHOT_MAGIC 0x42524153   // "SARB"
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_HEADER_SIZE 32     // bytes of the little-endian header from version 4
+#define SNAPSHOT_BUFFER_SIZE 65536  // bytes the snapshot is read and written in
+#define SNAPSHOT_MIN_RECORD 11      // bytes of the smallest encoded account
+#define LEDGER_FILE "ledger.dat"
+#define LEDGER_MAGIC 0x4C524153     // "SARL"
+#define LEDGER_VERSION 4
+#define LEDGER_SEGMENT_SIZE 8       // transactions per ledger segment
+#define LEDGER_POOL_BLOCK 1024      // segments carved out per pool allocation
+#define HISTORY_PAGE_SIZE 10
+#define HISTORY_INDEX_MIN_CAPACITY 16
+#define AUDIT_MERGE_MIN 4096        // unindexed log entries scanned before they are merged
+#define AUDIT_DISPLAY_LIMIT 100     // matches listed by the admin audit query
+#define AUDIT_BENCH_ACCOUNTS 65536  // accounts created in memory by --audit-bench
+#define AUDIT_BENCH_ROUNDS 5
+#define AUDIT_BENCH_SPAN (365 * 24 * 60 * 60)
+#define SEARCH_SYMBOLS 37           // search alphabet: a boundary, the letters and the digits
+#define SEARCH_GRAMS (SEARCH_SYMBOLS * SEARCH_SYMBOLS * SEARCH_SYMBOLS)
+#define SEARCH_FIELD_MAX 64         // symbols of one normalized profile field, padding included
+#define SEARCH_MAX_QUERY 48         // symbols of a search query used
+#define SEARCH_MIN_QUERY 2          // shortest query, in letters and digits
+#define SEARCH_FUZZY_MIN 6          // shortest query also matched with one typo
+#define SEARCH_MIN_POSTINGS 8       // first capacity of a posting list, in bytes
+#define SEARCH_INTERSECT 3          // shortest posting lists intersected for an exact search
+#define SEARCH_PAGE_SIZE 10         // accounts per page of the admin customer search
+#define SEARCH_BENCH_QUERIES 200    // queries timed per kind in --search-bench
+#define SEARCH_BENCH_CHECKS 3       // of which this many are checked against a full scan
+#define LIST_PAGE_SIZE 20           // accounts per page of the admin account listing
+#define EXPORT_BUFFER_SIZE (1 << 20) // bytes an export is written in
+#define EXPORT_ROW_MAX 2048         // longest formatted row, escapes included
+#define EXPORT_PATH_MAX 512
+#define EXPORT_MAX_SHARDS 64        // files an export is split into at most
+#define EXPORT_BENCH_HISTORY 4      // transactions per account in --export-bench
+#define EXPORT_BENCH_SHARDS 4       // shards of the sharded runs of --export-bench
+#define BATCH_GROUP_SIZE 4096       // batch operations per journal commit
+#define BATCH_LINE_LEN 256
+#define BATCH_MAX_FIELDS 5
+#define BATCH_BUFFER_SIZE (1 << 20)
+#define IMPORT_BLOCK_ROWS 16384     // customer rows read, checked in parallel and committed at a time by --import
+#define IMPORT_LINE_LEN 512
+#define IMPORT_FIELDS 8
+#define IMPORT_BENCH_REJECT_EVERY 100 // --import-bench spoils one row in this many, and duplicates another
+#define LOCK_STRIPES 256            // account locks, a power of two
+#define SERVER_BACKLOG 64
+#define SERVER_GROUP_SIZE 64        // operations a worker runs per journal commit
+#define SESSION_BUFFER_SIZE 8192
+#define LOADGEN_CLIENTS 16          // concurrent sessions opened by --loadgen
+#define LOADGEN_OPS 2000            // operations per load generator session
+#define LOADGEN_ACCOUNTS 1000       // accounts opened for --loadgen in its scratch directory
+#define LOADGEN_PASSWORD "Loadgen1234!"
+#define LIVE_SEQ_SHIFT 48           // live balance word: sequence << 48 | paise
+#define LIVE_SEQ_MASK 0xFFFF
+#define LIVE_BALANCE_LIMIT (1LL << 47) // credits past it are refused, so a balance never reaches the sequence
+#define RING_SIZE 16                // pending changes per account ring, a power of two
+#define RING_PUBLISHED 0x10000
+#define CONTENTION_ACCOUNTS 4       // hot accounts hammered by --contention
+#define CONTENTION_OPS 20000        // deposits per thread and round in --contention
+#define EOD_SAVINGS_RATE 400        // interest in basis points a year
+#define EOD_PREMIUM_RATE 600
+#define EOD_DAYS_PER_YEAR 365
+#define EOD_MAINTENANCE_FEE (10 * MINOR_UNITS) // per business day a current account is below its minimum
+#define EOD_BENCH_ACCOUNTS 262144   // accounts created in memory by --eod-bench
+#define CRASH_TEST_ACCOUNTS 8       // accounts transferring among themselves in --crash-test
+#define CRASH_TEST_TRANSFERS 48
+#define CRASH_TEST_CHECKPOINT 16    // transfers between checkpoints in --crash-test
+#define CRASH_TEST_EXIT 99          // exit status of a process killed at a write point
+#define FORMAT_BENCH_ROUNDS 3       // loads timed per format in --format-bench
+#define FORMAT_BENCH_DEPOSITS 1000  // deposits saved by one checkpoint per format in --format-bench
+#define BENCH_MIN_ACCOUNTS 1000     // first population of --bench, grown tenfold up to its argument
+#define BENCH_OPS 100000            // timed operations per kind and distribution in --bench
+#define BENCH_COMMIT_GROUP 64       // --bench operations per journal commit
+#define BENCH_HOT_PERCENT 1         // share of the accounts that are hot in skewed runs
+#define BENCH_HOT_SHARE 90          // percent of skewed operations aimed at hot accounts
+#define BENCH_INITIAL_DEPOSIT (100000LL * MINOR_UNITS)
+#define CREATE_BENCH_BATCH 1000     // accounts per bank_create_accounts() call in --create-bench
+#define SCALE_TEST_REPORT 10        // --scale-test prints a line at every tenth of the accounts
+#define METRICS_FILE "metrics.prom"
+#define METRICS_EXPORT_INTERVAL 10  // seconds between rewrites of METRICS_FILE
+#define METRIC_SHARDS 64            // per-thread metric shards, a power of two
+#define METRIC_SAMPLE_RATE 8        // one core operation in this many is timed, a power of two
+#define METRIC_SUB_BITS 3           // histogram buckets per power of two: 1 << METRIC_SUB_BITS
+#define METRIC_SUB_BUCKETS (1 << METRIC_SUB_BITS)
+#define METRIC_MAX_SHIFT 39         // latencies of 2^40 ns (18 minutes) and more share the last bucket
+#define METRIC_BUCKETS ((METRIC_MAX_SHIFT - METRIC_SUB_BITS + 2) * METRIC_SUB_BUCKETS)
+#define METRIC_EXPORT_MIN_SHIFT 10  // histogram bounds exported: 2^10 ns ...
+#define METRIC_EXPORT_MAX_SHIFT 34  // ... up to 2^34 ns, one per power of two
+#define METRICS_BENCH_ACCOUNTS 1024 // accounts created in memory by --metrics-bench
+#define METRICS_BENCH_SLICE 2000    // transfers between switches of the metrics in --metrics-bench
+#define SNAPSHOT_TEST_ACCOUNTS 10000 // accounts created in memory by --snapshot-test, over several chunks
+#define SNAPSHOT_TEST_THREADS 4     // threads transferring among them
+#define SNAPSHOT_TEST_TRANSFERS 25000 // transfers per thread
+#define STATS_TYPES 4               // values of the account type bits
+#define STATS_BUCKETS 6             // balance histogram buckets
+#define STATS_BENCH_ROUNDS 5        // timed passes per kernel in --stats-bench
+#define ACCOUNT_CHUNK_SHIFT 12
+#define ACCOUNT_CHUNK_SIZE (1 << ACCOUNT_CHUNK_SHIFT)
+#define MAPPED_MAGIC 0x4D524153     // "SARM"
+#define MAPPED_VERSION 2
+#define MAP_ALIGNMENT 65536         // file offsets of mapped regions (Windows granularity)
+#define MAP_PAGE_SIZE 4096          // unit of dirty tracking and write-back
 
-// Enhanced structures
+// How accounts.dat is kept
+enum {
+    STORAGE_SNAPSHOT,           // read at startup, rewritten at each checkpoint
+    STORAGE_MAPPED              // fixed-record file mapped in place
+};
+
+// Account types, kept in the low bits of the account flags column
+enum {
+    ACCOUNT_SAVINGS,
+    ACCOUNT_CURRENT,
+    ACCOUNT_PREMIUM
+};
+
+#define ACCOUNT_TYPE_MASK 0x03
+#define ACCOUNT_ACTIVE 0x04
+
+// Result codes of the core banking operations
+enum {
+    BANK_OK,
+    BANK_INVALID_AMOUNT,
+    BANK_INSUFFICIENT_BALANCE,
+    BANK_ACCOUNT_NOT_FOUND,
+    BANK_ACCOUNT_BLOCKED,
+    BANK_SAME_ACCOUNT,
+    BANK_BAD_REQUEST,
+    BANK_AUTH_FAILED,
+    BANK_USERNAME_TAKEN,
+    BANK_NO_STORAGE,
+    BANK_LOGIN_REQUIRED,
+    BANK_NOT_PERMITTED,
+    BANK_NOT_SAVED,
+    BANK_BALANCE_LIMIT
+};
+
+// Amounts and balances are whole paise, so sums are exact
+typedef long long Money;
+
+// Enhanced structures. The timestamp fills what used to be tail padding, so
+// the record size is unchanged; files from before it are stamped from date.
 typedef struct {
     char date[20];
     char type[20];          // DEPOSIT, WITHDRAW, TRANSFER_IN, TRANSFER_OUT
-    double amount;
-    double balance_after;
+    Money amount;
+    Money balance_after;
     char description[100];
     char reference_account[15];
+    unsigned int timestamp; // seconds since the epoch, never less than the previous entry's
 } Transaction;
 
+// Transaction types known to the history index
+enum {
+    HISTORY_DEPOSIT,
+    HISTORY_WITHDRAW,
+    HISTORY_TRANSFER_IN,
+    HISTORY_TRANSFER_OUT,
+    HISTORY_INTEREST,
+    HISTORY_FEE,
+    HISTORY_OTHER,
+    HISTORY_TYPES
+};
+
+// Cold account profile. The fields read on every scan (balance, type,
+// active flag) live in the balance and flags columns of the account store
+// instead, indexed by id, and the history lives in the ledger.
+typedef struct {
+    char account_number[15];
+    char name[MAX_NAME_LEN];
+    char username[MAX_USERNAME_LEN];
+    char password_hash[50];
+    char dob[12];
+    char mobile[15];
+    char email[50];
+    int failed_attempts;
+    char created_date[20];
+    int id;                 // slot in the account store
+} BankAccount;
+
+// Fixed-size block of ledger entries. An account's history is a chain of
+// segments linked from the newest one back to the oldest.
+typedef struct LedgerSegment {
+    struct LedgerSegment* prev;
+    int count;
+    Transaction entries[LEDGER_SEGMENT_SIZE];
+} LedgerSegment;
+
+typedef struct {
+    LedgerSegment* head;        // newest segment, NULL when empty
+    int transaction_count;
+    unsigned long long last_id; // transaction id of the newest entry
+} TransactionHistory;
+
+// Positions (in time order) of the entries of an account's history
+typedef struct {
+    int* positions;
+    int count;
+    int capacity;
+} PositionList;
+
+// Per-account index over a history for statements, built on the first query
+// and extended with the entries added since on each later one. entries is in
+// time order, so every list can be binary searched by timestamp.
+typedef struct {
+    Transaction** entries;
+    int count;
+    int capacity;
+    PositionList by_type[HISTORY_TYPES];
+    PositionList by_reference;  // sorted by reference account, then position
+} HistoryIndex;
+
+// ledger.dat is a header followed by LedgerRecords in commit order: it is
+// the global transaction log on disk
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+} LedgerHeader;
+
+typedef struct {
+    int account;
+    unsigned long long id;      // transaction id, shared by both legs of a transfer
+    Transaction trans;
+} LedgerRecord;
+
+// Record of ledgers before version 4, written account by account. Their
+// entries are given ids in file order when loaded.
+typedef struct {
+    int account;
+    Transaction trans;
+} LegacyLedgerRecord;
+
+// One entry of the global transaction log: a leg in some account's history.
+// Ids are handed out in commit order and never reused.
+typedef struct {
+    unsigned long long id;
+    Transaction* entry;
+    int account;                // account id of the leg
+} AuditEntry;
+
+// Every history entry of the bank in commit order, as ledger.dat holds it.
+// The secondary indexes are log positions sorted by amount, timestamp and
+// reference account (ties in log order) and cover the first indexed
+// entries; queries scan the newer ones until there are AUDIT_MERGE_MIN of
+// them, then merge them in.
+typedef struct {
+    AuditEntry* entries;
+    int count;
+    int capacity;
+    int persisted;              // entries already written to ledger.dat
+    int indexed;
+    int* by_amount;
+    int* by_time;
+    int* by_reference;
+    unsigned long long next_id;
+} AuditLog;
+
+// Persistent part of one block of the account store. In snapshot mode it is
+// heap memory; in mapped mode it is a private mapping of its region of
+// accounts.dat. The columns inside a chunk are contiguous for scans.
+typedef struct {
+    BankAccount profiles[ACCOUNT_CHUNK_SIZE];
+    Money balances[ACCOUNT_CHUNK_SIZE];
+    unsigned char flags[ACCOUNT_CHUNK_SIZE];
+} AccountChunkData;
+
+#define MAP_CHUNK_STRIDE ((sizeof(AccountChunkData) + MAP_ALIGNMENT - 1) / MAP_ALIGNMENT * MAP_ALIGNMENT)
+#define MAP_CHUNK_PAGES (MAP_CHUNK_STRIDE / MAP_PAGE_SIZE)
+
+// A balance change made by a lock-free operation, waiting to be moved into
+// the account's history and the journal. The description is owned by the
+// operation, which does not return until its entry has been moved.
+typedef struct {
+    unsigned int stamp;         // sequence | RING_PUBLISHED once filled in
+    const char* type;
+    const char* description;
+    Money amount;
+    Money balance_after;
+} RingEntry;
+
+// Entry n of an account lives in slot n % RING_SIZE, so entries are moved in
+// exactly the order their balance changes happened
+typedef struct {
+    RingEntry entries[RING_SIZE];
+    unsigned int drained;       // sequence of the next entry to move
+} AccountRing;
+
+// Chunks are allocated as the bank grows and never move, so BankAccount
+// pointers such as current_user stay valid.
+//
+// live_balances is what operations act on: the balance in paise in the low
+// bits and a per-account sequence number in the top 16, so one atomic add
+// both credits the account and orders the change. The balances column holds
+// the state already recorded in the history and the journal.
+typedef struct {
+    AccountChunkData* data;
+    TransactionHistory histories[ACCOUNT_CHUNK_SIZE];
+    HistoryIndex* history_indexes[ACCOUNT_CHUNK_SIZE];
+    unsigned long long live_balances[ACCOUNT_CHUNK_SIZE];
+    AccountRing* rings[ACCOUNT_CHUNK_SIZE];
+    unsigned int dirty_pages[(MAP_CHUNK_PAGES + 31) / 32];
+} AccountChunk;
+
+#define ACCOUNT_CHUNK(id) account_chunks[(id) >> ACCOUNT_CHUNK_SHIFT]
+#define ACCOUNT_SLOT(id) ((id) & (ACCOUNT_CHUNK_SIZE - 1))
+#define ACCOUNT(id) (ACCOUNT_CHUNK(id)->data->profiles[ACCOUNT_SLOT(id)])
+#define BALANCE(id) (ACCOUNT_CHUNK(id)->data->balances[ACCOUNT_SLOT(id)])
+#define FLAGS(id) (ACCOUNT_CHUNK(id)->data->flags[ACCOUNT_SLOT(id)])
+#define HISTORY(id) (ACCOUNT_CHUNK(id)->histories[ACCOUNT_SLOT(id)])
+#define LIVE(id) (ACCOUNT_CHUNK(id)->live_balances[ACCOUNT_SLOT(id)])
+#define RING(id) (ACCOUNT_CHUNK(id)->rings[ACCOUNT_SLOT(id)])
+#define HISTORY_INDEX(id) (ACCOUNT_CHUNK(id)->history_indexes[ACCOUNT_SLOT(id)])
+
+// A point-in-time view of the balance and flags columns, for reports and
+// end-of-day runs. Taking one passes briefly through every stripe lock, so no
+// operation is half done; after that writers go on, and the first write to a
+// chunk the reader has not read yet saves a copy of the chunk for it. A chunk
+// is claimed once it has been saved or read, and each chunk is read once.
+typedef struct {
+    Money balances[ACCOUNT_CHUNK_SIZE];
+    unsigned char flags[ACCOUNT_CHUNK_SIZE];
+} SnapshotChunk;
+
+typedef struct {
+    int account_count;
+    int chunk_count;
+    int* claimed;
+    SnapshotChunk** saved;      // copies made by writers, not yet read
+} AccountSnapshot;
+
+#define LIVE_STEP (1ULL << LIVE_SEQ_SHIFT)
+#define LIVE_BALANCE(word) ((Money)((word) & (LIVE_STEP - 1)))
+#define LIVE_SEQ(word) ((unsigned int)((word) >> LIVE_SEQ_SHIFT))
+
+// Header of a mapped accounts.dat. Chunk c occupies chunk_stride bytes at
+// MAP_ALIGNMENT + c * chunk_stride, laid out exactly as AccountChunkData.
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    int account_count;
+    int chunk_size;
+    long long chunk_stride;
+    long long ledger_bytes;
+    int eod_date;               // last end-of-day business date, YYYYMMDD
+    int account_sequence;       // next account number's sequence, 0 in older files
+} MappedHeader;
+
+// accounts.dat header; files without it are in the legacy layout below.
+// Version 1 files end after account_count and embed each history after the
+// columns; from version 2 histories live in ledger.dat, of which only the
+// first ledger_bytes are part of this snapshot. Versions before 3 store
+// balances as doubles. Up to version 3 the header and columns are memory
+// images; version 4 files are portable and compact: the same fields written
+// little-endian in SNAPSHOT_HEADER_SIZE bytes, followed by a CRC-32 of the
+// records and the next account number's sequence (0 in files from before
+// it), then one variable-length record per account
+// (see snapshot_put_account()).
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    int account_count;
+    int eod_date;               // last end-of-day business date, YYYYMMDD (from version 2)
+    long long ledger_bytes;
+} SnapshotHeader;
+
+// Original accounts.dat record, one memory image per account. Its
+// transactions hold doubles in the Money fields; see upgrade_transaction().
 typedef struct {
     char account_number[15];
     char name[MAX_NAME_LEN];
@@ -31,19 +490,239 @@ typedef struct {
     char mobile[15];
     char email[50];
     double balance;
-    char account_type[20];  // SAVINGS, CURRENT, PREMIUM
+    char account_type[20];
     int is_active;
     int failed_attempts;
     char created_date[20];
     Transaction transactions[MAX_TRANSACTIONS];
     int transaction_count;
-} BankAccount;
+} LegacyBankAccount;
+
+// Journal record types
+enum {
+    JOURNAL_TRANSACTION = 1,    // balance change with one transaction entry
+    JOURNAL_TRANSFER,           // both legs of a transfer in one record
+    JOURNAL_STATUS,             // is_active / failed_attempts change
+    JOURNAL_PASSWORD,           // password hash change
+    JOURNAL_CREATE,             // new account (profile + initial deposit)
+    JOURNAL_POSTING,            // end-of-day interest or fee, laid out as a transaction
+    JOURNAL_EOD                 // marks a business date as closed
+};
+
+// One fixed-size write-ahead journal record. Each record carries the
+// absolute state it produces (balance and transaction count after the
+// change), so replaying a record that is already in the snapshot is a no-op.
+typedef struct {
+    unsigned int magic;
+    unsigned int type;
+    unsigned long long lsn;
+    int account;                // account id
+    int target;                 // credited account of a transfer, -1 otherwise
+    char account_number[15];
+    union {
+        struct {
+            Money balance_after;
+            Money target_balance_after;
+            int transaction_count;
+            int target_transaction_count;
+            Transaction trans;
+            unsigned long long txn_id;  // both legs' id for a transfer
+        } txn;
+        struct {
+            int is_active;
+            int failed_attempts;
+        } status;
+        char password_hash[50];
+        int business_date;
+        struct {
+            char name[MAX_NAME_LEN];
+            char username[MAX_USERNAME_LEN];
+            char password_hash[50];
+            char dob[12];
+            char mobile[15];
+            char email[50];
+            char created_date[20];
+            int flags;
+            unsigned long long txn_id;  // of the initial deposit; the balance before JRN4
+            Transaction trans;          // the initial deposit, balance_after is the balance
+        } create;
+    } data;
+    unsigned int checksum;      // CRC-32 of everything above
+} JournalRecord;
+
+// Open-addressing (linear probing) hash index over one key field of
+// the account store. Each slot keeps the full hash next to the account id, so
+// a probe only touches the account profile when the hashes match.
+// Lookups do not lock: a full table is replaced by a larger one published
+// atomically, and the old one is kept until the index is rebuilt, so a
+// lookup still probing it reads valid memory.
+typedef struct {
+    unsigned int hash;
+    int account;                // account id, -1 = empty slot
+} IndexSlot;
+
+typedef struct IndexTable {
+    int capacity;               // power of two
+    struct IndexTable* retired; // the table this one replaced
+    IndexSlot slots[];
+} IndexTable;
+
+typedef struct {
+    IndexTable* table;
+    int count;
+    size_t key_offset;          // offset of the key string in BankAccount
+} AccountIndex;
+
+// Customer search: an inverted index from each trigram of the normalized
+// name, username, email and mobile of the accounts to the accounts having it.
+// Normalizing folds letters to lower case and turns every run of other
+// characters that are not digits into one boundary, so "John.Smith@x.com"
+// reads "john smith x com"; each field also gets a boundary on either side.
+// The account ids in a posting list ascend and are stored as varint gaps.
+// New accounts have the highest id, so they are only ever appended.
+typedef struct {
+    unsigned char* bytes;
+    int length;
+    int capacity;
+    int count;                  // accounts in the list
+    int last;                   // last account added, -1 if none
+} SearchPostings;
+
+typedef struct {
+    const unsigned char* next;
+    const unsigned char* end;
+    int account;                // current account, SEARCH_END once exhausted
+} SearchCursor;
+
+#define SEARCH_END 0x7FFFFFFF
+#define SEARCH_GRAM(s) (((s)[0] * SEARCH_SYMBOLS + (s)[1]) * SEARCH_SYMBOLS + (s)[2])
+
+// Exports write every account, or every transaction, as CSV or JSON lines.
+// Rows are formatted by hand straight into a buffer that reaches the file in
+// writes of EXPORT_BUFFER_SIZE; with several shards, each thread writes the
+// accounts of a range of chunks to a file of its own.
+enum {
+    EXPORT_ACCOUNTS,
+    EXPORT_TRANSACTIONS
+};
+
+enum {
+    EXPORT_CSV,
+    EXPORT_JSONL
+};
+
+typedef struct {
+    FILE* fp;
+    char* buffer;
+    size_t position;
+    long long total;
+    int failed;
+} ExportWriter;
+
+typedef struct {
+    int what;
+    int format;
+    int first_chunk;
+    int last_chunk;             // one past the last chunk of the shard
+    int account_count;          // accounts when the export started
+    AccountSnapshot* snapshot;  // accounts only
+    char path[EXPORT_PATH_MAX];
+    long long rows;
+    long long bytes;
+    int ok;
+} ExportShard;
+
+// SHA-256 and HMAC-SHA256 state for the password KDF. An HMAC key is
+// prepared once as the states after its inner and outer pad blocks.
+typedef struct {
+    unsigned int state[8];
+    unsigned long long length;  // bytes hashed so far
+    unsigned char block[64];
+} Sha256;
+
+typedef struct {
+    Sha256 inner;
+    Sha256 outer;
+} HmacSha256;
+
+// A session token is an HMAC, under a key drawn at startup, of the account
+// number, the stored password hash and the password. Slot id % AUTH_CACHE_SIZE
+// is guarded by the account's stripe lock.
+typedef struct {
+    int account;                // -1 = empty
+    unsigned char token[32];
+} AuthCacheEntry;
+
+// Buffered, checksummed byte stream over a file, in one direction. Counts
+// the bytes passed through it and keeps a running CRC-32 of them.
+typedef struct {
+    FILE* fp;
+    unsigned char buffer[SNAPSHOT_BUFFER_SIZE];
+    size_t position;
+    size_t length;              // bytes in buffer when reading
+    long long total;
+    unsigned int crc;
+    int failed;                 // a write failed, or a read ran out of data
+} ByteStream;
 
 typedef struct {
     char admin_username[20];
     char admin_password[50];
 } AdminCredentials;
 
+// Figures of the admin statistics report. Balances below
+// stats_bucket_floor[1] fall in bucket 0.
+typedef struct {
+    long long accounts;
+    long long type_count[STATS_TYPES];
+    Money type_balance[STATS_TYPES];
+    long long active_count;
+    Money active_balance;
+    long long below_minimum;        // accounts under their type's minimum balance
+    long long bucket_count[STATS_BUCKETS];
+} BankStats;
+
+// Timed events: the cheap core operations, of which a random sample is
+// timed, then the costly ones and the persistence steps, which all are
+enum {
+    METRIC_DEPOSIT,
+    METRIC_WITHDRAW,
+    METRIC_TRANSFER,
+    METRIC_HISTORY,
+    METRIC_LOGIN,
+    METRIC_CREATE,
+    METRIC_CHECKPOINT,
+    METRIC_FSYNC,
+    METRIC_TIMERS
+};
+
+enum {
+    COUNTER_JOURNAL_BYTES,
+    COUNTER_SNAPSHOT_BYTES,         // accounts.dat, either layout
+    COUNTER_LEDGER_BYTES,
+    COUNTER_LOOKUPS,                // account index lookups
+    COUNTER_LOOKUP_PROBES,          // index slots examined by them
+    METRIC_COUNTERS
+};
+
+// Metrics of the threads using one shard. Latencies are log-linear
+// histograms of nanoseconds, METRIC_SUB_BUCKETS buckets per power of two
+// (HDR style), so a percentile read from one is within an eighth of the
+// true value; see metric_bucket().
+typedef struct {
+    unsigned long long calls[METRIC_TIMERS];
+    unsigned long long errors[METRIC_TIMERS];
+    unsigned long long timed[METRIC_TIMERS];
+    unsigned long long total_ns[METRIC_TIMERS];     // of the timed calls
+    unsigned long long buckets[METRIC_TIMERS][METRIC_BUCKETS];
+    unsigned long long counters[METRIC_COUNTERS];
+    int shared;                     // taken by more than one thread
+} MetricShard;
+
+// Adds the figures of n consecutive accounts of a balance and a flags column
+typedef void (*StatsKernel)(const Money* balances, const unsigned char* flags, int n,
+                            const Money* minimum, BankStats* stats);
+
 // Function prototypes
 void main_menu();
 void admin_panel();
@@ -58,32 +737,430 @@ void change_password();
 void admin_view_all_accounts();
 void admin_block_account();
 void admin_unblock_account();
+void admin_view_statistics();
+int bank_stats(BankStats* stats);
+int run_batch(const char* path, const char* log_path);
+int run_eod(const char* business_date, int threads);
+int run_eod_bench(int max_threads);
+
+// Core operations
+int bank_deposit(BankAccount* account, Money amount, const char* description);
+int bank_withdraw(BankAccount* account, Money amount, const char* description);
+int bank_transfer(BankAccount* from, BankAccount* to, Money amount);
+int bank_set_active(BankAccount* account, int active);
+int bank_login(BankAccount* account, const char* password);
+int bank_change_password(BankAccount* account, const char* old_password, const char* new_password);
+int bank_create_account(const BankAccount* profile, int type, Money initial_deposit, BankAccount** created);
+int bank_create_accounts(const BankAccount* profiles, const int* types, const Money* deposits, int count,
+                         int* statuses, BankAccount** created);
+int bank_history(BankAccount* account, int skip, Transaction* page, int max);
+int bank_search(const char* query, int fuzzy, int skip, int* accounts, int max);
+int bank_search_usable(const char* query);
+const char* bank_status_message(int status);
+
+// Metrics
+unsigned long long metric_start(int timer);
+void metric_finish(int timer, unsigned long long start, int status);
+void metric_count(int counter, unsigned long long amount);
+void metrics_collect(MetricShard* total);
+int metrics_write(const char* path);
+int metrics_write_final(const char* path);
+void metrics_start_export();
+void admin_view_metrics();
 
 // Utility functions
-char* hash_password(const char* password);
+void hash_password(const char* password, char* hash);
+int verify_password(const char* password, const char* hash);
+int valid_password_hash(const char* hash);
+int password_needs_upgrade(const char* hash);
+int random_bytes(void* buffer, size_t length);
+void init_auth();
 int validate_account_number(const char* account_number);
 int validate_email(const char* email);
 int validate_mobile(const char* mobile);
-int validate_amount(double amount);
-void generate_account_number(char* account_number);
+int validate_amount(Money amount);
+int parse_money(const char* text, Money* amount);
+int read_money(Money* amount);
+char* format_money(Money amount, char* buffer);
+Money money_from_double(double amount);
+void upgrade_money(Money* field);
+void upgrade_transaction(Transaction* trans);
+void stamp_transaction(Transaction* trans);
+int generate_account_number(char* account_number);
+int account_sequence_of(const char* account_number);
 void get_current_date(char* date);
 void clear_screen();
 void pause_system();
+int read_key();
+void read_password(char* password, int size);
 BankAccount* find_account_by_username(const char* username);
 BankAccount* find_account_by_number(const char* account_number);
+int account_type(BankAccount* account);
+int account_is_active(BankAccount* account);
+void set_account_active(BankAccount* account, int active);
+const char* account_type_name(int type);
+Money min_balance_for(int type);
+int interest_rate_for(int type);
+int reserve_accounts(int count);
+AccountChunkData* alloc_chunk_data(int chunk);
+void mark_account_dirty(int id);
+int open_mapped_accounts();
+int save_mapped_accounts();
+int write_mapped_accounts(const char* path);
+int convert_to_mapped();
+int chunk_length(int chunk);
+BankAccount* append_account(const BankAccount* profile, int flags, Money balance);
 int load_accounts();
+int load_legacy_accounts(FILE* fp);
 int save_accounts();
-void add_transaction(BankAccount* account, const char* type, double amount, const char* description, const char* ref_account);
+LedgerSegment* ledger_alloc_segment();
+Transaction* ledger_append(TransactionHistory* history);
+Transaction* ledger_last(TransactionHistory* history);
+unsigned long long audit_append(int account, Transaction* entry, unsigned long long id);
+int audit_query(Money min_amount, Money max_amount, long long from, long long to, const char* reference,
+                int type, AuditEntry* results, int max_results);
+void admin_audit_query();
+void admin_search_customers();
+void admin_export_data();
+int history_type(const char* type);
+int history_query(BankAccount* account, long long from, long long to, int type, const char* reference,
+                  Transaction** results, int max_results);
+void view_statement();
+int load_ledger(long long length);
+int save_ledger();
+void ledger_ensure_loaded();
+int sync_file(FILE* fp);
+int sync_fd(int fd);
+int replace_file(const char* from, const char* to);
+void* map_file_region(int fd, long long offset, size_t length);
+void unmap_file_region(void* view, size_t length);
+int read_file_region(int fd, void* data, size_t length, long long offset);
+int write_file_region(int fd, const void* data, size_t length, long long offset);
+int resize_file(int fd, long long length);
+unsigned int crc32(const void* data, size_t len);
+unsigned int crc32_update(unsigned int crc, const void* data, size_t len);
+int load_compact_snapshot(FILE* fp);
+int save_compact_snapshot(FILE* fp);
+int journal_open();
+int journal_append(JournalRecord* rec);
+int journal_commit();
+int journal_replay(int* discarded);
+int checkpoint();
+int journal_reset();
+void checkpoint_if_needed();
+void journal_log_transaction(BankAccount* account);
+void journal_log_posting(BankAccount* account);
+void journal_log_eod(int business_date);
+void journal_log_transfer(BankAccount* from, BankAccount* to);
+void journal_log_status(BankAccount* account);
+void journal_log_password(BankAccount* account);
+void journal_log_create(BankAccount* account);
+unsigned int hash_string(const char* key);
+int index_insert(AccountIndex* index, int account);
+BankAccount* index_find(AccountIndex* index, const char* key);
+void index_rebuild();
+void index_ensure_ready();
+void search_reset();
+void add_transaction(BankAccount* account, const char* type, Money amount, const char* description,
+                     const char* ref_account, unsigned long long id);
+void init_locks();
+void lock_account(BankAccount* account);
+void unlock_account(BankAccount* account);
+void lock_account_pair(BankAccount* a, BankAccount* b);
+void unlock_account_pair(BankAccount* a, BankAccount* b);
+void lock_all_accounts();
+void unlock_all_accounts();
+AccountSnapshot* snapshot_begin();
+int snapshot_read(AccountSnapshot* snapshot, int chunk, SnapshotChunk* out);
+void snapshot_end(AccountSnapshot* snapshot);
+int snapshot_columns(Money** balances, unsigned char** flags);
+int export_data(const char* path, int what, int format, int shards, long long* rows, long long* bytes);
+double now_seconds();
+long peak_rss_kb();
+int run_server(int port, int workers);
+int run_loadgen(int max_workers);
+int run_contention(int max_threads);
+int run_stats_bench(int accounts);
+int run_login_bench(int max_threads);
+int run_audit_bench(int transactions);
+int run_search_bench(int accounts);
+int run_export(const char* what, const char* path, int shards);
+int run_export_bench(int accounts);
+int run_crash_test();
+int run_format_bench(int accounts);
+int run_convert();
+int run_bench(int max_accounts);
+int run_metrics_bench(int transfers);
+int run_snapshot_test();
+int run_create_bench(int accounts);
+int run_scale_test(int accounts);
+int import_customers(const char* path, FILE* rejects, int workers, long* accepted, long* rejected);
+int run_import(const char* path, const char* rejects_path, int workers);
+int run_import_bench(int rows);
+void fault_point();
 
 // Global variables
-BankAccount accounts[MAX_ACCOUNTS];
+AccountChunk** account_chunks = NULL;
+int account_chunk_count = 0;    // chunks allocated
+int account_chunk_capacity = 0; // slots in account_chunks
+AccountChunk** retired_chunk_directories[32]; // replaced directories, kept for lookups
+int retired_chunk_directory_count = 0;
 int total_accounts = 0;
+int storage_mode = STORAGE_SNAPSHOT;
+int use_mapped_storage = 0;     // --mmap: convert accounts.dat on startup
+int mapped_fd = -1;
+char* mapped_base = NULL;       // the mapping open_mapped_accounts() made, shared by the first chunks
+int mapped_base_chunks = 0;
+int eod_business_date = 0;      // last business date closed by an end-of-day run
+int account_sequence = 0;       // next account number's sequence; 0 until known
 BankAccount* current_user = NULL;
 AdminCredentials admin = {"admin", "admin"};
 
-// Simple hash function (MD5-like but simpler for demo)
-char* hash_password(const char* password) {
-    static char hash[50];
+// Journal state
+FILE* journal_fp = NULL;
+int journal_enabled = 1;        // off only for in-memory benchmarks
+unsigned long long journal_lsn = 0;
+int journal_records = 0;        // records appended since the last checkpoint
+
+// Ledger state
+LedgerSegment* segment_free_list = NULL;
+long long ledger_bytes = 0;     // length of ledger.dat covered by the snapshot
+int ledger_loaded = 0;          // histories are read from ledger.dat on first use
+int fault_countdown = 0;        // --crash-test: write points left before the process dies
+AuditLog audit_log = {NULL, 0, 0, 0, 0, NULL, NULL, NULL, 1};
+
+// Locking. Balances, flags and histories are guarded by their account's
+// stripe; the journal buffer and dirty page bitmaps by journal_lock; the
+// segment pool by ledger_lock; the global transaction log by audit_lock.
+// commit_lock orders journal syncs against checkpoints, and create_lock
+// serializes new accounts. Stripe locks are always taken before the others.
+// report_lock admits one snapshot at a time and snapshot_lock guards its
+// saved chunks; create_lock and report_lock come before the stripe locks.
+// eod_lock admits one end-of-day run at a time and guards eod_business_date
+// while one runs; it comes before all the others.
+bank_mutex account_locks[LOCK_STRIPES];
+bank_mutex journal_lock;
+bank_mutex commit_lock;
+bank_mutex ledger_lock;
+bank_mutex audit_lock;
+bank_mutex create_lock;
+bank_mutex report_lock;
+bank_mutex snapshot_lock;
+bank_mutex eod_lock;
+AccountSnapshot* active_snapshot = NULL;
+long long snapshot_chunks_saved = 0; // chunks copied by writers, for --snapshot-test
+
+// Metrics. Each thread takes a shard of its own on its first event, so the
+// hot paths update memory no other thread writes; once there are more than
+// METRIC_SHARDS threads, shards are handed out again and updated atomically.
+MetricShard metric_shards[METRIC_SHARDS];
+int metric_next_shard = 0;
+int metrics_enabled = 1;
+bank_mutex metrics_lock;        // one metrics_write() at a time
+int metrics_stopped = 0;        // set by metrics_write_final()
+static __thread MetricShard* metric_shard = NULL;
+static __thread unsigned int metric_seed = 0;
+unsigned long long journal_synced_lsn = 0;
+
+#define ACCOUNT_STRIPE(id) ((id) & (LOCK_STRIPES - 1))
+
+// Lookup indexes, built on first lookup and maintained by append_account()
+// under index_lock
+int index_ready = 0;
+AccountIndex number_index = {NULL, 0, offsetof(BankAccount, account_number)};
+AccountIndex username_index = {NULL, 0, offsetof(BankAccount, username)};
+bank_mutex index_lock;
+
+// Customer search index, built on first search and maintained by
+// append_account() under search_lock
+SearchPostings* search_postings = NULL;
+int search_ready = 0;
+long long search_bytes = 0;     // memory held by the index
+bank_mutex search_lock;
+static const size_t search_fields[] = {
+    offsetof(BankAccount, name), offsetof(BankAccount, username),
+    offsetof(BankAccount, email), offsetof(BankAccount, mobile)
+};
+
+HmacSha256 auth_key;             // keys session tokens; random per process
+AuthCacheEntry auth_cache[AUTH_CACHE_SIZE];
+
+static const unsigned int sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(unsigned int* state, const unsigned char* block) {
+    unsigned int w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (unsigned int)block[i * 4] << 24 | (unsigned int)block[i * 4 + 1] << 16 |
+               (unsigned int)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        unsigned int s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        unsigned int s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+    unsigned int e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        unsigned int t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        unsigned int t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void sha256_init(Sha256* ctx) {
+    static const unsigned int initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+}
+
+static void sha256_update(Sha256* ctx, const void* data, size_t length) {
+    const unsigned char* p = data;
+    while (length > 0) {
+        size_t used = ctx->length % 64;
+        size_t take = 64 - used < length ? 64 - used : length;
+        memcpy(ctx->block + used, p, take);
+        ctx->length += take;
+        p += take;
+        length -= take;
+        if (ctx->length % 64 == 0) {
+            sha256_compress(ctx->state, ctx->block);
+        }
+    }
+}
+
+static void sha256_final(Sha256* ctx, unsigned char* digest) {
+    unsigned long long bits = ctx->length * 8;
+    unsigned char pad = 0x80, zero = 0, length[8];
+    
+    sha256_update(ctx, &pad, 1);
+    while (ctx->length % 64 != 56) {
+        sha256_update(ctx, &zero, 1);
+    }
+    for (int i = 0; i < 8; i++) {
+        length[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    sha256_update(ctx, length, 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+static void hmac_init(HmacSha256* hmac, const void* key, size_t length) {
+    unsigned char pad[64] = {0};
+    
+    if (length > sizeof(pad)) {
+        Sha256 ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, key, length);
+        sha256_final(&ctx, pad);
+    } else {
+        memcpy(pad, key, length);
+    }
+    
+    for (int i = 0; i < 64; i++) pad[i] ^= 0x36;
+    sha256_init(&hmac->inner);
+    sha256_update(&hmac->inner, pad, sizeof(pad));
+    for (int i = 0; i < 64; i++) pad[i] ^= 0x36 ^ 0x5c;
+    sha256_init(&hmac->outer);
+    sha256_update(&hmac->outer, pad, sizeof(pad));
+}
+
+// Finishes an HMAC started with hmac_copy() and fed with sha256_update()
+static void hmac_final(const HmacSha256* hmac, Sha256* inner, unsigned char* mac) {
+    unsigned char digest[32];
+    Sha256 outer = hmac->outer;
+    
+    sha256_final(inner, digest);
+    sha256_update(&outer, digest, sizeof(digest));
+    sha256_final(&outer, mac);
+}
+
+// PBKDF2-HMAC-SHA256 with a single output block (key_length <= 32)
+static void pbkdf2_sha256(const char* password, const unsigned char* salt, size_t salt_length,
+                          long iterations, unsigned char* key, size_t key_length) {
+    static const unsigned char block_index[4] = {0, 0, 0, 1};
+    HmacSha256 hmac;
+    unsigned char u[32], t[32];
+    
+    hmac_init(&hmac, password, strlen(password));
+    Sha256 inner = hmac.inner;
+    sha256_update(&inner, salt, salt_length);
+    sha256_update(&inner, block_index, sizeof(block_index));
+    hmac_final(&hmac, &inner, u);
+    memcpy(t, u, sizeof(t));
+    
+    for (long i = 1; i < iterations; i++) {
+        inner = hmac.inner;
+        sha256_update(&inner, u, sizeof(u));
+        hmac_final(&hmac, &inner, u);
+        for (int j = 0; j < 32; j++) t[j] ^= u[j];
+    }
+    memcpy(key, t, key_length);
+}
+
+static const char base64_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789./";
+
+// Encodes length bytes (a multiple of 3) without padding
+static char* base64_encode(const unsigned char* data, size_t length, char* text) {
+    for (size_t i = 0; i < length; i += 3) {
+        unsigned int v = (unsigned int)data[i] << 16 | (unsigned int)data[i + 1] << 8 | data[i + 2];
+        *text++ = base64_digits[v >> 18];
+        *text++ = base64_digits[(v >> 12) & 63];
+        *text++ = base64_digits[(v >> 6) & 63];
+        *text++ = base64_digits[v & 63];
+    }
+    *text = '\0';
+    return text;
+}
+
+static int base64_decode(const char* text, unsigned char* data, size_t length) {
+    for (size_t i = 0; i < length; i += 3) {
+        unsigned int v = 0;
+        for (int k = 0; k < 4; k++) {
+            const char* digit = *text ? strchr(base64_digits, *text++) : NULL;
+            if (digit == NULL) return 0;
+            v = v << 6 | (unsigned int)(digit - base64_digits);
+        }
+        data[i] = (unsigned char)(v >> 16);
+        data[i + 1] = (unsigned char)(v >> 8);
+        data[i + 2] = (unsigned char)v;
+    }
+    return 1;
+}
+
+static int equal_constant_time(const void* a, const void* b, size_t length) {
+    const unsigned char* x = a;
+    const unsigned char* y = b;
+    unsigned char difference = 0;
+    for (size_t i = 0; i < length; i++) {
+        difference |= x[i] ^ y[i];
+    }
+    return difference == 0;
+}
+
+// Hash of accounts created before the KDF, still accepted until the
+// account's next login replaces it
+static void legacy_hash_password(const char* password, char* hash) {
     unsigned long hash_value = 5381;
     int c;
     
@@ -92,29 +1169,297 @@ char* hash_password(const char* password) {
     }
     
     sprintf(hash, "%lx", hash_value);
-    return hash;
 }
 
+int random_bytes(void* buffer, size_t length) {
+    unsigned char* p = buffer;
+#ifdef _WIN32
+    while (length > 0) {
+        unsigned int value;
+        if (rand_s(&value) != 0) return 0;
+        size_t take = length < sizeof(value) ? length : sizeof(value);
+        memcpy(p, &value, take);
+        p += take;
+        length -= take;
+    }
+    return 1;
+#else
+    FILE* fp = fopen("/dev/urandom", "rb");
+    if (fp == NULL) return 0;
+    int ok = fread(p, 1, length, fp) == length;
+    fclose(fp);
+    return ok;
+#endif
+}
+
+// Writes a salted PBKDF2 hash of password into hash (at least 50 bytes).
+// Safe to call from any thread.
+void hash_password(const char* password, char* hash) {
+    unsigned char salt[PASSWORD_SALT_BYTES], key[PASSWORD_KEY_BYTES];
+    
+    if (!random_bytes(salt, sizeof(salt))) {
+        // No system randomness: fall back on the clock and this stack address
+        unsigned long long seed = (unsigned long long)time(NULL) ^ (unsigned long long)(size_t)&salt;
+        seed ^= (unsigned long long)(now_seconds() * 1e9);
+        for (size_t i = 0; i < sizeof(salt); i++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            salt[i] = (unsigned char)(seed >> 56);
+        }
+    }
+    pbkdf2_sha256(password, salt, sizeof(salt), 1L << PASSWORD_KDF_COST, key, sizeof(key));
+    
+    char* p = hash + sprintf(hash, PASSWORD_HASH_PREFIX "%02d$", PASSWORD_KDF_COST);
+    p = base64_encode(salt, sizeof(salt), p);
+    *p++ = '$';
+    base64_encode(key, sizeof(key), p);
+}
+
+// Splits a "$p$" hash into its cost, salt and key; 0 if it is malformed
+static int parse_password_hash(const char* hash, int* cost, unsigned char* salt, unsigned char* key) {
+    const char* p = hash + strlen(PASSWORD_HASH_PREFIX);
+    *cost = atoi(p);
+    return *cost >= 1 && *cost <= 30 && (p = strchr(p, '$')) != NULL &&
+           base64_decode(p + 1, salt, PASSWORD_SALT_BYTES) && (p = strchr(p + 1, '$')) != NULL &&
+           base64_decode(p + 1, key, PASSWORD_KEY_BYTES);
+}
+
+// Checks password against a stored hash of either format, in time that does
+// not depend on where they differ
+int verify_password(const char* password, const char* hash) {
+    if (strncmp(hash, PASSWORD_HASH_PREFIX, strlen(PASSWORD_HASH_PREFIX)) != 0) {
+        char legacy[50];
+        legacy_hash_password(password, legacy);
+        return strlen(legacy) == strlen(hash) && equal_constant_time(legacy, hash, strlen(hash));
+    }
+    
+    unsigned char salt[PASSWORD_SALT_BYTES], expected[PASSWORD_KEY_BYTES], key[PASSWORD_KEY_BYTES];
+    int cost;
+    if (!parse_password_hash(hash, &cost, salt, expected)) return 0;
+    pbkdf2_sha256(password, salt, sizeof(salt), 1L << cost, key, sizeof(key));
+    return equal_constant_time(key, expected, sizeof(key));
+}
+
+// Whether hash is one verify_password() can check: a "$p$" hash or a
+// legacy one, which is the hex of an unsigned long
+int valid_password_hash(const char* hash) {
+    if (strncmp(hash, PASSWORD_HASH_PREFIX, strlen(PASSWORD_HASH_PREFIX)) == 0) {
+        unsigned char salt[PASSWORD_SALT_BYTES], key[PASSWORD_KEY_BYTES];
+        int cost;
+        return parse_password_hash(hash, &cost, salt, key);
+    }
+    size_t length = strspn(hash, "0123456789abcdef");
+    return length > 0 && length <= 2 * sizeof(unsigned long) && hash[length] == '\0';
+}
+
+// Legacy hashes, and hashes of a lower cost than PASSWORD_KDF_COST, are
+// rehashed at the next successful login
+int password_needs_upgrade(const char* hash) {
+    if (strncmp(hash, PASSWORD_HASH_PREFIX, strlen(PASSWORD_HASH_PREFIX)) != 0) return 1;
+    return atoi(hash + strlen(PASSWORD_HASH_PREFIX)) < PASSWORD_KDF_COST;
+}
+
+void init_auth() {
+    unsigned char key[32];
+    if (!random_bytes(key, sizeof(key))) {
+        // Tokens only live as long as the process; a weak key still keeps
+        // them unforgeable without it
+        unsigned long long seed = (unsigned long long)time(NULL) ^ (unsigned long long)(size_t)key;
+        memcpy(key, &seed, sizeof(seed));
+    }
+    hmac_init(&auth_key, key, sizeof(key));
+    for (int i = 0; i < AUTH_CACHE_SIZE; i++) {
+        auth_cache[i].account = -1;
+    }
+}
+
+static void session_token(BankAccount* account, const char* password, unsigned char* token) {
+    Sha256 inner = auth_key.inner;
+    sha256_update(&inner, account->account_number, strlen(account->account_number) + 1);
+    sha256_update(&inner, account->password_hash, strlen(account->password_hash) + 1);
+    sha256_update(&inner, password, strlen(password));
+    hmac_final(&auth_key, &inner, token);
+}
+
+// The formatted minute is cached per thread: localtime takes a process-wide
+// lock, which concurrent operations would otherwise all queue on
 void get_current_date(char* date) {
+    static __thread time_t cached_minute = -1;
+    static __thread char cached[64];
     time_t now = time(NULL);
-    struct tm* t = localtime(&now);
-    sprintf(date, "%02d/%02d/%04d %02d:%02d", 
-            t->tm_mday, t->tm_mon + 1, t->tm_year + 1900,
-            t->tm_hour, t->tm_min);
+    
+    if (now / 60 != cached_minute) {
+        struct tm t;
+#ifdef _WIN32
+        localtime_s(&t, &now);
+#else
+        localtime_r(&now, &t);
+#endif
+        sprintf(cached, "%02d/%02d/%04d %02d:%02d", 
+                t.tm_mday, t.tm_mon + 1, t.tm_year + 1900,
+                t.tm_hour, t.tm_min);
+        cached_minute = now / 60;
+    }
+    strcpy(date, cached);
+}
+
+// Luhn check digit of a 9-digit sequence
+static int account_check_digit(int sequence) {
+    int sum = 0;
+    for (int position = 0; sequence > 0; position++, sequence /= 10) {
+        int digit = sequence % 10;
+        if (position % 2 == 0) digit = digit * 2 > 9 ? digit * 2 - 9 : digit * 2;
+        sum += digit;
+    }
+    return (10 - sum % 10) % 10;
+}
+
+// The sequence of a number given by generate_account_number(), or -1 for
+// any other number. Numbers from before the sequence were random and always
+// start with 0 after SAR, so they can never be taken for one.
+int account_sequence_of(const char* account_number) {
+    if (strncmp(account_number, "SAR", 3) != 0) return -1;
+    int sequence = 0;
+    for (int i = 3; i < 12; i++) {
+        if (!isdigit((unsigned char)account_number[i])) return -1;
+        sequence = sequence * 10 + (account_number[i] - '0');
+    }
+    if (sequence < ACCOUNT_SEQUENCE_FIRST || account_number[12] - '0' != account_check_digit(sequence) ||
+        account_number[13] != '\0') {
+        return -1;
+    }
+    return sequence;
+}
+
+// Takes the next number of the sequence, which the caller serializes with
+// create_lock. Every number ever given out is below account_sequence, so no
+// lookup is needed. Returns 0 once the sequence is used up.
+int generate_account_number(char* account_number) {
+    if (account_sequence < ACCOUNT_SEQUENCE_FIRST) account_sequence = ACCOUNT_SEQUENCE_FIRST;
+    if (account_sequence > ACCOUNT_SEQUENCE_LAST) return 0;
+    int sequence = account_sequence++;
+    sprintf(account_number, "SAR%09d%d", sequence, account_check_digit(sequence));
+    return 1;
+}
+
+// Files from before the sequence was stored in the header leave it unknown;
+// it is then one past the highest sequenced number in the bank
+static void account_sequence_recover() {
+    account_sequence = ACCOUNT_SEQUENCE_FIRST;
+    for (int id = 0; id < total_accounts; id++) {
+        int sequence = account_sequence_of(ACCOUNT(id).account_number);
+        if (sequence >= account_sequence) account_sequence = sequence + 1;
+    }
+}
+
+// Terminal. Screens are cleared with ANSI escape sequences, and keys are read
+// one at a time without echo, the terminal being in raw mode only while a
+// key or password is read. Enter is '\r' and Backspace '\b' on every system.
+#ifdef _WIN32
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+
+static int terminal_raw(int on) {
+    (void)on;
+    return 1;
+}
+
+// Function and arrow keys arrive as two codes and are skipped
+static int terminal_key(int raw) {
+    (void)raw;
+    int ch;
+    while ((ch = _getch()) == 0 || ch == 0xE0) {
+        _getch();
+    }
+    return ch;
+}
+
+static int terminal_is_screen() {
+    static int enabled = -1;
+    if (enabled < 0) {
+        HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode;
+        enabled = _isatty(_fileno(stdout)) && GetConsoleMode(console, &mode) &&
+                  SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    }
+    return enabled;
+}
+#else
+static struct termios terminal_saved;
+
+// Switches stdin to unechoed single-key input, or back. Returns 0 when
+// stdin is not a terminal, e.g. a pipe, and is then read as it is.
+static int terminal_raw(int on) {
+    if (!on) return tcsetattr(STDIN_FILENO, TCSANOW, &terminal_saved) == 0;
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &terminal_saved) != 0) return 0;
+    
+    struct termios raw = terminal_saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_iflag &= ~ICRNL;
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
 }
 
-void generate_account_number(char* account_number) {
-    srand(time(NULL));
-    sprintf(account_number, "SAR%010d", rand() % 1000000000);
+// In raw mode Enter arrives as '\r', so a '\n' can only be the end of the
+// line the last scanf() read, and is skipped
+static int terminal_key(int raw) {
+    int ch;
+    do {
+        ch = getchar();
+    } while (raw && ch == '\n');
+    return ch == 127 ? '\b' : ch;
 }
 
+static int terminal_is_screen() {
+    return isatty(STDOUT_FILENO);
+}
+#endif
+
 void clear_screen() {
-    system("cls");
+    if (terminal_is_screen()) {
+        fputs("\033[H\033[2J", stdout);
+        fflush(stdout);
+    }
+}
+
+// Waits for one key and returns it, or EOF at the end of input
+int read_key() {
+    fflush(stdout);
+    int raw = terminal_raw(1);
+    int ch = terminal_key(raw);
+    if (raw) terminal_raw(0);
+    return ch;
 }
 
 void pause_system() {
     printf("\nPress any key to continue...");
-    getch();
+    read_key();
+}
+
+// Reads a password up to Enter, echoing '*' per character. Characters
+// beyond size - 1 are dropped.
+void read_password(char* password, int size) {
+    fflush(stdout);
+    int raw = terminal_raw(1);
+    int length = 0;
+    for (;;) {
+        int ch = terminal_key(raw);
+        if (ch == EOF || ch == '\r' || (ch == '\n' && length > 0)) break;
+        if (ch == '\n') continue;  // end of the line the last scanf() read
+        if (ch == '\b') {
+            if (length > 0) {
+                printf("\b \b");
+                length--;
+            }
+        } else if (length < size - 1) {
+            password[length++] = ch;
+            printf("*");
+        }
+        fflush(stdout);
+    }
+    password[length] = '\0';
+    if (raw) terminal_raw(0);
 }
 
 int validate_email(const char* email) {
@@ -145,777 +1490,7752 @@ int validate_mobile(const char* mobile) {
     return 1;
 }
 
-int validate_amount(double amount) {
-    return (amount > 0 && amount <= 1000000);
+int validate_amount(Money amount) {
+    return (amount > 0 && amount <= MAX_AMOUNT);
 }
 
-BankAccount* find_account_by_username(const char* username) {
-    for (int i = 0; i < total_accounts; i++) {
-        if (strcmp(accounts[i].username, username) == 0) {
-            return &accounts[i];
+// Parses rupees with at most two decimals ("1500", "99.5", "0.75") exactly,
+// without going through a double
+int parse_money(const char* text, Money* amount) {
+    Money rupees = 0;
+    int digits = 0;
+    
+    while (isdigit((unsigned char)*text)) {
+        if (++digits > 13) return 0;
+        rupees = rupees * 10 + (*text++ - '0');
+    }
+    
+    Money paise = 0;
+    if (*text == '.') {
+        text++;
+        for (int i = 0; i < 2; i++) {
+            paise *= 10;
+            if (isdigit((unsigned char)*text)) {
+                paise += *text++ - '0';
+                digits++;
+            }
         }
     }
-    return NULL;
+    if (*text != '\0' || digits == 0) return 0;
+    
+    *amount = rupees * MINOR_UNITS + paise;
+    return 1;
 }
 
-BankAccount* find_account_by_number(const char* account_number) {
-    for (int i = 0; i < total_accounts; i++) {
-        if (strcmp(accounts[i].account_number, account_number) == 0) {
-            return &accounts[i];
-        }
-    }
-    return NULL;
+// Reads an amount typed by the user; anything unparsable reads as 0, which
+// validate_amount() rejects
+int read_money(Money* amount) {
+    char text[32];
+    
+    *amount = 0;
+    if (scanf("%31s", text) != 1) return 0;
+    return parse_money(text, amount);
 }
 
-void add_transaction(BankAccount* account, const char* type, double amount, const char* description, const char* ref_account) {
-    if (account->transaction_count < MAX_TRANSACTIONS) {
-        Transaction* trans = &account->transactions[account->transaction_count];
-        get_current_date(trans->date);
-        strcpy(trans->type, type);
-        trans->amount = amount;
-        trans->balance_after = account->balance;
-        strcpy(trans->description, description);
-        if (ref_account) {
-            strcpy(trans->reference_account, ref_account);
-        } else {
-            strcpy(trans->reference_account, "N/A");
-        }
-        account->transaction_count++;
-    }
+char* format_money(Money amount, char* buffer) {
+    Money magnitude = amount < 0 ? -amount : amount;
+    sprintf(buffer, "%s%lld.%02lld", amount < 0 ? "-" : "",
+            magnitude / MINOR_UNITS, magnitude % MINOR_UNITS);
+    return buffer;
 }
 
-int load_accounts() {
-    FILE* fp = fopen("accounts.dat", "rb");
-    if (fp == NULL) {
-        return 0; // File doesn't exist yet
-    }
+// Rounds an amount from a file written before Money to the nearest paisa
+Money money_from_double(double amount) {
+    return (Money)(amount * MINOR_UNITS + (amount < 0 ? -0.5 : 0.5));
+}
+
+// Converts, in place, a Money field that still holds the bits of the double
+// an older version wrote there
+void upgrade_money(Money* field) {
+    double value;
+    memcpy(&value, field, sizeof(value));
+    *field = money_from_double(value);
+}
+
+// Converts a transaction from a file written before Money (and before
+// timestamps)
+void upgrade_transaction(Transaction* trans) {
+    upgrade_money(&trans->amount);
+    upgrade_money(&trans->balance_after);
+    stamp_transaction(trans);
+}
+
+// Sets the timestamp of a transaction from before timestamps from its
+// "DD/MM/YYYY HH:MM" local date
+void stamp_transaction(Transaction* trans) {
+    struct tm local = {0};
     
-    fread(&total_accounts, sizeof(int), 1, fp);
-    fread(accounts, sizeof(BankAccount), total_accounts, fp);
-    fclose(fp);
-    return 1;
+    trans->timestamp = 0;
+    if (sscanf(trans->date, "%d/%d/%d %d:%d", &local.tm_mday, &local.tm_mon, &local.tm_year,
+               &local.tm_hour, &local.tm_min) == 5) {
+        local.tm_mon -= 1;
+        local.tm_year -= 1900;
+        local.tm_isdst = -1;
+        time_t seconds = mktime(&local);
+        if (seconds > 0) trans->timestamp = (unsigned int)seconds;
+    }
 }
 
-int save_accounts() {
-    FILE* fp = fopen("accounts.dat", "wb");
-    if (fp == NULL) {
+// Builds the lookup indexes on first use; one thread builds them while any
+// others wait
+void index_ensure_ready() {
+    if (__atomic_load_n(&index_ready, __ATOMIC_ACQUIRE)) return;
+    mutex_lock(&index_lock);
+    if (!index_ready) index_rebuild();
+    mutex_unlock(&index_lock);
+}
+
+BankAccount* find_account_by_username(const char* username) {
+    index_ensure_ready();
+    return index_find(&username_index, username);
+}
+
+BankAccount* find_account_by_number(const char* account_number) {
+    index_ensure_ready();
+    return index_find(&number_index, account_number);
+}
+
+// FNV-1a
+unsigned int hash_string(const char* key) {
+    unsigned int hash = 2166136261u;
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const char* index_key(AccountIndex* index, int account) {
+    return (const char*)&ACCOUNT(account) + index->key_offset;
+}
+
+// Re-inserts every entry into a table of twice the size and publishes it.
+// The old table is retired, not freed: lookups may still be probing it.
+static int index_grow(AccountIndex* index) {
+    IndexTable* old = index->table;
+    int new_capacity = old != NULL ? old->capacity * 2 : INDEX_MIN_CAPACITY;
+    IndexTable* table = malloc(sizeof(IndexTable) + new_capacity * sizeof(IndexSlot));
+    if (table == NULL) return 0;
+    
+    table->capacity = new_capacity;
+    table->retired = old;
+    for (int i = 0; i < new_capacity; i++) {
+        table->slots[i].account = -1;
+    }
+    for (int i = 0; old != NULL && i < old->capacity; i++) {
+        if (old->slots[i].account < 0) continue;
+        unsigned int pos = old->slots[i].hash & (new_capacity - 1);
+        while (table->slots[pos].account >= 0) {
+            pos = (pos + 1) & (new_capacity - 1);
+        }
+        table->slots[pos] = old->slots[i];
+    }
+    
+    __atomic_store_n(&index->table, table, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Caller holds index_lock, or is the only thread
+int index_insert(AccountIndex* index, int account) {
+    // Keep the load factor at or below 1/2 so probe chains stay short
+    if ((index->table == NULL || (index->count + 1) * 2 > index->table->capacity) &&
+        !index_grow(index)) {
+        return 0;
+    }
+    
+    IndexTable* table = index->table;
+    unsigned int hash = hash_string(index_key(index, account));
+    unsigned int pos = hash & (table->capacity - 1);
+    while (table->slots[pos].account >= 0) {
+        pos = (pos + 1) & (table->capacity - 1);
+    }
+    // The hash goes in first; storing the id publishes the slot
+    table->slots[pos].hash = hash;
+    __atomic_store_n(&table->slots[pos].account, account, __ATOMIC_RELEASE);
+    index->count++;
+    return 1;
+}
+
+BankAccount* index_find(AccountIndex* index, const char* key) {
+    IndexTable* table = __atomic_load_n(&index->table, __ATOMIC_ACQUIRE);
+    if (table == NULL) return NULL;
+    
+    unsigned int hash = hash_string(key);
+    unsigned int pos = hash & (table->capacity - 1);
+    BankAccount* found = NULL;
+    int probes = 1;
+    int account;
+    while ((account = __atomic_load_n(&table->slots[pos].account, __ATOMIC_ACQUIRE)) >= 0) {
+        if (table->slots[pos].hash == hash && strcmp(index_key(index, account), key) == 0) {
+            found = &ACCOUNT(account);
+            break;
+        }
+        pos = (pos + 1) & (table->capacity - 1);
+        probes++;
+    }
+    metric_count(COUNTER_LOOKUPS, 1);
+    metric_count(COUNTER_LOOKUP_PROBES, probes);
+    return found;
+}
+
+// Only runs while index_ready is 0, when no lookup can be using the tables
+void index_rebuild() {
+    AccountIndex* indexes[] = {&number_index, &username_index};
+    
+    for (int i = 0; i < 2; i++) {
+        while (indexes[i]->table != NULL) {
+            IndexTable* retired = indexes[i]->table->retired;
+            free(indexes[i]->table);
+            indexes[i]->table = retired;
+        }
+        indexes[i]->count = 0;
+        for (int j = 0; j < total_accounts; j++) {
+            index_insert(indexes[i], j);
+        }
+    }
+    __atomic_store_n(&index_ready, 1, __ATOMIC_RELEASE);
+}
+
+// Symbol of a character in the search alphabet: 0 for a boundary, then the
+// letters in either case and the digits
+static int search_symbol(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return c - 'a' + 1;
+    if (c >= 'A' && c <= 'Z') return c - 'A' + 1;
+    if (c >= '0' && c <= '9') return c - '0' + 27;
+    return 0;
+}
+
+// Normalizes text into at most max symbols, with a boundary on either side
+// if pad is set. Returns the number of symbols.
+static int search_normalize(const char* text, int pad, unsigned char* out, int max) {
+    int length = 0;
+    if (pad) out[length++] = 0;
+    for (; *text && length < max - 1; text++) {
+        int symbol = search_symbol((unsigned char)*text);
+        if (symbol == 0 && length > 0 && out[length - 1] == 0) continue;
+        out[length++] = symbol;
+    }
+    if (pad && out[length - 1] != 0) out[length++] = 0;
+    return length;
+}
+
+// Appends an account to a posting list; repeats of the last one are dropped
+static int search_post(SearchPostings* list, int account) {
+    if (list->last == account) return 1;
+    if (list->length + 5 > list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : SEARCH_MIN_POSTINGS;
+        unsigned char* bytes = realloc(list->bytes, capacity);
+        if (bytes == NULL) return 0;
+        search_bytes += capacity - list->capacity;
+        list->bytes = bytes;
+        list->capacity = capacity;
+    }
+    unsigned int gap = account - list->last - 1;
+    while (gap >= 0x80) {
+        list->bytes[list->length++] = (unsigned char)(gap | 0x80);
+        gap >>= 7;
+    }
+    list->bytes[list->length++] = (unsigned char)gap;
+    list->last = account;
+    list->count++;
+    return 1;
+}
+
+static int search_insert(int account) {
+    unsigned char symbols[SEARCH_FIELD_MAX];
+    for (int f = 0; f < 4; f++) {
+        int length = search_normalize((const char*)&ACCOUNT(account) + search_fields[f], 1, symbols, SEARCH_FIELD_MAX);
+        for (int i = 0; i + 2 < length; i++) {
+            if (!search_post(&search_postings[SEARCH_GRAM(symbols + i)], account)) return 0;
+        }
+    }
+    return 1;
+}
+
+// Drops the index; the next search builds it again
+void search_reset() {
+    if (search_postings != NULL) {
+        for (int g = 0; g < SEARCH_GRAMS; g++) {
+            free(search_postings[g].bytes);
+        }
+        free(search_postings);
+        search_postings = NULL;
+    }
+    search_bytes = 0;
+    search_ready = 0;
+}
+
+// Caller holds search_lock
+static int search_build() {
+    search_reset();
+    search_postings = calloc(SEARCH_GRAMS, sizeof(SearchPostings));
+    if (search_postings == NULL) return 0;
+    search_bytes = SEARCH_GRAMS * sizeof(SearchPostings);
+    for (int g = 0; g < SEARCH_GRAMS; g++) {
+        search_postings[g].last = -1;
+    }
+    for (int id = 0; id < total_accounts; id++) {
+        if (!search_insert(id)) {
+            search_reset();
+            return 0;
+        }
+    }
+    search_ready = 1;
+    return 1;
+}
+
+static void search_cursor_next(SearchCursor* cursor) {
+    if (cursor->next == cursor->end) {
+        cursor->account = SEARCH_END;
+        return;
+    }
+    unsigned int gap = 0;
+    int shift = 0;
+    do {
+        gap |= (unsigned int)(*cursor->next & 0x7F) << shift;
+        shift += 7;
+    } while (*cursor->next++ & 0x80);
+    cursor->account += gap + 1;
+}
+
+// Moves every cursor to the first account at or after their current ones
+// that is in all their lists, and returns it
+static int search_intersect(SearchCursor* cursors, int count) {
+    int account = cursors[0].account;
+    for (int c = 0, agreed = 0; agreed < count && account != SEARCH_END; c = (c + 1) % count) {
+        while (cursors[c].account < account) {
+            search_cursor_next(&cursors[c]);
+        }
+        if (cursors[c].account > account) {
+            account = cursors[c].account;
+            agreed = 1;
+        } else {
+            agreed++;
+        }
+    }
+    return account;
+}
+
+// Normalizes a query. One that is too short for a trigram is taken as the
+// start of a word. Returns its length, or 0 if it has under SEARCH_MIN_QUERY
+// letters and digits: a single one would need every account scanned.
+static int search_query(const char* query, unsigned char* symbols) {
+    int length = search_normalize(query, 0, symbols + 1, SEARCH_MAX_QUERY + 1);
+    if (length < 3 && length > 0 && symbols[1] != 0) {
+        symbols[0] = 0;
+        length++;
+    } else {
+        memmove(symbols, symbols + 1, length);
+    }
+    return length >= 3 ? length : 0;
+}
+
+// Whether the query occurs in text with at most one symbol added, removed
+// or changed: the edit distance to the best-matching substring, column by
+// column, where a match may start at any symbol
+static int search_near(const unsigned char* text, int n, const unsigned char* query, int m) {
+    int column[SEARCH_MAX_QUERY + 1];
+    for (int i = 0; i <= m; i++) {
+        column[i] = i;
+    }
+    for (int j = 0; j < n; j++) {
+        int diagonal = column[0];
+        for (int i = 1; i <= m; i++) {
+            int best = diagonal + (query[i - 1] != text[j]);
+            if (column[i] + 1 < best) best = column[i] + 1;
+            if (column[i - 1] + 1 < best) best = column[i - 1] + 1;
+            diagonal = column[i];
+            column[i] = best;
+        }
+        if (column[m] <= 1) return 1;
+    }
+    return 0;
+}
+
+static int search_matches(int account, const unsigned char* query, int length, int fuzzy) {
+    unsigned char text[SEARCH_FIELD_MAX];
+    for (int f = 0; f < 4; f++) {
+        int n = search_normalize((const char*)&ACCOUNT(account) + search_fields[f], 1, text, SEARCH_FIELD_MAX);
+        if (fuzzy) {
+            if (search_near(text, n, query, length)) return 1;
+            continue;
+        }
+        for (int i = 0; i + length <= n; i++) {
+            if (text[i] == query[0] && memcmp(text + i, query, length) == 0) return 1;
+        }
+    }
+    return 0;
+}
+
+// Records a change in the account's history and the global log, as part of
+// transaction id (0 for a new transaction)
+void add_transaction(BankAccount* account, const char* type, Money amount, const char* description,
+                     const char* ref_account, unsigned long long id) {
+    ledger_ensure_loaded();
+    TransactionHistory* history = &HISTORY(account->id);
+    
+    // Keep timestamps in entry order even if the clock is set back
+    unsigned int timestamp = (unsigned int)time(NULL);
+    Transaction* last = ledger_last(history);
+    if (last != NULL && last->timestamp > timestamp) {
+        timestamp = last->timestamp;
+    }
+    
+    Transaction* trans = ledger_append(history);
+    if (trans == NULL) {
+        printf("Error: Out of memory for transaction history!\n");
+        return;
+    }
+    
+    trans->timestamp = timestamp;
+    get_current_date(trans->date);
+    strcpy(trans->type, type);
+    trans->amount = amount;
+    trans->balance_after = BALANCE(account->id);
+    strcpy(trans->description, description);
+    if (ref_account) {
+        strcpy(trans->reference_account, ref_account);
+    } else {
+        strcpy(trans->reference_account, "N/A");
+    }
+    audit_append(account->id, trans, id);
+}
+
+// Segments are carved out of large blocks and recycled through a free list,
+// so growing a history never calls malloc per transaction.
+LedgerSegment* ledger_alloc_segment() {
+    mutex_lock(&ledger_lock);
+    if (segment_free_list == NULL) {
+        LedgerSegment* block = malloc(LEDGER_POOL_BLOCK * sizeof(LedgerSegment));
+        if (block == NULL) {
+            mutex_unlock(&ledger_lock);
+            return NULL;
+        }
+        for (int i = 0; i < LEDGER_POOL_BLOCK; i++) {
+            block[i].prev = segment_free_list;
+            segment_free_list = &block[i];
+        }
+    }
+    
+    LedgerSegment* segment = segment_free_list;
+    segment_free_list = segment->prev;
+    mutex_unlock(&ledger_lock);
+    segment->prev = NULL;
+    segment->count = 0;
+    return segment;
+}
+
+// Returns the slot for a new, newest entry in the history
+Transaction* ledger_append(TransactionHistory* history) {
+    if (history->head == NULL || history->head->count == LEDGER_SEGMENT_SIZE) {
+        LedgerSegment* segment = ledger_alloc_segment();
+        if (segment == NULL) return NULL;
+        segment->prev = history->head;
+        history->head = segment;
+    }
+    
+    Transaction* trans = &history->head->entries[history->head->count++];
+    memset(trans, 0, sizeof(Transaction));
+    history->transaction_count++;
+    return trans;
+}
+
+Transaction* ledger_last(TransactionHistory* history) {
+    if (history->head == NULL) return NULL;
+    return &history->head->entries[history->head->count - 1];
+}
+
+static const char* const history_type_names[HISTORY_TYPES] = {
+    "DEPOSIT", "WITHDRAW", "TRANSFER_IN", "TRANSFER_OUT", "INTEREST", "FEE", "OTHER"
+};
+
+int history_type(const char* type) {
+    for (int t = 0; t < HISTORY_OTHER; t++) {
+        if (strcmp(type, history_type_names[t]) == 0) return t;
+    }
+    return HISTORY_OTHER;
+}
+
+static int grow_array(void** items, int* capacity, int needed, size_t item_size) {
+    if (needed <= *capacity) return 1;
+    int new_capacity = *capacity ? *capacity : HISTORY_INDEX_MIN_CAPACITY;
+    while (new_capacity < needed) new_capacity *= 2;
+    void* grown = realloc(*items, (size_t)new_capacity * item_size);
+    if (grown == NULL) return 0;
+    *items = grown;
+    *capacity = new_capacity;
+    return 1;
+}
+
+static int position_list_add(PositionList* list, int position) {
+    if (!grow_array((void**)&list->positions, &list->capacity, list->count + 1, sizeof(int))) return 0;
+    list->positions[list->count++] = position;
+    return 1;
+}
+
+// First index in [lo, hi) of the reference list whose account is not below
+// reference (or, with after set, is above it)
+static int reference_bound(HistoryIndex* index, int lo, int hi, const char* reference, int after) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(index->entries[index->by_reference.positions[mid]]->reference_account, reference);
+        if (cmp < 0 || (after && cmp == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// First index in [lo, hi) of positions (NULL: the entries themselves) whose
+// entry is not older than timestamp
+static int time_bound(HistoryIndex* index, const int* positions, int lo, int hi, long long timestamp) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        Transaction* trans = index->entries[positions ? positions[mid] : mid];
+        if ((long long)trans->timestamp < timestamp) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// A new entry of the reference list, for sorting the entries added at once
+typedef struct {
+    const char* reference;
+    int position;
+} ReferenceKey;
+
+static int compare_reference_keys(const void* a, const void* b) {
+    const ReferenceKey* x = a;
+    const ReferenceKey* y = b;
+    int cmp = strcmp(x->reference, y->reference);
+    return cmp != 0 ? cmp : (x->position > y->position) - (x->position < y->position);
+}
+
+// Sorts the new entries once, then merges them into the reference list from
+// its end. They come after every entry already listed, so among entries of
+// the same reference they go last.
+static int reference_merge(HistoryIndex* index, ReferenceKey* keys, int count) {
+    PositionList* list = &index->by_reference;
+    if (!grow_array((void**)&list->positions, &list->capacity, list->count + count, sizeof(int))) return 0;
+    qsort(keys, count, sizeof(ReferenceKey), compare_reference_keys);
+    
+    int i = list->count - 1, j = count - 1;
+    for (int k = list->count + count - 1; j >= 0; k--) {
+        if (i >= 0 && strcmp(index->entries[list->positions[i]]->reference_account, keys[j].reference) > 0) {
+            list->positions[k] = list->positions[i--];
+        } else {
+            list->positions[k] = keys[j--].position;
+        }
+    }
+    list->count += count;
+    return 1;
+}
+
+static void history_index_free(HistoryIndex* index) {
+    free(index->entries);
+    for (int t = 0; t < HISTORY_TYPES; t++) {
+        free(index->by_type[t].positions);
+    }
+    free(index->by_reference.positions);
+    free(index);
+}
+
+// Brings the account's index up to date with its history: the entries added
+// since the last query are the newest ones, at the head of the chain
+static HistoryIndex* history_index(BankAccount* account) {
+    TransactionHistory* history = &HISTORY(account->id);
+    HistoryIndex* index = HISTORY_INDEX(account->id);
+    if (index == NULL) {
+        index = calloc(1, sizeof(HistoryIndex));
+        if (index == NULL) return NULL;
+        HISTORY_INDEX(account->id) = index;
+    }
+    
+    int first = index->count;
+    int added = history->transaction_count - first;
+    if (added <= 0) return index;
+    if (!grow_array((void**)&index->entries, &index->capacity, history->transaction_count, sizeof(Transaction*))) {
+        return NULL;
+    }
+    
+    LedgerSegment* segment = history->head;
+    int slot = segment->count - 1;
+    for (int position = history->transaction_count - 1; position >= first; position--) {
+        index->entries[position] = &segment->entries[slot];
+        if (--slot < 0 && position > first) {
+            segment = segment->prev;
+            slot = segment->count - 1;
+        }
+    }
+    
+    ReferenceKey* keys = malloc(added * sizeof(ReferenceKey));
+    if (keys == NULL) return NULL;
+    int referenced = 0;
+    for (int position = first; position < history->transaction_count; position++) {
+        Transaction* trans = index->entries[position];
+        if (!position_list_add(&index->by_type[history_type(trans->type)], position)) {
+            free(keys);
+            return NULL;
+        }
+        if (strcmp(trans->reference_account, "N/A") == 0) continue;
+        keys[referenced].reference = trans->reference_account;
+        keys[referenced].position = position;
+        referenced++;
+    }
+    int merged = referenced == 0 || reference_merge(index, keys, referenced);
+    free(keys);
+    if (!merged) return NULL;
+    index->count = history->transaction_count;
+    return index;
+}
+
+// Finds the account's transactions with from <= timestamp <= to, of the
+// given type (-1 for any) and reference account (NULL for any), oldest first.
+// Stores up to max_results of them and returns how many there are. Costs
+// O(log n + k): only a filter on both type and reference scans the matches
+// of the reference.
+int history_query(BankAccount* account, long long from, long long to, int type, const char* reference,
+                  Transaction** results, int max_results) {
+    ledger_ensure_loaded();
+    lock_account(account);
+    HistoryIndex* index = history_index(account);
+    if (index == NULL) {
+        unlock_account(account);
+        return 0;
+    }
+    
+    const int* positions = NULL;
+    int lo = 0, hi = index->count;
+    if (reference != NULL) {
+        positions = index->by_reference.positions;
+        lo = reference_bound(index, 0, index->by_reference.count, reference, 0);
+        hi = reference_bound(index, lo, index->by_reference.count, reference, 1);
+    } else if (type >= 0) {
+        positions = index->by_type[type].positions;
+        hi = index->by_type[type].count;
+    }
+    lo = time_bound(index, positions, lo, hi, from);
+    hi = time_bound(index, positions, lo, hi, to + 1);
+    
+    int found = 0;
+    for (int i = lo; i < hi; i++) {
+        Transaction* trans = index->entries[positions ? positions[i] : i];
+        if (reference != NULL && type >= 0 && history_type(trans->type) != type) continue;
+        if (found < max_results) results[found] = trans;
+        found++;
+    }
+    unlock_account(account);
+    return found;
+}
+
+// Adds a filled-in history entry to the global log under transaction id id,
+// or under the next free one when id is 0, and returns the id. Caller holds
+// the account's stripe lock, or runs before any other thread.
+unsigned long long audit_append(int account, Transaction* entry, unsigned long long id) {
+    mutex_lock(&audit_lock);
+    if (id == 0) {
+        id = audit_log.next_id++;
+    } else if (id >= audit_log.next_id) {
+        audit_log.next_id = id + 1;
+    }
+    if (grow_array((void**)&audit_log.entries, &audit_log.capacity, audit_log.count + 1, sizeof(AuditEntry))) {
+        AuditEntry* slot = &audit_log.entries[audit_log.count++];
+        slot->id = id;
+        slot->entry = entry;
+        slot->account = account;
+    } else {
+        printf("Error: Out of memory for the transaction log!\n");
+    }
+    mutex_unlock(&audit_lock);
+    HISTORY(account).last_id = id;
+    return id;
+}
+
+// Sort keys of the audit indexes; ties keep log order. qsort() has no
+// context argument, so the comparators read the log directly under audit_lock.
+static int audit_compare_amount(const void* a, const void* b) {
+    int pa = *(const int*)a, pb = *(const int*)b;
+    Money ka = audit_log.entries[pa].entry->amount, kb = audit_log.entries[pb].entry->amount;
+    if (ka != kb) return ka < kb ? -1 : 1;
+    return pa - pb;
+}
+
+static int audit_compare_time(const void* a, const void* b) {
+    int pa = *(const int*)a, pb = *(const int*)b;
+    unsigned int ka = audit_log.entries[pa].entry->timestamp, kb = audit_log.entries[pb].entry->timestamp;
+    if (ka != kb) return ka < kb ? -1 : 1;
+    return pa - pb;
+}
+
+static int audit_compare_reference(const void* a, const void* b) {
+    int pa = *(const int*)a, pb = *(const int*)b;
+    int cmp = strcmp(audit_log.entries[pa].entry->reference_account, audit_log.entries[pb].entry->reference_account);
+    return cmp != 0 ? cmp : pa - pb;
+}
+
+// Merges the sorted positions added into the index, which covers the first
+// audit_log.indexed entries
+static int audit_merge(int** index, const int* added, int added_count, int (*compare)(const void*, const void*)) {
+    int old_count = audit_log.indexed;
+    int* merged = malloc((size_t)(old_count + added_count) * sizeof(int));
+    if (merged == NULL) return 0;
+    
+    int i = 0, j = 0, k = 0;
+    while (i < old_count && j < added_count) {
+        merged[k++] = compare(&(*index)[i], &added[j]) <= 0 ? (*index)[i++] : added[j++];
+    }
+    while (i < old_count) merged[k++] = (*index)[i++];
+    while (j < added_count) merged[k++] = added[j++];
+    free(*index);
+    *index = merged;
+    return 1;
+}
+
+// Merges the unindexed tail of the log into the indexes once it is long
+// enough to be worth it. Caller holds audit_lock.
+static void audit_refresh() {
+    int added_count = audit_log.count - audit_log.indexed;
+    if (added_count < AUDIT_MERGE_MIN) return;
+    
+    int* added = malloc((size_t)added_count * sizeof(int));
+    if (added == NULL) return;
+    struct {
+        int** index;
+        int (*compare)(const void*, const void*);
+    } keys[] = {
+        {&audit_log.by_amount, audit_compare_amount},
+        {&audit_log.by_time, audit_compare_time},
+        {&audit_log.by_reference, audit_compare_reference},
+    };
+    int ok = 1;
+    for (int k = 0; k < 3 && ok; k++) {
+        for (int i = 0; i < added_count; i++) {
+            added[i] = audit_log.indexed + i;
+        }
+        qsort(added, added_count, sizeof(int), keys[k].compare);
+        ok = audit_merge(keys[k].index, added, added_count, keys[k].compare);
+    }
+    free(added);
+    
+    // An index left behind by a failed merge is rebuilt from scratch next time
+    if (ok) {
+        audit_log.indexed = audit_log.count;
+    } else {
+        for (int k = 0; k < 3; k++) {
+            free(*keys[k].index);
+            *keys[k].index = NULL;
+        }
+        audit_log.indexed = 0;
+    }
+}
+
+// First index in [0, audit_log.indexed) of the amount index whose entry is
+// not below amount
+static int audit_amount_bound(Money amount) {
+    int lo = 0, hi = audit_log.indexed;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (audit_log.entries[audit_log.by_amount[mid]].entry->amount < amount) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int audit_time_bound(long long timestamp) {
+    int lo = 0, hi = audit_log.indexed;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if ((long long)audit_log.entries[audit_log.by_time[mid]].entry->timestamp < timestamp) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// With after set, the first index whose reference account is above reference
+static int audit_reference_bound(const char* reference, int after) {
+    int lo = 0, hi = audit_log.indexed;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(audit_log.entries[audit_log.by_reference[mid]].entry->reference_account, reference);
+        if (cmp < 0 || (after && cmp == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int audit_matches(const AuditEntry* entry, Money min_amount, Money max_amount, long long from, long long to,
+                         const char* reference, int type) {
+    const Transaction* trans = entry->entry;
+    return trans->amount >= min_amount && trans->amount <= max_amount &&
+           (long long)trans->timestamp >= from && (long long)trans->timestamp <= to &&
+           (reference == NULL || strcmp(trans->reference_account, reference) == 0) &&
+           (type < 0 || history_type(trans->type) == type);
+}
+
+// Finds the legs in the global log with min_amount <= amount <= max_amount,
+// from <= timestamp <= to, the given reference account (NULL for any) and the
+// given history_type() (-1 for any). Stores up to max_results of them and
+// returns how many there are. Walks whichever index range the filters narrow
+// most (the reference one when given), then the entries not yet indexed, so
+// matches come in that index's order followed by the newest ones in log
+// order. The type is checked on those candidates rather than indexed.
+int audit_query(Money min_amount, Money max_amount, long long from, long long to, const char* reference,
+                int type, AuditEntry* results, int max_results) {
+    ledger_ensure_loaded();
+    mutex_lock(&audit_lock);
+    audit_refresh();
+    
+    const int* positions;
+    int lo, hi;
+    if (reference != NULL) {
+        positions = audit_log.by_reference;
+        lo = audit_reference_bound(reference, 0);
+        hi = audit_reference_bound(reference, 1);
+    } else {
+        int amount_lo = audit_amount_bound(min_amount);
+        int amount_hi = max_amount < MAX_AMOUNT ? audit_amount_bound(max_amount + 1) : audit_log.indexed;
+        int time_lo = audit_time_bound(from);
+        int time_hi = audit_time_bound(to + 1);
+        if (amount_hi - amount_lo <= time_hi - time_lo) {
+            positions = audit_log.by_amount;
+            lo = amount_lo;
+            hi = amount_hi;
+        } else {
+            positions = audit_log.by_time;
+            lo = time_lo;
+            hi = time_hi;
+        }
+    }
+    
+    int found = 0;
+    for (int i = lo; i < hi; i++) {
+        AuditEntry* entry = &audit_log.entries[positions[i]];
+        if (!audit_matches(entry, min_amount, max_amount, from, to, reference, type)) continue;
+        if (found < max_results) results[found] = *entry;
+        found++;
+    }
+    for (int i = audit_log.indexed; i < audit_log.count; i++) {
+        AuditEntry* entry = &audit_log.entries[i];
+        if (!audit_matches(entry, min_amount, max_amount, from, to, reference, type)) continue;
+        if (found < max_results) results[found] = *entry;
+        found++;
+    }
+    mutex_unlock(&audit_lock);
+    return found;
+}
+
+// Rebuilds the in-memory histories from the first length bytes of ledger.dat.
+// Anything past that was written by a checkpoint that never completed.
+int load_ledger(long long length) {
+    FILE* fp = fopen(LEDGER_FILE, "rb");
+    if (fp == NULL) return 0;
+    
+    LedgerHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != LEDGER_MAGIC) {
+        fclose(fp);
+        return 0;
+    }
+    
+    LedgerRecord rec;
+    LegacyLedgerRecord legacy;
+    long long record_size = header.version >= 4 ? sizeof(LedgerRecord) : sizeof(LegacyLedgerRecord);
+    long long offset = sizeof(header);
+    while (offset + record_size <= length) {
+        if (header.version >= 4) {
+            if (fread(&rec, sizeof(rec), 1, fp) != 1) break;
+        } else {
+            if (fread(&legacy, sizeof(legacy), 1, fp) != 1) break;
+            rec.account = legacy.account;
+            rec.id = 0;
+            rec.trans = legacy.trans;
+        }
+        offset += record_size;
+        if (rec.account < 0 || rec.account >= total_accounts) continue;
+        Transaction* trans = ledger_append(&HISTORY(rec.account));
+        if (trans == NULL) break;
+        *trans = rec.trans;
+        if (header.version < 2) {
+            upgrade_transaction(trans);
+        } else if (header.version < 3) {
+            stamp_transaction(trans);
+        }
+        audit_append(rec.account, trans, rec.id);
+    }
+    fclose(fp);
+    
+    // New records cannot be appended to an old-format ledger: the next
+    // checkpoint writes a fresh one
+    if (header.version < LEDGER_VERSION) {
+        ledger_bytes = 0;
+        return 1;
+    }
+    
+    audit_log.persisted = audit_log.count;
+    return 1;
+}
+
+void ledger_ensure_loaded() {
+    if (!ledger_loaded) {
+        load_ledger(ledger_bytes);
+        ledger_loaded = 1;
+    }
+}
+
+// Appends every entry of the global log not yet in ledger.dat, in log order,
+// and syncs the file. The caller keeps the log from growing meanwhile. On
+// failure nothing counts as saved: the next save writes over whatever part
+// of the records made it past ledger_bytes.
+int save_ledger() {
+    if (!ledger_loaded) return 1;   // nothing can have been added
+    
+    const char* temp_file = LEDGER_FILE ".tmp";
+    FILE* fp = NULL;
+    int fresh = 0;
+    if (ledger_bytes > 0) {
+        fp = fopen(LEDGER_FILE, "r+b");
+        if (fp != NULL && fseek(fp, ledger_bytes, SEEK_SET) != 0) {
+            fclose(fp);
+            fp = NULL;
+        }
+    }
+    if (fp == NULL) {
+        // Start a fresh ledger holding every account's full history. It is
+        // built beside the old one, which the current snapshot may still use.
+        fp = fopen(temp_file, "wb");
+        if (fp == NULL) return 0;
+        fresh = 1;
+        LedgerHeader header = {LEDGER_MAGIC, LEDGER_VERSION};
+        if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+            fclose(fp);
+            remove(temp_file);
+            return 0;
+        }
+    }
+    
+    static LedgerRecord pending[BATCH_GROUP_SIZE];
+    memset(pending, 0, sizeof(pending));
+    int written = fresh ? 0 : audit_log.persisted;
+    int ok = 1;
+    while (written < audit_log.count) {
+        int count = audit_log.count - written;
+        if (count > BATCH_GROUP_SIZE) count = BATCH_GROUP_SIZE;
+        for (int j = 0; j < count; j++) {
+            AuditEntry* entry = &audit_log.entries[written + j];
+            pending[j].account = entry->account;
+            pending[j].id = entry->id;
+            pending[j].trans = *entry->entry;
+        }
+        fault_point();
+        if (fwrite(pending, sizeof(LedgerRecord), count, fp) != (size_t)count) {
+            ok = 0;
+            break;
+        }
+        metric_count(COUNTER_LEDGER_BYTES, count * sizeof(LedgerRecord));
+        written += count;
+    }
+    
+    long long length = ok && sync_file(fp) ? ftell(fp) : -1;
+    fclose(fp);
+    if (length < 0 || (fresh && !replace_file(temp_file, LEDGER_FILE))) {
+        if (fresh) remove(temp_file);
+        return 0;
+    }
+    audit_log.persisted = written;
+    ledger_bytes = length;
+    return 1;
+}
+
+// Saves chunk c for the snapshot unless it has been claimed already. Without
+// memory for the copy the writer waits for the reader to claim the chunk.
+static void snapshot_save(AccountSnapshot* snapshot, int c) {
+    while (!__atomic_load_n(&snapshot->claimed[c], __ATOMIC_ACQUIRE)) {
+        mutex_lock(&snapshot_lock);
+        if (!snapshot->claimed[c]) {
+            SnapshotChunk* copy = malloc(sizeof(SnapshotChunk));
+            if (copy != NULL) {
+                int length = snapshot->account_count - c * ACCOUNT_CHUNK_SIZE;
+                if (length > ACCOUNT_CHUNK_SIZE) length = ACCOUNT_CHUNK_SIZE;
+                memcpy(copy->balances, account_chunks[c]->data->balances, length * sizeof(Money));
+                memcpy(copy->flags, account_chunks[c]->data->flags, length);
+                snapshot->saved[c] = copy;
+                snapshot_chunks_saved++;
+                __atomic_store_n(&snapshot->claimed[c], 1, __ATOMIC_RELEASE);
+            }
+        }
+        mutex_unlock(&snapshot_lock);
+        if (!__atomic_load_n(&snapshot->claimed[c], __ATOMIC_ACQUIRE)) thread_yield();
+    }
+}
+
+// Called under the stripe lock before an account's balance or flags change.
+// Accounts appended after the snapshot was taken are not part of it.
+static void snapshot_guard(int id) {
+    AccountSnapshot* snapshot = __atomic_load_n(&active_snapshot, __ATOMIC_ACQUIRE);
+    if (snapshot != NULL && id < snapshot->account_count) {
+        snapshot_save(snapshot, id >> ACCOUNT_CHUNK_SHIFT);
+    }
+}
+
+// Takes a snapshot of every account. Returns NULL when out of memory; a
+// caller holding one must end it before taking another.
+AccountSnapshot* snapshot_begin() {
+    mutex_lock(&report_lock);
+    mutex_lock(&create_lock);
+    
+    int chunks = (total_accounts + ACCOUNT_CHUNK_SIZE - 1) >> ACCOUNT_CHUNK_SHIFT;
+    AccountSnapshot* snapshot = calloc(1, sizeof(AccountSnapshot));
+    if (snapshot != NULL) {
+        snapshot->claimed = calloc(chunks + 1, sizeof(int));
+        snapshot->saved = calloc(chunks + 1, sizeof(SnapshotChunk*));
+    }
+    if (snapshot == NULL || snapshot->claimed == NULL || snapshot->saved == NULL) {
+        if (snapshot != NULL) {
+            free(snapshot->claimed);
+            free(snapshot->saved);
+            free(snapshot);
+        }
+        mutex_unlock(&create_lock);
+        mutex_unlock(&report_lock);
+        return NULL;
+    }
+    snapshot->account_count = total_accounts;
+    snapshot->chunk_count = chunks;
+    
+    lock_all_accounts();
+    __atomic_store_n(&active_snapshot, snapshot, __ATOMIC_RELEASE);
+    unlock_all_accounts();
+    mutex_unlock(&create_lock);
+    return snapshot;
+}
+
+// Copies chunk c of the snapshot into out and returns how many accounts of
+// the snapshot it holds. A chunk no writer has saved is copied from the
+// live columns, which cannot change while snapshot_lock is held.
+int snapshot_read(AccountSnapshot* snapshot, int c, SnapshotChunk* out) {
+    int length = snapshot->account_count - c * ACCOUNT_CHUNK_SIZE;
+    if (length > ACCOUNT_CHUNK_SIZE) length = ACCOUNT_CHUNK_SIZE;
+    
+    mutex_lock(&snapshot_lock);
+    SnapshotChunk* copy = snapshot->saved[c];
+    const Money* balances = copy != NULL ? copy->balances : account_chunks[c]->data->balances;
+    const unsigned char* flags = copy != NULL ? copy->flags : account_chunks[c]->data->flags;
+    memcpy(out->balances, balances, length * sizeof(Money));
+    memcpy(out->flags, flags, length);
+    snapshot->saved[c] = NULL;
+    __atomic_store_n(&snapshot->claimed[c], 1, __ATOMIC_RELEASE);
+    mutex_unlock(&snapshot_lock);
+    
+    free(copy);
+    return length;
+}
+
+// Releases the snapshot. Its chunks are claimed first, so no writer waits on
+// it, and it is unpublished under every stripe lock, so none still uses it.
+void snapshot_end(AccountSnapshot* snapshot) {
+    mutex_lock(&snapshot_lock);
+    for (int c = 0; c < snapshot->chunk_count; c++) {
+        __atomic_store_n(&snapshot->claimed[c], 1, __ATOMIC_RELEASE);
+    }
+    mutex_unlock(&snapshot_lock);
+    
+    lock_all_accounts();
+    __atomic_store_n(&active_snapshot, NULL, __ATOMIC_RELEASE);
+    unlock_all_accounts();
+    
+    for (int c = 0; c < snapshot->chunk_count; c++) {
+        free(snapshot->saved[c]);
+    }
+    free(snapshot->claimed);
+    free(snapshot->saved);
+    free(snapshot);
+    mutex_unlock(&report_lock);
+}
+
+// Takes a snapshot and copies its balance and flags columns into arrays
+// indexed by account id, which the caller frees. Returns the number of
+// accounts, or -1 when out of memory.
+int snapshot_columns(Money** balances, unsigned char** flags) {
+    SnapshotChunk* chunk = malloc(sizeof(SnapshotChunk));
+    AccountSnapshot* snapshot = chunk != NULL ? snapshot_begin() : NULL;
+    if (snapshot == NULL) {
+        free(chunk);
+        return -1;
+    }
+    int count = snapshot->account_count;
+    *balances = malloc((count + 1) * sizeof(Money));
+    *flags = malloc(count + 1);
+    if (*balances != NULL && *flags != NULL) {
+        for (int c = 0; c < snapshot->chunk_count; c++) {
+            int length = snapshot_read(snapshot, c, chunk);
+            memcpy(*balances + c * ACCOUNT_CHUNK_SIZE, chunk->balances, length * sizeof(Money));
+            memcpy(*flags + c * ACCOUNT_CHUNK_SIZE, chunk->flags, length);
+        }
+    } else {
+        free(*balances);
+        free(*flags);
+        count = -1;
+    }
+    snapshot_end(snapshot);
+    free(chunk);
+    return count;
+}
+
+// Balance changes. Every change to an account takes the next sequence number
+// from its live balance word and reaches the history and journal in that
+// order. Deposits and withdrawals do so without a lock: they update the word
+// atomically and publish an entry in the account's ring, and whichever thread
+// next gets the stripe lock moves all published entries at once. Operations
+// that hold the stripe lock take their sequence number from the word too and
+// first move everything published before it.
+
+// Moves one change into the history. Caller holds the stripe lock.
+static void record_change(BankAccount* account, const char* type, Money amount, Money balance_after,
+                          const char* description, const char* ref_account, unsigned long long id) {
+    snapshot_guard(account->id);
+    BALANCE(account->id) = balance_after;
+    add_transaction(account, type, amount, description, ref_account, id);
+}
+
+// Moves published entries into the history and journal. With wait set it
+// moves every entry before stop, waiting for any still being filled in;
+// otherwise it stops at the first unpublished entry. Caller holds the
+// stripe lock.
+static void ring_drain(BankAccount* account, AccountRing* ring, int wait, unsigned int stop) {
+    for (;;) {
+        unsigned int seq = ring->drained;
+        if (wait && seq == stop) break;
+        
+        RingEntry* entry = &ring->entries[seq & (RING_SIZE - 1)];
+        if (__atomic_load_n(&entry->stamp, __ATOMIC_ACQUIRE) != (seq | RING_PUBLISHED)) {
+            if (!wait) break;
+            thread_yield();
+            continue;
+        }
+        record_change(account, entry->type, entry->amount, entry->balance_after, entry->description, NULL, 0);
+        journal_log_transaction(account);
+        __atomic_store_n(&ring->drained, (seq + 1) & LIVE_SEQ_MASK, __ATOMIC_RELEASE);
+    }
+}
+
+// Drains the ring if the stripe is free; otherwise the holder is making
+// progress and this thread steps aside
+static void ring_help(BankAccount* account, AccountRing* ring) {
+    bank_mutex* lock = &account_locks[ACCOUNT_STRIPE(account->id)];
+    if (mutex_trylock(lock)) {
+        ring_drain(account, ring, 0, 0);
+        mutex_unlock(lock);
+    } else {
+        thread_yield();
+    }
+}
+
+static void ring_publish(BankAccount* account, AccountRing* ring, unsigned int seq, const char* type,
+                         Money amount, Money balance_after, const char* description) {
+    // The slot is free once the entry a full ring earlier has been moved
+    while (((seq - __atomic_load_n(&ring->drained, __ATOMIC_ACQUIRE)) & LIVE_SEQ_MASK) >= RING_SIZE) {
+        ring_help(account, ring);
+    }
+    RingEntry* entry = &ring->entries[seq & (RING_SIZE - 1)];
+    entry->type = type;
+    entry->description = description;
+    entry->amount = amount;
+    entry->balance_after = balance_after;
+    __atomic_store_n(&entry->stamp, seq | RING_PUBLISHED, __ATOMIC_RELEASE);
+}
+
+// Returns once entry seq is in the history and the journal buffer
+static void ring_wait(BankAccount* account, AccountRing* ring, unsigned int seq) {
+    while (((__atomic_load_n(&ring->drained, __ATOMIC_ACQUIRE) - seq - 1) & LIVE_SEQ_MASK) >= 0x8000) {
+        ring_help(account, ring);
+    }
+}
+
+// Returns the account's ring, creating it on first use. Creation happens
+// under the stripe lock, so no locked operation can be holding a sequence
+// number the new ring does not know about.
+static AccountRing* account_ring(BankAccount* account) {
+    AccountRing* ring = __atomic_load_n(&RING(account->id), __ATOMIC_ACQUIRE);
+    if (ring != NULL) return ring;
+    
+    lock_account(account);
+    ring = RING(account->id);
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(AccountRing));
+        if (ring != NULL) {
+            ring->drained = LIVE_SEQ(LIVE(account->id));
+            __atomic_store_n(&RING(account->id), ring, __ATOMIC_RELEASE);
+        }
+    }
+    unlock_account(account);
+    return ring;
+}
+
+// For an operation holding the stripe lock that took sequence seq: moves the
+// lock-free changes ordered before it, so its own change can be recorded next
+static void ring_catch_up(BankAccount* account, unsigned int seq) {
+    AccountRing* ring = __atomic_load_n(&RING(account->id), __ATOMIC_ACQUIRE);
+    if (ring != NULL) {
+        ring_drain(account, ring, 1, seq);
+    }
+}
+
+// Marks the locked operation's own sequence number as recorded
+static void ring_skip(BankAccount* account, unsigned int seq) {
+    AccountRing* ring = __atomic_load_n(&RING(account->id), __ATOMIC_ACQUIRE);
+    if (ring != NULL) {
+        __atomic_store_n(&ring->drained, (seq + 1) & LIVE_SEQ_MASK, __ATOMIC_RELEASE);
+    }
+}
+
+// Takes a sequence number and debits amount unless that would leave less
+// than min_balance. Returns 0 if the balance is too low.
+static int live_debit(BankAccount* account, Money amount, Money min_balance, unsigned long long* word) {
+    unsigned long long old = __atomic_load_n(&LIVE(account->id), __ATOMIC_ACQUIRE);
+    do {
+        if (LIVE_BALANCE(old) - amount < min_balance) return 0;
+    } while (!__atomic_compare_exchange_n(&LIVE(account->id), &old, old + LIVE_STEP - amount, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    *word = old;
+    return 1;
+}
+
+// Takes a sequence number and credits amount unless that would take the
+// balance past LIVE_BALANCE_LIMIT. Returns 0 if it would.
+static int live_credit(BankAccount* account, Money amount, unsigned long long* word) {
+    unsigned long long old = __atomic_load_n(&LIVE(account->id), __ATOMIC_ACQUIRE);
+    do {
+        if (LIVE_BALANCE(old) > LIVE_BALANCE_LIMIT - amount) return 0;
+    } while (!__atomic_compare_exchange_n(&LIVE(account->id), &old, old + LIVE_STEP + amount, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    *word = old;
+    return 1;
+}
+
+// The same change made entirely under the stripe lock. Used when a ring
+// cannot be allocated, and as the baseline of the contention benchmark.
+static int change_locked(BankAccount* account, const char* type, Money amount, const char* description) {
+    int status = BANK_OK;
+    unsigned long long old;
+    
+    lock_account(account);
+    if (!account_is_active(account)) {
+        status = BANK_ACCOUNT_BLOCKED;
+    } else if (amount > 0) {
+        if (!live_credit(account, amount, &old)) status = BANK_BALANCE_LIMIT;
+    } else if (!live_debit(account, -amount, min_balance_for(account_type(account)), &old)) {
+        status = BANK_INSUFFICIENT_BALANCE;
+    }
+    if (status == BANK_OK) {
+        ring_catch_up(account, LIVE_SEQ(old));
+        record_change(account, type, amount > 0 ? amount : -amount, LIVE_BALANCE(old) + amount, description, NULL, 0);
+        ring_skip(account, LIVE_SEQ(old));
+        journal_log_transaction(account);
+    }
+    unlock_account(account);
+    return status;
+}
+
+// Core operations. Each one applies the business rules, updates the account
+// and its history and appends the journal record. Nothing is synced: the
+// caller decides when to journal_commit(), so a batch or a server worker can
+// share one sync between many operations. The public bank_*() entry points
+// further down time each call into the metrics.
+static int apply_deposit(BankAccount* account, Money amount, const char* description) {
+    if (!validate_amount(amount)) return BANK_INVALID_AMOUNT;
+    if (!account_is_active(account)) return BANK_ACCOUNT_BLOCKED;
+    
+    AccountRing* ring = account_ring(account);
+    if (ring == NULL) return change_locked(account, "DEPOSIT", amount, description);
+    
+    unsigned long long old;
+    if (!live_credit(account, amount, &old)) return BANK_BALANCE_LIMIT;
+    ring_publish(account, ring, LIVE_SEQ(old), "DEPOSIT", amount, LIVE_BALANCE(old) + amount, description);
+    ring_wait(account, ring, LIVE_SEQ(old));
+    return BANK_OK;
+}
+
+static int apply_withdraw(BankAccount* account, Money amount, const char* description) {
+    if (!validate_amount(amount)) return BANK_INVALID_AMOUNT;
+    if (!account_is_active(account)) return BANK_ACCOUNT_BLOCKED;
+    
+    AccountRing* ring = account_ring(account);
+    if (ring == NULL) return change_locked(account, "WITHDRAW", -amount, description);
+    
+    unsigned long long old;
+    if (!live_debit(account, amount, min_balance_for(account_type(account)), &old)) {
+        return BANK_INSUFFICIENT_BALANCE;
+    }
+    ring_publish(account, ring, LIVE_SEQ(old), "WITHDRAW", amount, LIVE_BALANCE(old) - amount, description);
+    ring_wait(account, ring, LIVE_SEQ(old));
+    return BANK_OK;
+}
+
+// Transfers hold both stripes, so the two legs reach the journal as one
+// record; both carry the same transaction id
+static int apply_transfer(BankAccount* from, BankAccount* to, Money amount) {
+    if (from == to) return BANK_SAME_ACCOUNT;
+    if (!validate_amount(amount)) return BANK_INVALID_AMOUNT;
+    
+    unsigned long long debit, credit;
+    int status = BANK_OK;
+    
+    // The credit cannot be refused once the debit is made, so the limit is
+    // checked first. Lock-free deposits may still land in between; only
+    // holders of the stripe lock credit past the limit, one at a time and
+    // by at most MAX_AMOUNT, which the sequence bits leave room for.
+    lock_account_pair(from, to);
+    if (!account_is_active(from) || !account_is_active(to)) {
+        status = BANK_ACCOUNT_BLOCKED;
+    } else if (LIVE_BALANCE(__atomic_load_n(&LIVE(to->id), __ATOMIC_ACQUIRE)) > LIVE_BALANCE_LIMIT - amount) {
+        status = BANK_BALANCE_LIMIT;
+    } else if (!live_debit(from, amount, min_balance_for(account_type(from)), &debit)) {
+        status = BANK_INSUFFICIENT_BALANCE;
+    } else {
+        credit = __atomic_fetch_add(&LIVE(to->id), LIVE_STEP + amount, __ATOMIC_ACQ_REL);
+        
+        char desc[100];
+        ring_catch_up(from, LIVE_SEQ(debit));
+        snprintf(desc, sizeof(desc), "Transfer to %s", to->name);
+        record_change(from, "TRANSFER_OUT", amount, LIVE_BALANCE(debit) - amount, desc, to->account_number, 0);
+        ring_skip(from, LIVE_SEQ(debit));
+        
+        ring_catch_up(to, LIVE_SEQ(credit));
+        snprintf(desc, sizeof(desc), "Transfer from %s", from->name);
+        record_change(to, "TRANSFER_IN", amount, LIVE_BALANCE(credit) + amount, desc, from->account_number,
+                      HISTORY(from->id).last_id);
+        ring_skip(to, LIVE_SEQ(credit));
+        
+        journal_log_transfer(from, to);
+    }
+    unlock_account_pair(from, to);
+    return status;
+}
+
+// Blocks or unblocks an account; unblocking also clears failed logins
+int bank_set_active(BankAccount* account, int active) {
+    lock_account(account);
+    set_account_active(account, active);
+    if (active) {
+        account->failed_attempts = 0;
+    }
+    journal_log_status(account);
+    unlock_account(account);
+    return BANK_OK;
+}
+
+// Checks a password, counting failures: the MAX_LOGIN_ATTEMPTS-th blocks the
+// account. Repeat logins with the same password are answered from the
+// session-token cache; otherwise the KDF runs without any lock held, and a
+// legacy or cheaper hash is replaced with a current one.
+static int apply_login(BankAccount* account, const char* password) {
+    unsigned char token[32];
+    char stored[50];
+    
+    lock_account(account);
+    if (!account_is_active(account)) {
+        unlock_account(account);
+        return BANK_ACCOUNT_BLOCKED;
+    }
+    AuthCacheEntry* entry = &auth_cache[account->id & (AUTH_CACHE_SIZE - 1)];
+    session_token(account, password, token);
+    int cached = entry->account == account->id && equal_constant_time(entry->token, token, sizeof(token)) &&
+                 account->failed_attempts == 0;
+    strcpy(stored, account->password_hash);
+    unlock_account(account);
+    if (cached) return BANK_OK;
+    
+    int valid = verify_password(password, stored);
+    char upgraded[50];
+    if (valid && password_needs_upgrade(stored)) {
+        hash_password(password, upgraded);
+    }
+    
+    int status = BANK_OK;
+    lock_account(account);
+    if (strcmp(stored, account->password_hash) != 0) {
+        status = BANK_AUTH_FAILED;          // the password changed meanwhile
+    } else if (!valid) {
+        if (++account->failed_attempts >= MAX_LOGIN_ATTEMPTS) {
+            set_account_active(account, 0);
+        }
+        journal_log_status(account);
+        status = BANK_AUTH_FAILED;
+    } else {
+        if (account->failed_attempts != 0) {
+            account->failed_attempts = 0;
+            journal_log_status(account);
+        }
+        if (password_needs_upgrade(stored)) {
+            strcpy(account->password_hash, upgraded);
+            journal_log_password(account);
+        }
+        entry->account = account->id;
+        session_token(account, password, entry->token);
+    }
+    unlock_account(account);
+    return status;
+}
+
+int bank_change_password(BankAccount* account, const char* old_password, const char* new_password) {
+    char stored[50], hash[50];
+    
+    lock_account(account);
+    strcpy(stored, account->password_hash);
+    unlock_account(account);
+    
+    if (!verify_password(old_password, stored)) return BANK_AUTH_FAILED;
+    hash_password(new_password, hash);
+    
+    int status = BANK_OK;
+    lock_account(account);
+    if (strcmp(stored, account->password_hash) != 0) {
+        status = BANK_AUTH_FAILED;
+    } else {
+        strcpy(account->password_hash, hash);
+        journal_log_password(account);
+    }
+    unlock_account(account);
+    return status;
+}
+
+// What is wrong with a new account's profile, or NULL if nothing is
+static const char* profile_problem(const BankAccount* profile) {
+    size_t username_length = strlen(profile->username);
+    if (username_length < 8 || username_length > 15) return "Username must be 8-15 characters";
+    if (!validate_email(profile->email)) return "Invalid email format";
+    if (!validate_mobile(profile->mobile)) return "Invalid mobile number";
+    for (const char* c = profile->name; *c; c++) {
+        if (!isalpha((unsigned char)*c) && *c != ' ') return "Invalid name";
+    }
+    return NULL;
+}
+
+// Checks a new account's profile, type and initial deposit, which has to
+// cover the minimum balance of the type
+static int check_new_account(const BankAccount* profile, int type, Money initial_deposit) {
+    if (type < ACCOUNT_SAVINGS || type > ACCOUNT_PREMIUM || profile_problem(profile) != NULL) {
+        return BANK_BAD_REQUEST;
+    }
+    if (initial_deposit < min_balance_for(type) || initial_deposit > MAX_AMOUNT) return BANK_INVALID_AMOUNT;
+    return BANK_OK;
+}
+
+// Numbers and appends a checked account dated created_date. The caller
+// holds create_lock.
+static int open_new_account(const BankAccount* profile, int type, Money initial_deposit, const char* created_date) {
+    if (find_account_by_username(profile->username) != NULL) return BANK_USERNAME_TAKEN;
+    
+    BankAccount details = *profile;
+    details.failed_attempts = 0;
+    strcpy(details.created_date, created_date);
+    if (!generate_account_number(details.account_number) ||
+        append_account(&details, type | ACCOUNT_ACTIVE, initial_deposit) == NULL) {
+        return BANK_NO_STORAGE;
+    }
+    return BANK_OK;
+}
+
+// Records the initial deposit of an account open_new_account() appended.
+// The caller still holds create_lock, so JOURNAL_CREATE records reach the
+// journal in id order, which replay depends on.
+static void log_new_account(BankAccount* account, Money initial_deposit) {
+    lock_account(account);
+    add_transaction(account, "DEPOSIT", initial_deposit, "Initial Deposit", NULL, 0);
+    journal_log_create(account);
+    unlock_account(account);
+}
+
+// Opens an account for profile, whose password_hash the caller has already
+// set with hash_password(), so the KDF runs outside every lock. The account
+// gets the next number, today's date and the initial deposit.
+static int apply_create_account(const BankAccount* profile, int type, Money initial_deposit,
+                                BankAccount** created) {
+    BankAccount* account = NULL;
+    int status = check_new_account(profile, type, initial_deposit);
+    if (status == BANK_OK) {
+        char created_date[20];
+        get_current_date(created_date);
+        mutex_lock(&create_lock);
+        status = open_new_account(profile, type, initial_deposit, created_date);
+        if (status == BANK_OK) {
+            account = &ACCOUNT(total_accounts - 1);
+            log_new_account(account, initial_deposit);
+        }
+        mutex_unlock(&create_lock);
+    }
+    
+    if (created != NULL) *created = account;
+    return status;
+}
+
+// Opens count accounts as bank_create_account() would one by one: profile i
+// with types[i] and deposits[i], its BANK_* status going to statuses[i] and
+// the account, or NULL, to created[i] when created is not NULL. The batch
+// is numbered and journaled under one hold of create_lock, so its accounts
+// get consecutive ids and no other create comes between their records.
+// Returns how many were opened.
+int bank_create_accounts(const BankAccount* profiles, const int* types, const Money* deposits, int count,
+                         int* statuses, BankAccount** created) {
+    char created_date[20];
+    get_current_date(created_date);
+    for (int i = 0; i < count; i++) {
+        statuses[i] = check_new_account(&profiles[i], types[i], deposits[i]);
+    }
+    
+    int opened = 0;
+    mutex_lock(&create_lock);
+    for (int i = 0; i < count; i++) {
+        BankAccount* account = NULL;
+        if (statuses[i] == BANK_OK) {
+            statuses[i] = open_new_account(&profiles[i], types[i], deposits[i], created_date);
+        }
+        if (statuses[i] == BANK_OK) {
+            int id = total_accounts - 1;
+            account = &ACCOUNT(id);
+            log_new_account(account, deposits[i]);
+            opened++;
+        }
+        if (created != NULL) created[i] = account;
+    }
+    mutex_unlock(&create_lock);
+    return opened;
+}
+
+// Copies up to max entries of the account's history into page, newest
+// first, after skipping the newest skip of them. Returns how many it copied.
+int bank_history(BankAccount* account, int skip, Transaction* page, int max) {
+    unsigned long long start = metric_start(METRIC_HISTORY);
+    ledger_ensure_loaded();
+    lock_account(account);
+    LedgerSegment* segment = HISTORY(account->id).head;
+    while (segment != NULL && skip >= segment->count) {
+        skip -= segment->count;
+        segment = segment->prev;
+    }
+    int copied = 0;
+    int slot = segment != NULL ? segment->count - 1 - skip : 0;
+    while (segment != NULL && copied < max) {
+        page[copied++] = segment->entries[slot];
+        if (--slot < 0) {
+            segment = segment->prev;
+            if (segment != NULL) slot = segment->count - 1;
+        }
+    }
+    unlock_account(account);
+    metric_finish(METRIC_HISTORY, start, BANK_OK);
+    return copied;
+}
+
+// Whether the query has the SEARCH_MIN_QUERY letters or digits a search needs
+int bank_search_usable(const char* query) {
+    unsigned char symbols[SEARCH_MAX_QUERY + 2];
+    return search_query(query, symbols) > 0;
+}
+
+// Finds the accounts whose name, username, email or mobile contains the
+// query, compared as normalized for the search index; with fuzzy set, a
+// query of SEARCH_FUZZY_MIN symbols or more also matches with one symbol
+// added, removed or changed. Copies the ids of up to max of them in account
+// order, after skipping the first skip, and returns how many it copied.
+// A query with fewer than SEARCH_MIN_QUERY letters and digits finds nothing.
+int bank_search(const char* query, int fuzzy, int skip, int* accounts, int max) {
+    unsigned char symbols[SEARCH_MAX_QUERY + 2];
+    int length = search_query(query, symbols);
+    if (length == 0) return 0;
+    fuzzy = fuzzy && length >= SEARCH_FUZZY_MIN;
+    
+    mutex_lock(&search_lock);
+    if (!search_ready && !search_build()) {
+        mutex_unlock(&search_lock);
+        return 0;
+    }
+    
+    // The distinct trigrams of the query, shortest posting list first
+    int grams[SEARCH_MAX_QUERY];
+    int count = 0;
+    for (int i = 0; i + 2 < length; i++) {
+        int gram = SEARCH_GRAM(symbols + i), at = count;
+        for (int c = 0; c < count && at >= 0; c++) {
+            if (grams[c] == gram) at = -1;
+        }
+        if (at < 0) continue;
+        while (at > 0 && search_postings[grams[at - 1]].count > search_postings[gram].count) {
+            grams[at] = grams[at - 1];
+            at--;
+        }
+        grams[at] = gram;
+        count++;
+    }
+    
+    // An exact match is in every list, and intersecting the shortest few
+    // leaves few candidates to check. One edit removes at most three
+    // trigrams, so a fuzzy match is in all lists but three at most.
+    if (!fuzzy && count > SEARCH_INTERSECT) count = SEARCH_INTERSECT;
+    int needed = !fuzzy ? count : count > 3 ? count - 3 : 1;
+    SearchCursor cursors[SEARCH_MAX_QUERY];
+    for (int c = 0; c < count; c++) {
+        SearchPostings* list = &search_postings[grams[c]];
+        cursors[c].next = list->bytes;
+        cursors[c].end = list->bytes + list->length;
+        cursors[c].account = -1;
+        search_cursor_next(&cursors[c]);
+    }
+    int found = 0, copied = 0;
+    while (copied < max) {
+        int account = needed == count ? search_intersect(cursors, count) : SEARCH_END;
+        int hits = count;
+        if (needed < count) {
+            for (int c = 0; c < count; c++) {
+                if (cursors[c].account < account) account = cursors[c].account;
+            }
+            hits = 0;
+            for (int c = 0; c < count; c++) {
+                if (cursors[c].account == account) hits++;
+            }
+        }
+        if (account == SEARCH_END) break;
+        for (int c = 0; c < count; c++) {
+            if (cursors[c].account == account) search_cursor_next(&cursors[c]);
+        }
+        if (hits >= needed && search_matches(account, symbols, length, fuzzy) && found++ >= skip) {
+            accounts[copied++] = account;
+        }
+    }
+    mutex_unlock(&search_lock);
+    return copied;
+}
+
+int bank_deposit(BankAccount* account, Money amount, const char* description) {
+    unsigned long long start = metric_start(METRIC_DEPOSIT);
+    int status = apply_deposit(account, amount, description);
+    metric_finish(METRIC_DEPOSIT, start, status);
+    return status;
+}
+
+int bank_withdraw(BankAccount* account, Money amount, const char* description) {
+    unsigned long long start = metric_start(METRIC_WITHDRAW);
+    int status = apply_withdraw(account, amount, description);
+    metric_finish(METRIC_WITHDRAW, start, status);
+    return status;
+}
+
+int bank_transfer(BankAccount* from, BankAccount* to, Money amount) {
+    unsigned long long start = metric_start(METRIC_TRANSFER);
+    int status = apply_transfer(from, to, amount);
+    metric_finish(METRIC_TRANSFER, start, status);
+    return status;
+}
+
+int bank_login(BankAccount* account, const char* password) {
+    unsigned long long start = metric_start(METRIC_LOGIN);
+    int status = apply_login(account, password);
+    metric_finish(METRIC_LOGIN, start, status);
+    return status;
+}
+
+int bank_create_account(const BankAccount* profile, int type, Money initial_deposit, BankAccount** created) {
+    unsigned long long start = metric_start(METRIC_CREATE);
+    int status = apply_create_account(profile, type, initial_deposit, created);
+    metric_finish(METRIC_CREATE, start, status);
+    return status;
+}
+
+// Nanoseconds on a monotonic clock
+static unsigned long long metric_now() {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)(counter.QuadPart / frequency.QuadPart * 1000000000ULL +
+                                counter.QuadPart % frequency.QuadPart * 1000000000ULL / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static MetricShard* metric_local() {
+    if (metric_shard == NULL) {
+        int n = __atomic_fetch_add(&metric_next_shard, 1, __ATOMIC_RELAXED);
+        metric_shard = &metric_shards[n & (METRIC_SHARDS - 1)];
+        if (n >= METRIC_SHARDS) __atomic_store_n(&metric_shard->shared, 1, __ATOMIC_RELAXED);
+    }
+    return metric_shard;
+}
+
+// A shard's only writer adds with a plain load and store; readers may load
+// concurrently, so both are relaxed atomics, which cost no more than plain
+// moves
+static void metric_add(MetricShard* shard, unsigned long long* cell, unsigned long long amount) {
+    if (__atomic_load_n(&shard->shared, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(cell, amount, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(cell, __atomic_load_n(cell, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+    }
+}
+
+// Values below METRIC_SUB_BUCKETS get a bucket each; above, each power of
+// two is split into METRIC_SUB_BUCKETS equal buckets
+static int metric_bucket(unsigned long long ns) {
+    if (ns < METRIC_SUB_BUCKETS) return (int)ns;
+    int shift = 63 - __builtin_clzll(ns);
+    if (shift > METRIC_MAX_SHIFT) return METRIC_BUCKETS - 1;
+    return (shift - METRIC_SUB_BITS + 1) * METRIC_SUB_BUCKETS +
+           (int)((ns >> (shift - METRIC_SUB_BITS)) & (METRIC_SUB_BUCKETS - 1));
+}
+
+// Smallest value falling in bucket
+static unsigned long long metric_bucket_floor(int bucket) {
+    if (bucket < METRIC_SUB_BUCKETS) return bucket;
+    int shift = bucket / METRIC_SUB_BUCKETS + METRIC_SUB_BITS - 1;
+    return (unsigned long long)(METRIC_SUB_BUCKETS + bucket % METRIC_SUB_BUCKETS) << (shift - METRIC_SUB_BITS);
+}
+
+#define METRIC_OFF 0                // metric_start() results that are not times
+#define METRIC_UNTIMED 1
+
+// Start time of an event, or METRIC_UNTIMED when the event is only counted.
+// Reading the clock twice costs several percent of a transfer, so the cheap
+// operations are timed on a random one in METRIC_SAMPLE_RATE; a fixed
+// stride could keep missing the same step of a repeating workload.
+unsigned long long metric_start(int timer) {
+    if (!metrics_enabled) return METRIC_OFF;
+    if (timer < METRIC_LOGIN) {
+        if (metric_seed == 0) metric_seed = 2463534242u + (unsigned int)(metric_local() - metric_shards);
+        metric_seed ^= metric_seed << 13;
+        metric_seed ^= metric_seed >> 17;
+        metric_seed ^= metric_seed << 5;
+        if (metric_seed & (METRIC_SAMPLE_RATE - 1)) return METRIC_UNTIMED;
+    }
+    return metric_now();
+}
+
+// Records an event begun at start; a status other than BANK_OK counts as an
+// error
+void metric_finish(int timer, unsigned long long start, int status) {
+    if (start == METRIC_OFF) return;
+    MetricShard* shard = metric_local();
+    metric_add(shard, &shard->calls[timer], 1);
+    if (status != BANK_OK) metric_add(shard, &shard->errors[timer], 1);
+    if (start == METRIC_UNTIMED) return;
+    
+    unsigned long long ns = metric_now() - start;
+    metric_add(shard, &shard->timed[timer], 1);
+    metric_add(shard, &shard->total_ns[timer], ns);
+    metric_add(shard, &shard->buckets[timer][metric_bucket(ns)], 1);
+}
+
+void metric_count(int counter, unsigned long long amount) {
+    if (!metrics_enabled) return;
+    MetricShard* shard = metric_local();
+    metric_add(shard, &shard->counters[counter], amount);
+}
+
+// Sums every shard into total
+void metrics_collect(MetricShard* total) {
+    unsigned long long* sum = (unsigned long long*)total;
+    size_t cells = offsetof(MetricShard, shared) / sizeof(unsigned long long);
+    memset(total, 0, sizeof(MetricShard));
+    for (int s = 0; s < METRIC_SHARDS; s++) {
+        unsigned long long* cell = (unsigned long long*)&metric_shards[s];
+        for (size_t i = 0; i < cells; i++) {
+            sum[i] += __atomic_load_n(&cell[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Upper bound in nanoseconds of the q-quantile of a timer, 0 without
+// timed calls
+static unsigned long long metric_percentile(const MetricShard* total, int timer, double q) {
+    unsigned long long timed = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        timed += total->buckets[timer][b];
+    }
+    if (timed == 0) return 0;
+    unsigned long long rank = (unsigned long long)(q * (timed - 1)) + 1;
+    unsigned long long seen = 0;
+    for (int b = 0; b < METRIC_BUCKETS - 1; b++) {
+        seen += total->buckets[timer][b];
+        if (seen >= rank) return metric_bucket_floor(b + 1) - 1;
+    }
+    return metric_bucket_floor(METRIC_BUCKETS - 1);
+}
+
+static const char* const metric_timer_names[METRIC_TIMERS] = {
+    "deposit", "withdraw", "transfer", "history", "login", "create", "checkpoint", "fsync"
+};
+
+// Writes the metrics in the Prometheus text format, beside path first and
+// then renamed over it, so a scraper never reads half a file. Caller holds
+// metrics_lock, as the temporary file has a fixed name.
+static int metrics_write_locked(const char* path) {
+    static const char* const file_names[] = {"journal", "snapshot", "ledger"};
+    MetricShard total;
+    char temp_file[256];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", path);
+    FILE* fp = fopen(temp_file, "w");
+    if (fp == NULL) return 0;
+    
+    metrics_collect(&total);
+    fprintf(fp, "# HELP bank_operations_total Calls of core operations and persistence steps.\n");
+    fprintf(fp, "# TYPE bank_operations_total counter\n");
+    for (int t = 0; t < METRIC_TIMERS; t++) {
+        fprintf(fp, "bank_operations_total{operation=\"%s\"} %llu\n", metric_timer_names[t], total.calls[t]);
+    }
+    fprintf(fp, "# HELP bank_operation_seconds Latency of a random sample of the operations.\n");
+    fprintf(fp, "# TYPE bank_operation_seconds histogram\n");
+    for (int t = 0; t < METRIC_TIMERS; t++) {
+        unsigned long long below = 0;
+        int bucket = 0;
+        for (int shift = METRIC_EXPORT_MIN_SHIFT; shift <= METRIC_EXPORT_MAX_SHIFT; shift++) {
+            for (; bucket < (shift - METRIC_SUB_BITS + 1) * METRIC_SUB_BUCKETS; bucket++) {
+                below += total.buckets[t][bucket];
+            }
+            fprintf(fp, "bank_operation_seconds_bucket{operation=\"%s\",le=\"%.9g\"} %llu\n",
+                    metric_timer_names[t], (double)(1ULL << shift) / 1e9, below);
+        }
+        fprintf(fp, "bank_operation_seconds_bucket{operation=\"%s\",le=\"+Inf\"} %llu\n",
+                metric_timer_names[t], total.timed[t]);
+        fprintf(fp, "bank_operation_seconds_sum{operation=\"%s\"} %.9f\n", metric_timer_names[t],
+                total.total_ns[t] / 1e9);
+        fprintf(fp, "bank_operation_seconds_count{operation=\"%s\"} %llu\n", metric_timer_names[t], total.timed[t]);
+    }
+    fprintf(fp, "# HELP bank_operation_errors_total Operations that returned an error.\n");
+    fprintf(fp, "# TYPE bank_operation_errors_total counter\n");
+    for (int t = 0; t < METRIC_CHECKPOINT; t++) {
+        fprintf(fp, "bank_operation_errors_total{operation=\"%s\"} %llu\n", metric_timer_names[t], total.errors[t]);
+    }
+    fprintf(fp, "# HELP bank_written_bytes_total Bytes written to each data file.\n");
+    fprintf(fp, "# TYPE bank_written_bytes_total counter\n");
+    for (int c = COUNTER_JOURNAL_BYTES; c <= COUNTER_LEDGER_BYTES; c++) {
+        fprintf(fp, "bank_written_bytes_total{file=\"%s\"} %llu\n", file_names[c], total.counters[c]);
+    }
+    fprintf(fp, "# HELP bank_account_lookups_total Account index lookups.\n");
+    fprintf(fp, "# TYPE bank_account_lookups_total counter\n");
+    fprintf(fp, "bank_account_lookups_total %llu\n", total.counters[COUNTER_LOOKUPS]);
+    fprintf(fp, "# HELP bank_account_lookup_probes_total Index slots examined by account lookups.\n");
+    fprintf(fp, "# TYPE bank_account_lookup_probes_total counter\n");
+    fprintf(fp, "bank_account_lookup_probes_total %llu\n", total.counters[COUNTER_LOOKUP_PROBES]);
+    fprintf(fp, "# HELP bank_accounts Accounts in the bank.\n");
+    fprintf(fp, "# TYPE bank_accounts gauge\n");
+    fprintf(fp, "bank_accounts %d\n", total_accounts);
+    
+    if (fclose(fp) != 0) {
+        remove(temp_file);
+        return 0;
+    }
+    return replace_file(temp_file, path);
+}
+
+// The exporter thread and the menu's exit both write the file; once the
+// final write is done the exporter's later ones are skipped
+static int metrics_write_file(const char* path, int final) {
+    mutex_lock(&metrics_lock);
+    int ok = !metrics_stopped && metrics_write_locked(path);
+    if (final) metrics_stopped = 1;
+    mutex_unlock(&metrics_lock);
+    return ok;
+}
+
+int metrics_write(const char* path) {
+    return metrics_write_file(path, 0);
+}
+
+int metrics_write_final(const char* path) {
+    return metrics_write_file(path, 1);
+}
+
+static THREAD_FUNC metrics_exporter(void* arg) {
+    (void)arg;
+    for (;;) {
+        metrics_write(METRICS_FILE);
+        thread_sleep(METRICS_EXPORT_INTERVAL);
+    }
+    return 0;
+}
+
+// Rewrites METRICS_FILE every METRICS_EXPORT_INTERVAL seconds for as long as
+// the program runs, for a Prometheus textfile collector to pick up
+void metrics_start_export() {
+    bank_thread thread;
+    if (thread_start(&thread, metrics_exporter, NULL)) {
+        thread_detach(thread);
+    }
+}
+
+const char* bank_status_message(int status) {
+    switch (status) {
+        case BANK_OK: return "OK";
+        case BANK_INVALID_AMOUNT: return "Invalid amount";
+        case BANK_INSUFFICIENT_BALANCE: return "Insufficient balance";
+        case BANK_ACCOUNT_NOT_FOUND: return "Account not found";
+        case BANK_ACCOUNT_BLOCKED: return "Account is blocked";
+        case BANK_SAME_ACCOUNT: return "Cannot transfer to same account";
+        case BANK_AUTH_FAILED: return "Invalid username or password";
+        case BANK_USERNAME_TAKEN: return "Username already exists";
+        case BANK_NO_STORAGE: return "Unable to allocate account storage";
+        case BANK_LOGIN_REQUIRED: return "Login required";
+        case BANK_NOT_PERMITTED: return "Not permitted for this account";
+        case BANK_NOT_SAVED: return "Unable to save data";
+        case BANK_BALANCE_LIMIT: return "Balance limit exceeded";
+        default: return "Malformed request";
+    }
+}
+
+void init_locks() {
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        mutex_init(&account_locks[i]);
+    }
+    mutex_init(&journal_lock);
+    mutex_init(&commit_lock);
+    mutex_init(&ledger_lock);
+    mutex_init(&audit_lock);
+    mutex_init(&create_lock);
+    mutex_init(&report_lock);
+    mutex_init(&snapshot_lock);
+    mutex_init(&eod_lock);
+    mutex_init(&search_lock);
+    mutex_init(&index_lock);
+    mutex_init(&metrics_lock);
+}
+
+void lock_account(BankAccount* account) {
+    mutex_lock(&account_locks[ACCOUNT_STRIPE(account->id)]);
+}
+
+void unlock_account(BankAccount* account) {
+    mutex_unlock(&account_locks[ACCOUNT_STRIPE(account->id)]);
+}
+
+// Two stripes are always taken lowest first, so transfers running in
+// opposite directions between the same accounts cannot deadlock
+void lock_account_pair(BankAccount* a, BankAccount* b) {
+    int first = ACCOUNT_STRIPE(a->id);
+    int second = ACCOUNT_STRIPE(b->id);
+    if (first > second) {
+        int t = first;
+        first = second;
+        second = t;
+    }
+    mutex_lock(&account_locks[first]);
+    if (second != first) {
+        mutex_lock(&account_locks[second]);
+    }
+}
+
+void unlock_account_pair(BankAccount* a, BankAccount* b) {
+    int first = ACCOUNT_STRIPE(a->id);
+    int second = ACCOUNT_STRIPE(b->id);
+    mutex_unlock(&account_locks[first]);
+    if (second != first) {
+        mutex_unlock(&account_locks[second]);
+    }
+}
+
+// Stops every account operation, e.g. while a checkpoint reads all accounts
+void lock_all_accounts() {
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        mutex_lock(&account_locks[i]);
+    }
+}
+
+void unlock_all_accounts() {
+    for (int i = LOCK_STRIPES - 1; i >= 0; i--) {
+        mutex_unlock(&account_locks[i]);
+    }
+}
+
+int account_type(BankAccount* account) {
+    return FLAGS(account->id) & ACCOUNT_TYPE_MASK;
+}
+
+int account_is_active(BankAccount* account) {
+    return (FLAGS(account->id) & ACCOUNT_ACTIVE) != 0;
+}
+
+void set_account_active(BankAccount* account, int active) {
+    snapshot_guard(account->id);
+    if (active) {
+        FLAGS(account->id) |= ACCOUNT_ACTIVE;
+    } else {
+        FLAGS(account->id) &= ~ACCOUNT_ACTIVE;
+    }
+}
+
+const char* account_type_name(int type) {
+    switch (type) {
+        case ACCOUNT_CURRENT: return "CURRENT";
+        case ACCOUNT_PREMIUM: return "PREMIUM";
+        default: return "SAVINGS";
+    }
+}
+
+Money min_balance_for(int type) {
+    switch (type) {
+        case ACCOUNT_CURRENT: return 1000 * MINOR_UNITS;
+        case ACCOUNT_PREMIUM: return 5000 * MINOR_UNITS;
+        default: return MIN_BALANCE * MINOR_UNITS;
+    }
+}
+
+// Makes sure the store has room for count accounts. Only the chunk directory
+// is replaced; existing chunks stay where they are. Lookups read the
+// directory without a lock, so the larger copy is published atomically and
+// the old one is kept: it still points at every chunk it had.
+static int grow_chunk_directory(int chunks) {
+    if (chunks <= account_chunk_capacity) return 1;
+    
+    int capacity = account_chunk_capacity ? account_chunk_capacity * 2 : 16;
+    while (capacity < chunks) capacity *= 2;
+    AccountChunk** grown = malloc(capacity * sizeof(AccountChunk*));
+    if (grown == NULL) return 0;
+    if (account_chunk_count > 0) {
+        memcpy(grown, account_chunks, account_chunk_count * sizeof(AccountChunk*));
+    }
+    if (account_chunks != NULL) retired_chunk_directories[retired_chunk_directory_count++] = account_chunks;
+    __atomic_store_n(&account_chunks, grown, __ATOMIC_RELEASE);
+    account_chunk_capacity = capacity;
+    return 1;
+}
+
+int reserve_accounts(int count) {
+    int chunks_needed = (count + ACCOUNT_CHUNK_SIZE - 1) >> ACCOUNT_CHUNK_SHIFT;
+    
+    if (!grow_chunk_directory(chunks_needed)) return 0;
+    while (account_chunk_count < chunks_needed) {
+        AccountChunk* chunk = calloc(1, sizeof(AccountChunk));
+        if (chunk == NULL) return 0;
+        chunk->data = alloc_chunk_data(account_chunk_count);
+        if (chunk->data == NULL) {
+            free(chunk);
+            return 0;
+        }
+        account_chunks[account_chunk_count++] = chunk;
+    }
+    return 1;
+}
+
+// In mapped mode a new chunk extends accounts.dat by one region and maps it
+AccountChunkData* alloc_chunk_data(int chunk) {
+    if (storage_mode != STORAGE_MAPPED) {
+        return calloc(1, sizeof(AccountChunkData));
+    }
+    
+    long long offset = MAP_ALIGNMENT + (long long)chunk * MAP_CHUNK_STRIDE;
+    if (!resize_file(mapped_fd, offset + MAP_CHUNK_STRIDE)) return NULL;
+    return map_file_region(mapped_fd, offset, MAP_CHUNK_STRIDE);
+}
+
+static void mark_dirty_range(AccountChunk* chunk, size_t offset, size_t length) {
+    for (size_t page = offset / MAP_PAGE_SIZE; page <= (offset + length - 1) / MAP_PAGE_SIZE; page++) {
+        chunk->dirty_pages[page / 32] |= 1u << (page % 32);
+    }
+}
+
+// Records which pages of the mapped file an account's fields live on, so a
+// mapped-mode checkpoint writes back only those pages
+void mark_account_dirty(int id) {
+    AccountChunk* chunk = ACCOUNT_CHUNK(id);
+    size_t slot = ACCOUNT_SLOT(id);
+    mark_dirty_range(chunk, offsetof(AccountChunkData, profiles) + slot * sizeof(BankAccount), sizeof(BankAccount));
+    mark_dirty_range(chunk, offsetof(AccountChunkData, balances) + slot * sizeof(Money), sizeof(Money));
+    mark_dirty_range(chunk, offsetof(AccountChunkData, flags) + slot, 1);
+}
+
+// Version 1 mapped files hold balances as doubles. They are read onto the
+// heap and converted, and load_accounts() then writes a current mapped file.
+static int load_mapped_v1(int fd, const MappedHeader* header) {
+    if (header->chunk_size != ACCOUNT_CHUNK_SIZE || header->chunk_stride != (long long)MAP_CHUNK_STRIDE ||
+        header->account_count < 0 || !reserve_accounts(header->account_count)) {
+        printf("Error: %s has an unsupported mapped layout!\n", ACCOUNTS_FILE);
+        close(fd);
+        return 0;
+    }
+    
+    total_accounts = header->account_count;
+    for (int c = 0; c * ACCOUNT_CHUNK_SIZE < total_accounts; c++) {
+        AccountChunkData* data = account_chunks[c]->data;
+        if (!read_file_region(fd, data, sizeof(AccountChunkData), MAP_ALIGNMENT + (long long)c * MAP_CHUNK_STRIDE)) {
+            printf("Error: %s is damaged!\n", ACCOUNTS_FILE);
+            total_accounts = 0;
+            break;
+        }
+        for (int i = 0; i < chunk_length(c); i++) {
+            upgrade_money(&data->balances[i]);
+        }
+    }
+    close(fd);
+    
+    ledger_bytes = header->ledger_bytes;
+    eod_business_date = header->eod_date;
+    use_mapped_storage = 1;
+    return 1;
+}
+
+// Maps an accounts.dat in the mapped layout. Only the header is read; the
+// account data is paged in by the OS as it is touched, so startup cost does
+// not grow with the number of accounts.
+int open_mapped_accounts() {
+    int fd = open(ACCOUNTS_FILE, O_RDWR | O_BINARY);
+    if (fd < 0) return 0;
+    
+    MappedHeader header;
+    if (read_file_region(fd, &header, sizeof(header), 0) && header.magic == MAPPED_MAGIC &&
+        header.version == 1) {
+        return load_mapped_v1(fd, &header);
+    }
+    if (!read_file_region(fd, &header, sizeof(header), 0) ||
+        header.magic != MAPPED_MAGIC || header.version != MAPPED_VERSION ||
+        header.chunk_size != ACCOUNT_CHUNK_SIZE || header.chunk_stride != (long long)MAP_CHUNK_STRIDE ||
+        header.account_count < 0) {
+        printf("Error: %s has an unsupported mapped layout!\n", ACCOUNTS_FILE);
+        close(fd);
+        return 0;
+    }
+    
+    // All existing chunks come from a single mapping
+    int chunks = (header.account_count + ACCOUNT_CHUNK_SIZE - 1) >> ACCOUNT_CHUNK_SHIFT;
+    char* base = NULL;
+    if (chunks > 0) {
+        base = map_file_region(fd, MAP_ALIGNMENT, (size_t)chunks * MAP_CHUNK_STRIDE);
+        if (base == NULL) {
+            printf("Error: Unable to map %s!\n", ACCOUNTS_FILE);
+            close(fd);
+            return 0;
+        }
+    }
+    
+    if (!grow_chunk_directory(chunks)) {
+        close(fd);
+        return 0;
+    }
+    
+    // Chunks that already exist (when converting) give up their heap data
+    for (int c = 0; c < chunks; c++) {
+        if (c < account_chunk_count) {
+            free(account_chunks[c]->data);
+        } else {
+            account_chunks[c] = calloc(1, sizeof(AccountChunk));
+            if (account_chunks[c] == NULL) return 0;
+        }
+        account_chunks[c]->data = (AccountChunkData*)(base + (size_t)c * MAP_CHUNK_STRIDE);
+        memset(account_chunks[c]->dirty_pages, 0, sizeof(account_chunks[c]->dirty_pages));
+    }
+    account_chunk_count = chunks;
+    mapped_base = base;
+    mapped_base_chunks = chunks;
+    total_accounts = header.account_count;
+    ledger_bytes = header.ledger_bytes;
+    eod_business_date = header.eod_date;
+    account_sequence = header.account_sequence;
+    storage_mode = STORAGE_MAPPED;
+    mapped_fd = fd;
+    return 1;
+}
+
+// Mapped-mode checkpoint: writes back only the dirty pages, coalescing
+// neighbouring pages into one write, then the header.
+int save_mapped_accounts() {
+    for (int c = 0; c < account_chunk_count; c++) {
+        AccountChunk* chunk = account_chunks[c];
+        long long chunk_offset = MAP_ALIGNMENT + (long long)c * MAP_CHUNK_STRIDE;
+        size_t page = 0;
+        
+        while (page < MAP_CHUNK_PAGES) {
+            if (!(chunk->dirty_pages[page / 32] & (1u << (page % 32)))) {
+                page++;
+                continue;
+            }
+            size_t first = page;
+            while (page < MAP_CHUNK_PAGES && (chunk->dirty_pages[page / 32] & (1u << (page % 32)))) {
+                page++;
+            }
+            if (!write_file_region(mapped_fd, (char*)chunk->data + first * MAP_PAGE_SIZE,
+                                   (page - first) * MAP_PAGE_SIZE, chunk_offset + first * MAP_PAGE_SIZE)) {
+                return 0;
+            }
+        }
+        memset(chunk->dirty_pages, 0, sizeof(chunk->dirty_pages));
+    }
+    
+    MappedHeader header = {MAPPED_MAGIC, MAPPED_VERSION, total_accounts, ACCOUNT_CHUNK_SIZE,
+                           MAP_CHUNK_STRIDE, ledger_bytes, eod_business_date, account_sequence};
+    if (!write_file_region(mapped_fd, &header, sizeof(header), 0)) return 0;
+    return sync_fd(mapped_fd);
+}
+
+// Writes every account to a file in the mapped layout
+int write_mapped_accounts(const char* path) {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return 0;
+    
+    MappedHeader header = {MAPPED_MAGIC, MAPPED_VERSION, total_accounts, ACCOUNT_CHUNK_SIZE,
+                           MAP_CHUNK_STRIDE, ledger_bytes, eod_business_date, account_sequence};
+    fwrite(&header, sizeof(header), 1, fp);
+    for (int c = 0; c < account_chunk_count; c++) {
+        fseek(fp, MAP_ALIGNMENT + (long)c * MAP_CHUNK_STRIDE, SEEK_SET);
+        fwrite(account_chunks[c]->data, sizeof(AccountChunkData), 1, fp);
+    }
+    // Every region is mapped at its full stride, so the file must cover it
+    fflush(fp);
+    if (!resize_file(fileno(fp), MAP_ALIGNMENT + (long long)account_chunk_count * MAP_CHUNK_STRIDE) ||
+        !sync_file(fp)) {
+        fclose(fp);
+        return 0;
+    }
+    return fclose(fp) == 0;
+}
+
+// Rewrites accounts.dat in the mapped layout and switches to mapped mode.
+// Used once by --mmap; after that the layout is detected on load.
+int convert_to_mapped() {
+    const char* temp_file = ACCOUNTS_FILE ".tmp";
+    
+    ledger_ensure_loaded();
+    if (!save_ledger()) return 0;
+    if (!write_mapped_accounts(temp_file)) return 0;
+    if (!replace_file(temp_file, ACCOUNTS_FILE)) return 0;
+    journal_reset();
+    return open_mapped_accounts();
+}
+
+// Number of accounts in use in the given chunk
+int chunk_length(int chunk) {
+    int remaining = total_accounts - chunk * ACCOUNT_CHUNK_SIZE;
+    return remaining < ACCOUNT_CHUNK_SIZE ? remaining : ACCOUNT_CHUNK_SIZE;
+}
+
+// Places a new account in the next free slot and registers it in the lookup
+// indexes. Returns NULL when the store cannot grow.
+BankAccount* append_account(const BankAccount* profile, int flags, Money balance) {
+    if (!reserve_accounts(total_accounts + 1)) return NULL;
+    
+    int id = total_accounts;
+    ACCOUNT(id) = *profile;
+    ACCOUNT(id).id = id;
+    BALANCE(id) = balance;
+    LIVE(id) = balance;
+    RING(id) = NULL;
+    FLAGS(id) = flags;
+    HISTORY(id).head = NULL;
+    HISTORY(id).transaction_count = 0;
+    HISTORY(id).last_id = 0;
+    total_accounts++;
+    mark_account_dirty(id);
+    
+    // Accounts replayed from the journal may be newer than the sequence
+    // saved with the snapshot
+    int sequence = account_sequence_of(profile->account_number);
+    if (sequence >= account_sequence) account_sequence = sequence + 1;
+    
+    mutex_lock(&index_lock);
+    if (index_ready) {
+        index_insert(&number_index, id);
+        index_insert(&username_index, id);
+    }
+    mutex_unlock(&index_lock);
+    mutex_lock(&search_lock);
+    if (search_ready && !search_insert(id)) search_reset();
+    mutex_unlock(&search_lock);
+    return &ACCOUNT(id);
+}
+
+int load_accounts() {
+    unsigned int magic = 0;
+    int loaded = 0;
+    
+    // Files a checkpoint was building when it died; the ones they were to
+    // replace are still complete
+    remove(ACCOUNTS_FILE ".tmp");
+    remove(LEDGER_FILE ".tmp");
+    
+    ledger_loaded = 1;              // until a file says there is a ledger to read
+    account_sequence = 0;
+    FILE* fp = fopen(ACCOUNTS_FILE, "rb");
+    if (fp != NULL) {
+        fread(&magic, sizeof(magic), 1, fp);
+        rewind(fp);
+    }
+    
+    if (magic == MAPPED_MAGIC) {
+        fclose(fp);
+        loaded = open_mapped_accounts();
+        ledger_loaded = 0;
+    } else if (fp != NULL) {
+        loaded = 1;
+        SnapshotHeader header = {0};
+        if (fread(&header, offsetof(SnapshotHeader, eod_date), 1, fp) == 1 &&
+            header.magic == SNAPSHOT_MAGIC && header.version >= 4) {
+            loaded = load_compact_snapshot(fp);
+        } else if (header.magic == SNAPSHOT_MAGIC) {
+            if (header.version >= 2) {
+                fread(&header.eod_date, sizeof(header) - offsetof(SnapshotHeader, eod_date), 1, fp);
+            }
+            // Size the store from the header, but only as far as the file
+            // can actually hold that many records
+            long long data_start = header.version >= 2 ? sizeof(header) : offsetof(SnapshotHeader, eod_date);
+            long long record_size = sizeof(BankAccount) + sizeof(Money) + sizeof(unsigned char);
+            fseek(fp, 0, SEEK_END);
+            long long file_size = ftell(fp);
+            fseek(fp, data_start, SEEK_SET);
+            if (header.account_count < 0 ||
+                header.account_count > (file_size - data_start) / record_size ||
+                !reserve_accounts(header.account_count)) {
+                printf("Error: %s is damaged (%d accounts in header)!\n", ACCOUNTS_FILE, header.account_count);
+                header.account_count = 0;
+            }
+            total_accounts = header.account_count;
+            eod_business_date = header.eod_date;
+            
+            // Each column is stored contiguously; read it chunk by chunk
+            for (int c = 0; c * ACCOUNT_CHUNK_SIZE < total_accounts; c++) {
+                fread(account_chunks[c]->data->profiles, sizeof(BankAccount), chunk_length(c), fp);
+            }
+            for (int c = 0; c * ACCOUNT_CHUNK_SIZE < total_accounts; c++) {
+                fread(account_chunks[c]->data->balances, sizeof(Money), chunk_length(c), fp);
+            }
+            for (int c = 0; c * ACCOUNT_CHUNK_SIZE < total_accounts; c++) {
+                fread(account_chunks[c]->data->flags, sizeof(unsigned char), chunk_length(c), fp);
+            }
+            for (int i = 0; i < total_accounts; i++) {
+                ACCOUNT(i).id = i;
+                if (header.version < 3) {
+                    upgrade_money(&BALANCE(i));
+                }
+            }
+            
+            if (header.version >= 2) {
+                ledger_bytes = header.ledger_bytes;
+                ledger_loaded = 0;
+            } else {
+                // Version 1 histories follow the columns; they go to ledger.dat
+                // at the next checkpoint
+                for (int i = 0; i < total_accounts; i++) {
+                    int count = 0;
+                    fread(&count, sizeof(int), 1, fp);
+                    for (int j = 0; j < count; j++) {
+                        Transaction* trans = ledger_append(&HISTORY(i));
+                        if (trans == NULL || fread(trans, sizeof(Transaction), 1, fp) != 1) break;
+                        upgrade_transaction(trans);
+                        audit_append(i, trans, 0);
+                    }
+                }
+            }
+        } else {
+            rewind(fp);
+            load_legacy_accounts(fp);
+        }
+        fclose(fp);
+    }
+    
+    if (account_sequence == 0) account_sequence_recover();
+    
+    // Bring the snapshot up to date with everything committed since the
+    // last checkpoint, then fold the replayed records into a fresh snapshot.
+    int discarded = 0;
+    if (journal_replay(&discarded) > 0 || discarded) {
+        checkpoint();
+    }
+    if (use_mapped_storage && storage_mode != STORAGE_MAPPED && !convert_to_mapped()) {
+        printf("Error: Unable to convert %s to mapped storage!\n", ACCOUNTS_FILE);
+    }
+    journal_open();
+    index_ready = 0;
+    search_reset();
+    for (int i = 0; i < total_accounts; i++) {
+        LIVE(i) = BALANCE(i);
+    }
+    return loaded;
+}
+
+// Reads the original accounts.dat layout (int count followed by full
+// BankAccount images) and splits each record into profile, hot columns and
+// history. The next checkpoint rewrites the file in the current layout.
+int load_legacy_accounts(FILE* fp) {
+    static LegacyBankAccount legacy;
+    int count = 0;
+    
+    total_accounts = 0;
+    if (fread(&count, sizeof(int), 1, fp) != 1) return 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (fread(&legacy, sizeof(LegacyBankAccount), 1, fp) != 1) break;
+        
+        BankAccount profile = {0};
+        strcpy(profile.account_number, legacy.account_number);
+        strcpy(profile.name, legacy.name);
+        strcpy(profile.username, legacy.username);
+        strcpy(profile.password_hash, legacy.password_hash);
+        strcpy(profile.dob, legacy.dob);
+        strcpy(profile.mobile, legacy.mobile);
+        strcpy(profile.email, legacy.email);
+        strcpy(profile.created_date, legacy.created_date);
+        profile.failed_attempts = legacy.failed_attempts;
+        
+        int type = ACCOUNT_SAVINGS;
+        if (strcmp(legacy.account_type, "CURRENT") == 0) type = ACCOUNT_CURRENT;
+        if (strcmp(legacy.account_type, "PREMIUM") == 0) type = ACCOUNT_PREMIUM;
+        BankAccount* account = append_account(&profile, type | (legacy.is_active ? ACCOUNT_ACTIVE : 0),
+                                              money_from_double(legacy.balance));
+        if (account == NULL) break;
+        
+        for (int j = 0; j < legacy.transaction_count && j < MAX_TRANSACTIONS; j++) {
+            Transaction* trans = ledger_append(&HISTORY(account->id));
+            if (trans == NULL) break;
+            *trans = legacy.transactions[j];
+            upgrade_transaction(trans);
+            audit_append(account->id, trans, 0);
+        }
+    }
+    return 1;
+}
+
+int save_accounts() {
+    // New transactions must be durable in the ledger before the snapshot
+    // that counts them replaces the old one
+    if (!save_ledger()) {
+        printf("Error: Unable to save transaction history!\n");
+        return 0;
+    }
+    
+    if (storage_mode == STORAGE_MAPPED) {
+        if (!save_mapped_accounts()) {
+            printf("Error: Unable to save data!\n");
+            return 0;
+        }
+        return 1;
+    }
+    
+    // The new snapshot is written beside the old one and renamed over it once
+    // synced, so a crash leaves one or the other intact, never a mix
+    const char* temp_file = ACCOUNTS_FILE ".tmp";
+    FILE* fp = fopen(temp_file, "wb");
+    if (fp == NULL) {
+        printf("Error: Unable to save data!\n");
+        return 0;
+    }
+    
+    if (!save_compact_snapshot(fp) || !sync_file(fp)) {
+        fclose(fp);
+        printf("Error: Unable to save data!\n");
+        return 0;
+    }
+    fclose(fp);
+    if (!replace_file(temp_file, ACCOUNTS_FILE)) {
+        printf("Error: Unable to save data!\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Every step that puts data on disk passes here first. Under --crash-test the
+// process dies at the fault_countdown-th one, as a crash between two writes
+// would: whatever was still in stdio buffers is lost.
+void fault_point() {
+    if (fault_countdown > 0 && --fault_countdown == 0) {
+        _exit(CRASH_TEST_EXIT);
+    }
+}
+
+int sync_file(FILE* fp) {
+    if (fflush(fp) != 0) return 0;
+    return sync_fd(fileno(fp));
+}
+
+int sync_fd(int fd) {
+    fault_point();
+    unsigned long long start = metric_start(METRIC_FSYNC);
+#ifdef _WIN32
+    int ok = _commit(fd) == 0;
+#else
+    int ok = fsync(fd) == 0;
+#endif
+    metric_finish(METRIC_FSYNC, start, ok ? BANK_OK : BANK_BAD_REQUEST);
+    return ok;
+}
+
+// rename() that also replaces an existing target on Windows. The new name is
+// made durable before returning, since callers clear the journal next.
+int replace_file(const char* from, const char* to) {
+    fault_point();
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    if (rename(from, to) != 0) return 0;
+    int dir = open(".", O_RDONLY);
+    if (dir < 0) return 0;
+    int ok = fsync(dir) == 0;
+    close(dir);
+    return ok;
+#endif
+}
+
+// Private (copy-on-write) writable mapping of part of a file. Changes made
+// through it never reach the file by themselves; write_file_region() puts
+// them there after the journal is durable.
+void* map_file_region(int fd, long long offset, size_t length) {
+#ifdef _WIN32
+    HANDLE file = (HANDLE)_get_osfhandle(fd);
+    long long end = offset + length;
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, (DWORD)(end >> 32), (DWORD)end, NULL);
+    if (mapping == NULL) return NULL;
+    void* view = MapViewOfFile(mapping, FILE_MAP_COPY, (DWORD)(offset >> 32), (DWORD)offset, length);
+    CloseHandle(mapping);
+    return view;
+#else
+    void* view = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+    return view == MAP_FAILED ? NULL : view;
+#endif
+}
+
+void unmap_file_region(void* view, size_t length) {
+#ifdef _WIN32
+    (void)length;
+    UnmapViewOfFile(view);
+#else
+    munmap(view, length);
+#endif
+}
+
+int read_file_region(int fd, void* data, size_t length, long long offset) {
+#ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return 0;
+    return _read(fd, data, length) == (int)length;
+#else
+    return pread(fd, data, length, offset) == (ssize_t)length;
+#endif
+}
+
+int write_file_region(int fd, const void* data, size_t length, long long offset) {
+    fault_point();
+    metric_count(COUNTER_SNAPSHOT_BYTES, length);
+#ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return 0;
+    return _write(fd, data, length) == (int)length;
+#else
+    return pwrite(fd, data, length, offset) == (ssize_t)length;
+#endif
+}
+
+int resize_file(int fd, long long length) {
+#ifdef _WIN32
+    return _chsize_s(fd, length) == 0;
+#else
+    return ftruncate(fd, length) == 0;
+#endif
+}
+
+unsigned int crc32(const void* data, size_t len) {
+    return crc32_update(0, data, len);
+}
+
+// Continues the CRC-32 of earlier data (0 for none) over len more bytes.
+// Eight bytes at a time ("slicing by 8"): table[k][b] is the CRC of byte b
+// followed by k zero bytes.
+unsigned int crc32_update(unsigned int crc, const void* data, size_t len) {
+    static unsigned int table[8][256];
+    static int table_ready = 0;
+    const unsigned char* p = data;
+    crc ^= 0xFFFFFFFF;
+    
+    if (!table_ready) {
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[0][i] = c;
+        }
+        for (int k = 1; k < 8; k++) {
+            for (int i = 0; i < 256; i++) {
+                table[k][i] = table[0][table[k - 1][i] & 0xFF] ^ (table[k - 1][i] >> 8);
+            }
+        }
+        table_ready = 1;
+    }
+    
+    while (len >= 8) {
+        unsigned int low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+              table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static void stream_init(ByteStream* stream, FILE* fp) {
+    stream->fp = fp;
+    stream->position = 0;
+    stream->length = 0;
+    stream->total = 0;
+    stream->crc = 0;
+    stream->failed = 0;
+}
+
+static void stream_flush(ByteStream* stream) {
+    if (stream->position == 0) return;
+    fault_point();
+    if (fwrite(stream->buffer, 1, stream->position, stream->fp) != stream->position) {
+        stream->failed = 1;
+    }
+    metric_count(COUNTER_SNAPSHOT_BYTES, stream->position);
+    stream->crc = crc32_update(stream->crc, stream->buffer, stream->position);
+    stream->position = 0;
+}
+
+static void stream_write(ByteStream* stream, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    while (length > 0) {
+        if (stream->position == SNAPSHOT_BUFFER_SIZE) stream_flush(stream);
+        size_t n = SNAPSHOT_BUFFER_SIZE - stream->position;
+        if (n > length) n = length;
+        memcpy(stream->buffer + stream->position, bytes, n);
+        stream->position += n;
+        stream->total += n;
+        bytes += n;
+        length -= n;
+    }
+}
+
+// Seven bits per byte, least significant first; the top bit marks that
+// more bytes follow
+static void stream_put_varint(ByteStream* stream, unsigned long long value) {
+    unsigned char bytes[10];
+    size_t n = 0;
+    do {
+        bytes[n] = value & 0x7F;
+        value >>= 7;
+        if (value != 0) bytes[n] |= 0x80;
+        n++;
+    } while (value != 0);
+    stream_write(stream, bytes, n);
+}
+
+static void stream_put_string(ByteStream* stream, const char* text) {
+    size_t length = strlen(text);
+    stream_put_varint(stream, length);
+    stream_write(stream, text, length);
+}
+
+// Reads the next chunk of the file into the buffer. The CRC covers each
+// chunk as it arrives, so the checksum of a whole file costs no extra pass.
+static int stream_fill(ByteStream* stream) {
+    stream->position = 0;
+    stream->length = fread(stream->buffer, 1, SNAPSHOT_BUFFER_SIZE, stream->fp);
+    stream->crc = crc32_update(stream->crc, stream->buffer, stream->length);
+    if (stream->length == 0) stream->failed = 1;
+    return stream->length > 0;
+}
+
+static int stream_read(ByteStream* stream, void* data, size_t length) {
+    unsigned char* bytes = data;
+    while (length > 0) {
+        if (stream->position == stream->length && !stream_fill(stream)) return 0;
+        size_t n = stream->length - stream->position;
+        if (n > length) n = length;
+        memcpy(bytes, stream->buffer + stream->position, n);
+        stream->position += n;
+        stream->total += n;
+        bytes += n;
+        length -= n;
+    }
+    return 1;
+}
+
+static int stream_get_varint(ByteStream* stream, unsigned long long* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (stream->position == stream->length && !stream_fill(stream)) return 0;
+        unsigned char byte = stream->buffer[stream->position++];
+        stream->total++;
+        *value |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return 1;
+    }
+    stream->failed = 1;
+    return 0;
+}
+
+// Reads a string into a field of capacity bytes; one that does not fit
+// means the file is damaged
+static int stream_get_string(ByteStream* stream, char* text, size_t capacity) {
+    unsigned long long length;
+    if (!stream_get_varint(stream, &length) || length >= capacity || !stream_read(stream, text, length)) {
+        stream->failed = 1;
+        return 0;
+    }
+    text[length] = '\0';
+    return 1;
+}
+
+static void put_le32(unsigned char* bytes, unsigned int value) {
+    for (int i = 0; i < 4; i++) bytes[i] = (unsigned char)(value >> (8 * i));
+}
+
+static void put_le64(unsigned char* bytes, unsigned long long value) {
+    for (int i = 0; i < 8; i++) bytes[i] = (unsigned char)(value >> (8 * i));
+}
+
+static unsigned int get_le32(const unsigned char* bytes) {
+    unsigned int value = 0;
+    for (int i = 3; i >= 0; i--) value = value << 8 | bytes[i];
+    return value;
+}
+
+static unsigned long long get_le64(const unsigned char* bytes) {
+    unsigned long long value = 0;
+    for (int i = 7; i >= 0; i--) value = value << 8 | bytes[i];
+    return value;
+}
+
+// One account of a compact snapshot: the profile strings, each as a varint
+// length and its bytes, then failed_attempts as a varint, the flags byte and
+// the balance zigzag-encoded as a varint
+static void snapshot_put_account(ByteStream* stream, int id) {
+    BankAccount* account = &ACCOUNT(id);
+    stream_put_string(stream, account->account_number);
+    stream_put_string(stream, account->name);
+    stream_put_string(stream, account->username);
+    stream_put_string(stream, account->password_hash);
+    stream_put_string(stream, account->dob);
+    stream_put_string(stream, account->mobile);
+    stream_put_string(stream, account->email);
+    stream_put_string(stream, account->created_date);
+    stream_put_varint(stream, (unsigned int)account->failed_attempts);
+    unsigned char flags = FLAGS(id);
+    stream_write(stream, &flags, 1);
+    Money balance = BALANCE(id);
+    stream_put_varint(stream, ((unsigned long long)balance << 1) ^ (unsigned long long)(balance >> 63));
+}
+
+static int snapshot_get_account(ByteStream* stream, int id) {
+    BankAccount* account = &ACCOUNT(id);
+    unsigned long long failed_attempts, balance;
+    unsigned char flags;
+    if (!stream_get_string(stream, account->account_number, sizeof(account->account_number)) ||
+        !stream_get_string(stream, account->name, sizeof(account->name)) ||
+        !stream_get_string(stream, account->username, sizeof(account->username)) ||
+        !stream_get_string(stream, account->password_hash, sizeof(account->password_hash)) ||
+        !stream_get_string(stream, account->dob, sizeof(account->dob)) ||
+        !stream_get_string(stream, account->mobile, sizeof(account->mobile)) ||
+        !stream_get_string(stream, account->email, sizeof(account->email)) ||
+        !stream_get_string(stream, account->created_date, sizeof(account->created_date)) ||
+        !stream_get_varint(stream, &failed_attempts) ||
+        !stream_read(stream, &flags, 1) ||
+        !stream_get_varint(stream, &balance)) {
+        return 0;
+    }
+    account->failed_attempts = (int)failed_attempts;
+    account->id = id;
+    FLAGS(id) = flags;
+    BALANCE(id) = (Money)(balance >> 1) ^ -(Money)(balance & 1);
+    return 1;
+}
+
+// Writes the accounts as a version 4 snapshot to fp, which must be seekable:
+// the header is filled in once the checksum of the records is known
+int save_compact_snapshot(FILE* fp) {
+    static ByteStream stream;
+    unsigned char header[SNAPSHOT_HEADER_SIZE] = {0};
+    
+    if (fwrite(header, sizeof(header), 1, fp) != 1) return 0;
+    stream_init(&stream, fp);
+    for (int i = 0; i < total_accounts; i++) {
+        snapshot_put_account(&stream, i);
+    }
+    stream_flush(&stream);
+    if (stream.failed) return 0;
+    
+    put_le32(header, SNAPSHOT_MAGIC);
+    put_le32(header + 4, SNAPSHOT_VERSION);
+    put_le32(header + 8, (unsigned int)total_accounts);
+    put_le32(header + 12, (unsigned int)eod_business_date);
+    put_le64(header + 16, (unsigned long long)ledger_bytes);
+    put_le32(header + 24, stream.crc);
+    put_le32(header + 28, (unsigned int)account_sequence);
+    fault_point();
+    return fseek(fp, 0, SEEK_SET) == 0 && fwrite(header, sizeof(header), 1, fp) == 1;
+}
+
+// Streams a version 4 snapshot in SNAPSHOT_BUFFER_SIZE chunks straight into
+// the columns, checking the record checksum on the way. A damaged file is
+// never loaded, since the next checkpoint would write the damage back.
+int load_compact_snapshot(FILE* fp) {
+    static ByteStream stream;
+    unsigned char header[SNAPSHOT_HEADER_SIZE];
+    
+    rewind(fp);
+    fseek(fp, 0, SEEK_END);
+    long long file_size = ftell(fp);
+    rewind(fp);
+    const char* problem = NULL;
+    if (fread(header, sizeof(header), 1, fp) != 1) {
+        problem = "truncated header";
+    } else if (get_le32(header + 4) != SNAPSHOT_VERSION) {
+        problem = "unsupported version";
+    } else if (get_le32(header + 8) > (unsigned long long)(file_size - SNAPSHOT_HEADER_SIZE) / SNAPSHOT_MIN_RECORD) {
+        problem = "more accounts in header than the file can hold";
+    } else if (!reserve_accounts((int)get_le32(header + 8))) {
+        problem = "out of memory";
+    }
+    
+    if (problem == NULL) {
+        int count = (int)get_le32(header + 8);
+        int complete = 1;
+        stream_init(&stream, fp);
+        for (int i = 0; i < count && complete; i++) {
+            complete = snapshot_get_account(&stream, i);
+        }
+        // Every byte after the header must belong to a record
+        if (!complete || stream.position != stream.length || stream_fill(&stream)) {
+            problem = "records do not match the header";
+        } else if (stream.crc != get_le32(header + 24)) {
+            problem = "checksum mismatch";
+        } else {
+            total_accounts = count;
+        }
+    }
+    if (problem != NULL) {
+        printf("Error: %s is damaged (%s)! Restore it from a backup; it has not been changed.\n",
+               ACCOUNTS_FILE, problem);
+        exit(1);
+    }
+    
+    eod_business_date = (int)get_le32(header + 12);
+    ledger_bytes = (long long)get_le64(header + 16);
+    account_sequence = (int)get_le32(header + 28);
+    ledger_loaded = 0;
+    return 1;
+}
+
+int journal_open() {
+    static char buffer[JOURNAL_BUFFER_SIZE];
+    
+    journal_fp = fopen(JOURNAL_FILE, "ab");
+    if (journal_fp == NULL) {
+        printf("Error: Unable to open journal!\n");
+        return 0;
+    }
+    setvbuf(journal_fp, buffer, _IOFBF, sizeof(buffer));
+    return 1;
+}
+
+// Queues a record in the journal buffer. Nothing is durable until
+// journal_commit() is called, so a caller can group several records
+// (or several operations) under one fsync.
+int journal_append(JournalRecord* rec) {
+    if (!journal_enabled) return 1;
+    
+    mutex_lock(&journal_lock);
+    if (journal_fp == NULL && !journal_open()) {
+        mutex_unlock(&journal_lock);
+        return 0;
+    }
+    
+    if (rec->account >= 0) {
+        mark_account_dirty(rec->account);
+    }
+    if (rec->target >= 0) {
+        mark_account_dirty(rec->target);
+    }
+    
+    fault_point();
+    rec->magic = JOURNAL_MAGIC;
+    rec->lsn = ++journal_lsn;
+    rec->checksum = crc32(rec, offsetof(JournalRecord, checksum));
+    int ok = fwrite(rec, sizeof(JournalRecord), 1, journal_fp) == 1;
+    if (ok) {
+        journal_records++;
+    }
+    mutex_unlock(&journal_lock);
+    metric_count(COUNTER_JOURNAL_BYTES, sizeof(JournalRecord));
+    
+    if (!ok) {
+        printf("Error: Unable to write journal!\n");
+    }
+    return ok;
+}
+
+// Makes every record appended so far durable. Concurrent callers share
+// syncs: whoever finds its records already covered by another thread's sync
+// returns without one.
+int journal_commit() {
+    if (!journal_enabled) return 1;
+    
+    mutex_lock(&journal_lock);
+    if (journal_fp == NULL) {
+        mutex_unlock(&journal_lock);
+        return 0;
+    }
+    unsigned long long lsn = journal_lsn;
+    int fd = fileno(journal_fp);
+    fault_point();
+    int ok = fflush(journal_fp) == 0;
+    mutex_unlock(&journal_lock);
+    
+    mutex_lock(&commit_lock);
+    if (ok && journal_synced_lsn < lsn) {
+        ok = sync_fd(fd);
+        if (ok) {
+            journal_synced_lsn = lsn;
+        }
+    }
+    mutex_unlock(&commit_lock);
+    
+    if (!ok) {
         printf("Error: Unable to save data!\n");
+    }
+    return ok;
+}
+
+// Records written before Money have the same layout with doubles in the
+// amount fields; those written before timestamps have none in their entry.
+// None before JRN4 carry a transaction id, so replay hands out new ones.
+static void journal_upgrade_record(JournalRecord* rec) {
+    int doubles = rec->magic == JOURNAL_MAGIC_V1;
+    Transaction* trans = NULL;
+    
+    switch (rec->type) {
+        case JOURNAL_TRANSACTION:
+        case JOURNAL_TRANSFER:
+        case JOURNAL_POSTING:
+            if (doubles) {
+                upgrade_money(&rec->data.txn.balance_after);
+                upgrade_money(&rec->data.txn.target_balance_after);
+            }
+            rec->data.txn.txn_id = 0;
+            trans = &rec->data.txn.trans;
+            break;
+        case JOURNAL_CREATE:
+            rec->data.create.txn_id = 0;
+            trans = &rec->data.create.trans;
+            break;
+    }
+    if (trans != NULL) {
+        if (doubles) {
+            upgrade_transaction(trans);
+        } else {
+            stamp_transaction(trans);
+        }
+    }
+}
+
+static int journal_record_valid(const JournalRecord* rec) {
+    return (rec->magic == JOURNAL_MAGIC || rec->magic == JOURNAL_MAGIC_V3 || rec->magic == JOURNAL_MAGIC_V2 ||
+            rec->magic == JOURNAL_MAGIC_V1) &&
+           rec->checksum == crc32(rec, offsetof(JournalRecord, checksum));
+}
+
+// Applies journal records on top of the loaded snapshot. Replay stops at the
+// first record with a bad magic or checksum, which is where a crash tore the
+// tail of the file. The postings of an end-of-day run that never reached its
+// marker are applied like any other record; running the date again skips the
+// accounts they posted. Returns the number of records applied; *discarded is
+// set when something after them was dropped, which the next checkpoint must
+// clear before new records are appended.
+int journal_replay(int* discarded) {
+    FILE* fp = fopen(JOURNAL_FILE, "rb");
+    if (fp == NULL) return 0;
+    
+    JournalRecord rec;
+    int applied = 0;
+    while (fread(&rec, sizeof(JournalRecord), 1, fp) == 1) {
+        if (!journal_record_valid(&rec)) {
+            break;
+        }
+        if (rec.magic != JOURNAL_MAGIC) {
+            journal_upgrade_record(&rec);
+        }
+        ledger_ensure_loaded();
+        
+        if (rec.type == JOURNAL_CREATE) {
+            // Creates are journaled in id order; a gap means the records
+            // after it cannot be trusted to name the right accounts
+            if (rec.account > total_accounts) {
+                printf("Error: %s creates account %d after account %d; recovery stops at record %llu!\n",
+                       JOURNAL_FILE, rec.account, total_accounts - 1, rec.lsn);
+                break;
+            }
+            if (rec.account == total_accounts) {
+                BankAccount profile = {0};
+                strcpy(profile.account_number, rec.account_number);
+                strcpy(profile.name, rec.data.create.name);
+                strcpy(profile.username, rec.data.create.username);
+                strcpy(profile.password_hash, rec.data.create.password_hash);
+                strcpy(profile.dob, rec.data.create.dob);
+                strcpy(profile.mobile, rec.data.create.mobile);
+                strcpy(profile.email, rec.data.create.email);
+                strcpy(profile.created_date, rec.data.create.created_date);
+                BankAccount* account = append_account(&profile, rec.data.create.flags,
+                                                      rec.data.create.trans.balance_after);
+                Transaction* trans = account ? ledger_append(&HISTORY(account->id)) : NULL;
+                if (trans != NULL) {
+                    *trans = rec.data.create.trans;
+                    audit_append(account->id, trans, rec.data.create.txn_id);
+                }
+            }
+            journal_lsn = rec.lsn;
+            applied++;
+            continue;
+        }
+        if (rec.type == JOURNAL_EOD) {
+            eod_business_date = rec.data.business_date;
+            journal_lsn = rec.lsn;
+            applied++;
+            continue;
+        }
+        
+        if (rec.account < 0 || rec.account >= total_accounts ||
+            strcmp(ACCOUNT(rec.account).account_number, rec.account_number) != 0) {
+            break;
+        }
+        BankAccount* account = &ACCOUNT(rec.account);
+        TransactionHistory* history = &HISTORY(rec.account);
+        mark_account_dirty(rec.account);
+        if (rec.type == JOURNAL_TRANSFER && rec.target >= 0 && rec.target < total_accounts) {
+            mark_account_dirty(rec.target);
+        }
+        
+        switch (rec.type) {
+            case JOURNAL_TRANSACTION:
+            case JOURNAL_POSTING:
+                BALANCE(rec.account) = rec.data.txn.balance_after;
+                if (history->transaction_count < rec.data.txn.transaction_count) {
+                    Transaction* trans = ledger_append(history);
+                    if (trans != NULL) {
+                        *trans = rec.data.txn.trans;
+                        audit_append(rec.account, trans, rec.data.txn.txn_id);
+                    }
+                }
+                break;
+            case JOURNAL_TRANSFER: {
+                if (rec.target < 0 || rec.target >= total_accounts) break;
+                TransactionHistory* target = &HISTORY(rec.target);
+                BALANCE(rec.account) = rec.data.txn.balance_after;
+                if (history->transaction_count < rec.data.txn.transaction_count) {
+                    Transaction* trans = ledger_append(history);
+                    if (trans != NULL) {
+                        *trans = rec.data.txn.trans;
+                        rec.data.txn.txn_id = audit_append(rec.account, trans, rec.data.txn.txn_id);
+                    }
+                }
+                BALANCE(rec.target) = rec.data.txn.target_balance_after;
+                if (target->transaction_count < rec.data.txn.target_transaction_count) {
+                    // The credit leg mirrors the debit leg recorded in the journal;
+                    // format its description apart from the ledger slot it lands in
+                    char desc[100];
+                    snprintf(desc, sizeof(desc), "Transfer from %s", account->name);
+                    Transaction* trans = ledger_append(target);
+                    if (trans == NULL) break;
+                    *trans = rec.data.txn.trans;
+                    strcpy(trans->type, "TRANSFER_IN");
+                    trans->balance_after = BALANCE(rec.target);
+                    memcpy(trans->description, desc, sizeof(desc));
+                    strcpy(trans->reference_account, account->account_number);
+                    audit_append(rec.target, trans, rec.data.txn.txn_id);
+                }
+                break;
+            }
+            case JOURNAL_STATUS:
+                set_account_active(account, rec.data.status.is_active);
+                account->failed_attempts = rec.data.status.failed_attempts;
+                break;
+            case JOURNAL_PASSWORD:
+                strcpy(account->password_hash, rec.data.password_hash);
+                break;
+        }
+        journal_lsn = rec.lsn;
+        applied++;
+    }
+    fseek(fp, 0, SEEK_END);
+    if (ftell(fp) > (long)(applied * sizeof(JournalRecord))) {
+        *discarded = 1;
+    }
+    
+    fclose(fp);
+    return applied;
+}
+
+// Folds the journal into the snapshot: the snapshot is written and synced
+// first, and only then is the journal truncated. With other threads running
+// the caller must hold lock_all_accounts().
+int checkpoint() {
+    unsigned long long start = metric_start(METRIC_CHECKPOINT);
+    mutex_lock(&commit_lock);
+    int ok = save_accounts() && journal_reset();
+    if (ok) {
+        journal_synced_lsn = journal_lsn;
+    }
+    mutex_unlock(&commit_lock);
+    metric_finish(METRIC_CHECKPOINT, start, ok ? BANK_OK : BANK_BAD_REQUEST);
+    return ok;
+}
+
+// Empties the journal once everything in it is safely in accounts.dat
+int journal_reset() {
+    mutex_lock(&journal_lock);
+    if (journal_fp != NULL) {
+        fclose(journal_fp);
+        journal_fp = NULL;
+    }
+    fault_point();
+    FILE* fp = fopen(JOURNAL_FILE, "wb");
+    if (fp != NULL) {
+        sync_file(fp);
+        fclose(fp);
+    }
+    journal_records = 0;
+    int ok = journal_open();
+    mutex_unlock(&journal_lock);
+    return ok;
+}
+
+// Called from the menu loop between operations, so the cost of rewriting the
+// snapshot is paid once per JOURNAL_CHECKPOINT_RECORDS mutations instead of
+// on every deposit.
+void checkpoint_if_needed() {
+    if (journal_records >= JOURNAL_CHECKPOINT_RECORDS) {
+        checkpoint();
+    }
+}
+
+static void journal_log_change(BankAccount* account, int type) {
+    TransactionHistory* history = &HISTORY(account->id);
+    JournalRecord rec = {0};
+    rec.type = type;
+    rec.account = account->id;
+    rec.target = -1;
+    strcpy(rec.account_number, account->account_number);
+    rec.data.txn.balance_after = BALANCE(account->id);
+    rec.data.txn.transaction_count = history->transaction_count;
+    if (history->transaction_count > 0) {
+        rec.data.txn.trans = *ledger_last(history);
+        rec.data.txn.txn_id = history->last_id;
+    }
+    journal_append(&rec);
+}
+
+void journal_log_transaction(BankAccount* account) {
+    journal_log_change(account, JOURNAL_TRANSACTION);
+}
+
+void journal_log_posting(BankAccount* account) {
+    journal_log_change(account, JOURNAL_POSTING);
+}
+
+void journal_log_eod(int business_date) {
+    JournalRecord rec = {0};
+    rec.type = JOURNAL_EOD;
+    rec.account = -1;
+    rec.target = -1;
+    rec.data.business_date = business_date;
+    journal_append(&rec);
+}
+
+void journal_log_transfer(BankAccount* from, BankAccount* to) {
+    TransactionHistory* history = &HISTORY(from->id);
+    JournalRecord rec = {0};
+    rec.type = JOURNAL_TRANSFER;
+    rec.account = from->id;
+    rec.target = to->id;
+    strcpy(rec.account_number, from->account_number);
+    rec.data.txn.balance_after = BALANCE(from->id);
+    rec.data.txn.target_balance_after = BALANCE(to->id);
+    rec.data.txn.transaction_count = history->transaction_count;
+    rec.data.txn.target_transaction_count = HISTORY(to->id).transaction_count;
+    if (history->transaction_count > 0) {
+        rec.data.txn.trans = *ledger_last(history);
+        rec.data.txn.txn_id = history->last_id;
+    }
+    journal_append(&rec);
+}
+
+void journal_log_status(BankAccount* account) {
+    JournalRecord rec = {0};
+    rec.type = JOURNAL_STATUS;
+    rec.account = account->id;
+    rec.target = -1;
+    strcpy(rec.account_number, account->account_number);
+    rec.data.status.is_active = account_is_active(account);
+    rec.data.status.failed_attempts = account->failed_attempts;
+    journal_append(&rec);
+}
+
+void journal_log_password(BankAccount* account) {
+    JournalRecord rec = {0};
+    rec.type = JOURNAL_PASSWORD;
+    rec.account = account->id;
+    rec.target = -1;
+    strcpy(rec.account_number, account->account_number);
+    strcpy(rec.data.password_hash, account->password_hash);
+    journal_append(&rec);
+}
+
+void journal_log_create(BankAccount* account) {
+    JournalRecord rec = {0};
+    rec.type = JOURNAL_CREATE;
+    rec.account = account->id;
+    rec.target = -1;
+    strcpy(rec.account_number, account->account_number);
+    strcpy(rec.data.create.name, account->name);
+    strcpy(rec.data.create.username, account->username);
+    strcpy(rec.data.create.password_hash, account->password_hash);
+    strcpy(rec.data.create.dob, account->dob);
+    strcpy(rec.data.create.mobile, account->mobile);
+    strcpy(rec.data.create.email, account->email);
+    strcpy(rec.data.create.created_date, account->created_date);
+    rec.data.create.flags = FLAGS(account->id);
+    rec.data.create.txn_id = HISTORY(account->id).last_id;
+    rec.data.create.trans = *ledger_last(&HISTORY(account->id));
+    journal_append(&rec);
+}
+
+void main_menu() {
+    int choice;
+    
+    load_accounts();
+    metrics_start_export();
+    
+    while (1) {
+        checkpoint_if_needed();
+        clear_screen();
+        printf("===============================================================\n");
+        printf("=                    SARNATH ADVANCED BANK                    =\n");
+        printf("=                   Professional Banking System               =\n");
+        printf("===============================================================\n");
+        printf("=  [1] Admin Login                                            =\n");
+        printf("=  [2] User Login                                             =\n");
+        printf("=  [3] Create New Account                                     =\n");
+        printf("=  [4] Exit                                                   =\n");
+        printf("===============================================================\n");
+        printf("\nEnter your choice: ");
+        
+        scanf("%d", &choice);
+        
+        switch (choice) {
+            case 1:
+                admin_panel();
+                break;
+            case 2:
+                user_login();
+                break;
+            case 3:
+                create_account();
+                break;
+            case 4:
+                printf("\nThank you for using Sarnath Bank!\n");
+                checkpoint();
+                metrics_write_final(METRICS_FILE);
+                exit(0);
+            default:
+                printf("Invalid choice! Please try again.\n");
+                pause_system();
+        }
+    }
+}
+
+void admin_panel() {
+    char username[20], password[20];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                        ADMIN LOGIN                          =\n");
+    printf("===============================================================\n");
+    
+    printf("\nEnter Admin Username: ");
+    scanf("%s", username);
+    
+    printf("Enter Admin Password: ");
+    read_password(password, sizeof(password));
+    
+    if (strcmp(username, admin.admin_username) == 0 && 
+        strcmp(password, admin.admin_password) == 0) {
+        
+        int choice;
+        while (1) {
+            clear_screen();
+            printf("===============================================================\n");
+            printf("=                      ADMIN DASHBOARD                        =\n");
+            printf("===============================================================\n");
+            printf("\n[1] View All Accounts\n");
+            printf("[2] Block Account\n");
+            printf("[3] Unblock Account\n");
+            printf("[4] View System Statistics\n");
+            printf("[5] Audit Transactions\n");
+            printf("[6] View Metrics\n");
+            printf("[7] Search Customers\n");
+            printf("[8] Export Data\n");
+            printf("[9] Back to Main Menu\n");
+            printf("\nEnter choice: ");
+            
+            scanf("%d", &choice);
+            
+            switch (choice) {
+                case 1:
+                    admin_view_all_accounts();
+                    break;
+                case 2:
+                    admin_block_account();
+                    break;
+                case 3:
+                    admin_unblock_account();
+                    break;
+                case 4:
+                    admin_view_statistics();
+                    break;
+                case 5:
+                    admin_audit_query();
+                    break;
+                case 6:
+                    admin_view_metrics();
+                    break;
+                case 7:
+                    admin_search_customers();
+                    break;
+                case 8:
+                    admin_export_data();
+                    break;
+                case 9:
+                    return;
+                default:
+                    printf("Invalid choice!\n");
+                    pause_system();
+            }
+        }
+    } else {
+        printf("\n\nInvalid admin credentials!\n");
+        pause_system();
+    }
+}
+
+void user_login() {
+    char username[20], password[20];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                        USER LOGIN                           =\n");
+    printf("===============================================================\n");
+    
+    printf("\nEnter Username: ");
+    scanf("%s", username);
+    
+    printf("Enter Password: ");
+    read_password(password, sizeof(password));
+    
+    BankAccount* account = find_account_by_username(username);
+    
+    if (account == NULL) {
+        printf("\n\nAccount not found!\n");
+        pause_system();
+        return;
+    }
+    
+    int status = bank_login(account, password);
+    journal_commit();
+    
+    if (status == BANK_ACCOUNT_BLOCKED) {
+        printf("\n\nAccount is blocked! Contact administrator.\n");
+        pause_system();
+        return;
+    }
+    if (status != BANK_OK) {
+        if (!account_is_active(account)) {
+            printf("\n\nAccount blocked due to multiple failed attempts!\n");
+        } else {
+            printf("\n\nInvalid password! Attempts remaining: %d\n", MAX_LOGIN_ATTEMPTS - account->failed_attempts);
+        }
+        pause_system();
+        return;
+    }
+    current_user = account;
+    
+    int choice;
+    char amount_text[MONEY_BUFFER_SIZE];
+    while (1) {
+        clear_screen();
+        printf("===============================================================\n");
+        printf("=                    WELCOME %s%-20s                          =\n", "", current_user->name);
+        printf("=                      USER DASHBOARD                         =\n");
+        printf("===============================================================\n");
+        printf("\n[1] View Account Details\n");
+        printf("[2] Deposit Money\n");
+        printf("[3] Withdraw Money\n");
+        printf("[4] Transfer Money\n");
+        printf("[5] Transaction History\n");
+        printf("[6] Change Password\n");
+        printf("[7] Logout\n");
+        printf("\nCurrent Balance: %s\n", format_money(BALANCE(current_user->id), amount_text));
+        printf("\nEnter choice: ");
+        
+        scanf("%d", &choice);
+        
+        switch (choice) {
+            case 1:
+                view_account_details();
+                break;
+            case 2:
+                deposit_money();
+                break;
+            case 3:
+                withdraw_money();
+                break;
+            case 4:
+                transfer_money();
+                break;
+            case 5:
+                view_transaction_history();
+                break;
+            case 6:
+                change_password();
+                break;
+            case 7:
+                current_user = NULL;
+                return;
+            default:
+                printf("Invalid choice!\n");
+                pause_system();
+        }
+    }
+}
+
+void create_account() {
+    BankAccount new_account = {0};
+    Money initial_deposit;
+    char amount_text[MONEY_BUFFER_SIZE];
+    char confirm_password[20];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                    CREATE NEW ACCOUNT                       =\n");
+    printf("===============================================================\n");
+    
+    printf("\nEnter Full Name: ");
+    scanf(" %[^\n]", new_account.name);
+    
+    // Validate name
+    for (int i = 0; new_account.name[i]; i++) {
+        if (!isalpha(new_account.name[i]) && new_account.name[i] != ' ') {
+            printf("Invalid name! Only letters and spaces allowed.\n");
+            pause_system();
+            return;
+        }
+    }
+    
+    printf("Enter Username (8-15 characters): ");
+    scanf("%s", new_account.username);
+    
+    if (strlen(new_account.username) < 8 || strlen(new_account.username) > 15) {
+        printf("Username must be 8-15 characters!\n");
+        pause_system();
+        return;
+    }
+    
+    if (find_account_by_username(new_account.username) != NULL) {
+        printf("Username already exists!\n");
+        pause_system();
+        return;
+    }
+    
+    printf("Enter Email: ");
+    scanf("%s", new_account.email);
+    
+    if (!validate_email(new_account.email)) {
+        printf("Invalid email format!\n");
+        pause_system();
+        return;
+    }
+    
+    printf("Enter Mobile Number (10 digits): ");
+    scanf("%s", new_account.mobile);
+    
+    if (!validate_mobile(new_account.mobile)) {
+        printf("Invalid mobile number!\n");
+        pause_system();
+        return;
+    }
+    
+    printf("Enter Date of Birth (DD/MM/YYYY): ");
+    scanf("%s", new_account.dob);
+    
+    printf("Enter Password: ");
+    char password[20];
+    read_password(password, sizeof(password));
+    
+    printf("\nConfirm Password: ");
+    read_password(confirm_password, sizeof(confirm_password));
+    
+    if (strcmp(password, confirm_password) != 0) {
+        printf("\n\nPasswords don't match!\n");
+        pause_system();
+        return;
+    }
+    
+    printf("\n\nSelect Account Type:\n");
+    printf("[1] Savings (Min Balance: 500)\n");
+    printf("[2] Current (Min Balance: 1000)\n");
+    printf("[3] Premium (Min Balance: 5000)\n");
+    printf("Choice: ");
+    
+    int acc_type;
+    scanf("%d", &acc_type);
+    
+    int type;
+    switch (acc_type) {
+        case 1:
+            type = ACCOUNT_SAVINGS;
+            break;
+        case 2:
+            type = ACCOUNT_CURRENT;
+            break;
+        case 3:
+            type = ACCOUNT_PREMIUM;
+            break;
+        default:
+            printf("Invalid choice!\n");
+            pause_system();
+            return;
+    }
+    Money min_deposit = min_balance_for(type);
+    
+    printf("\nEnter initial deposit (Min: %lld): ", min_deposit / MINOR_UNITS);
+    read_money(&initial_deposit);
+    
+    if (initial_deposit < min_deposit || initial_deposit > MAX_AMOUNT) {
+        printf("Insufficient initial deposit!\n");
+        pause_system();
+        return;
+    }
+    
+    hash_password(password, new_account.password_hash);
+    
+    BankAccount* account;
+    int status = bank_create_account(&new_account, type, initial_deposit, &account);
+    if (status != BANK_OK) {
+        printf("Error: %s!\n", bank_status_message(status));
+        pause_system();
+        return;
+    }
+    journal_commit();
+    
+    printf("\n===============================================================\n");
+    printf("=                  ACCOUNT CREATED SUCCESSFULLY!              =\n");
+    printf("===============================================================\n");
+    printf("\nAccount Number: %s\n", account->account_number);
+    printf("Account Type: %s\n", account_type_name(type));
+    printf("Initial Balance: %s\n", format_money(BALANCE(account->id), amount_text));
+    printf("\nPlease save your account number and login credentials securely!\n");
+    
+    pause_system();
+}
+
+void deposit_money() {
+    Money amount;
+    char amount_text[MONEY_BUFFER_SIZE];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                        DEPOSIT MONEY                        =\n");
+    printf("===============================================================\n");
+    
+    printf("\nCurrent Balance: %s\n", format_money(BALANCE(current_user->id), amount_text));
+    printf("Enter amount to deposit: ");
+    read_money(&amount);
+    
+    int status = bank_deposit(current_user, amount, "Cash Deposit");
+    if (status != BANK_OK) {
+        printf("%s!\n", bank_status_message(status));
+        pause_system();
+        return;
+    }
+    journal_commit();
+    
+    printf("\n✓ Deposit successful!\n");
+    printf("Amount Deposited: %s\n", format_money(amount, amount_text));
+    printf("New Balance: %s\n", format_money(BALANCE(current_user->id), amount_text));
+    
+    pause_system();
+}
+
+void withdraw_money() {
+    Money amount;
+    char amount_text[MONEY_BUFFER_SIZE];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                       WITHDRAW MONEY                        =\n");
+    printf("===============================================================\n");
+    
+    printf("\nCurrent Balance: %s\n", format_money(BALANCE(current_user->id), amount_text));
+    printf("Enter amount to withdraw: ");
+    read_money(&amount);
+    
+    int status = bank_withdraw(current_user, amount, "Cash Withdrawal");
+    if (status == BANK_INSUFFICIENT_BALANCE) {
+        printf("Insufficient balance! Minimum balance required: %lld\n",
+               min_balance_for(account_type(current_user)) / MINOR_UNITS);
+        pause_system();
+        return;
+    } else if (status != BANK_OK) {
+        printf("%s!\n", bank_status_message(status));
+        pause_system();
+        return;
+    }
+    journal_commit();
+    
+    printf("\n✓ Withdrawal successful!\n");
+    printf("Amount Withdrawn: %s\n", format_money(amount, amount_text));
+    printf("New Balance: %s\n", format_money(BALANCE(current_user->id), amount_text));
+    
+    pause_system();
+}
+
+void transfer_money() {
+    char target_account[15];
+    Money amount;
+    char amount_text[MONEY_BUFFER_SIZE];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                       TRANSFER MONEY                        =\n");
+    printf("===============================================================\n");
+    
+    printf("\nCurrent Balance: %s\n", format_money(BALANCE(current_user->id), amount_text));
+    printf("Enter target account number: ");
+    scanf("%s", target_account);
+    
+    BankAccount* target = find_account_by_number(target_account);
+    if (target == NULL) {
+        printf("Target account not found!\n");
+        pause_system();
+        return;
+    }
+    
+    if (!account_is_active(target)) {
+        printf("Target account is blocked!\n");
+        pause_system();
+        return;
+    }
+    
+    if (strcmp(target->account_number, current_user->account_number) == 0) {
+        printf("Cannot transfer to same account!\n");
+        pause_system();
+        return;
+    }
+    
+    printf("Target Account Holder: %s\n", target->name);
+    printf("Enter amount to transfer: ");
+    read_money(&amount);
+    
+    // Process transfer
+    int status = bank_transfer(current_user, target, amount);
+    if (status == BANK_INSUFFICIENT_BALANCE) {
+        printf("Insufficient balance! Minimum balance required: %lld\n",
+               min_balance_for(account_type(current_user)) / MINOR_UNITS);
+        pause_system();
+        return;
+    } else if (status != BANK_OK) {
+        printf("%s!\n", bank_status_message(status));
+        pause_system();
+        return;
+    }
+    journal_commit();
+    
+    printf("\n✓ Transfer successful!\n");
+    printf("Amount Transferred: %s\n", format_money(amount, amount_text));
+    printf("To: %s (%s)\n", target->name, target->account_number);
+    printf("Your New Balance: %s\n", format_money(BALANCE(current_user->id), amount_text));
+    
+    pause_system();
+}
+
+void view_account_details() {
+    char amount_text[MONEY_BUFFER_SIZE];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                     ACCOUNT DETAILS                         =\n");
+    printf("===============================================================\n");
+    
+    ledger_ensure_loaded();
+    printf("\nAccount Number    : %s\n", current_user->account_number);
+    printf("Account Holder    : %s\n", current_user->name);
+    printf("Account Type      : %s\n", account_type_name(account_type(current_user)));
+    printf("Username          : %s\n", current_user->username);
+    printf("Email             : %s\n", current_user->email);
+    printf("Mobile            : %s\n", current_user->mobile);
+    printf("Date of Birth     : %s\n", current_user->dob);
+    printf("Account Created   : %s\n", current_user->created_date);
+    printf("Current Balance   : %s\n", format_money(BALANCE(current_user->id), amount_text));
+    printf("Account Status    : %s\n", account_is_active(current_user) ? "ACTIVE" : "BLOCKED");
+    printf("Total Transactions: %d\n", HISTORY(current_user->id).transaction_count);
+    
+    pause_system();
+}
+
+void view_transaction_history() {
+    Transaction page[HISTORY_PAGE_SIZE];
+    int shown = 0;
+    
+    // Page through the history, newest entry first. Each page offers a
+    // statement instead.
+    for (;;) {
+        clear_screen();
+        printf("===============================================================\n");
+        printf("=                   TRANSACTION HISTORY                       =\n");
+        printf("===============================================================\n");
+        
+        int count = bank_history(current_user, shown, page, HISTORY_PAGE_SIZE);
+        if (count == 0 && shown == 0) {
+            printf("\nNo transactions found!\n");
+            pause_system();
+            return;
+        }
+        
+        printf("\n%-20s %-15s %-12s %-12s %-20s\n", "Date", "Type", "Amount", "Balance", "Description");
+        printf("================================================================================\n");
+        for (int i = 0; i < count; i++) {
+            char amount_text[MONEY_BUFFER_SIZE], balance_text[MONEY_BUFFER_SIZE];
+            printf("%-20s %-15s %-10s %-10s %-20s\n",
+                   page[i].date, page[i].type, format_money(page[i].amount, amount_text), 
+                   format_money(page[i].balance_after, balance_text), page[i].description);
+        }
+        shown += count;
+        
+        int total = HISTORY(current_user->id).transaction_count;
+        if (shown >= total) {
+            printf("\nShowing %d of %d. [S] Statement, any other key to return: ", shown, total);
+        } else {
+            printf("\nShowing %d of %d. [N] Next page, [S] Statement, any other key to return: ", shown, total);
+        }
+        int ch = read_key();
+        if (ch == 's' || ch == 'S') {
+            view_statement();
+            return;
+        }
+        if (shown >= total || (ch != 'n' && ch != 'N')) return;
+    }
+}
+
+// Start of a "DD/MM/YYYY" day in local time, or -1
+static long long parse_day(const char* text) {
+    struct tm local = {0};
+    if (sscanf(text, "%d/%d/%d", &local.tm_mday, &local.tm_mon, &local.tm_year) != 3 ||
+        local.tm_mday < 1 || local.tm_mday > 31 || local.tm_mon < 1 || local.tm_mon > 12) {
+        return -1;
+    }
+    local.tm_mon -= 1;
+    local.tm_year -= 1900;
+    local.tm_isdst = -1;
+    return mktime(&local);
+}
+
+// Transactions of the current user between two dates, optionally of one
+// type or with one counterparty, oldest first
+void view_statement() {
+    char from_text[20], to_text[20], type_text[20], reference[15];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                     ACCOUNT STATEMENT                       =\n");
+    printf("===============================================================\n");
+    
+    printf("\nFrom date (DD/MM/YYYY): ");
+    scanf("%19s", from_text);
+    printf("To date (DD/MM/YYYY): ");
+    scanf("%19s", to_text);
+    printf("Type (ALL, DEPOSIT, WITHDRAW, TRANSFER_IN, TRANSFER_OUT, INTEREST, FEE): ");
+    scanf("%19s", type_text);
+    printf("Other account number (ALL for any): ");
+    scanf("%14s", reference);
+    
+    long long from = parse_day(from_text), to = parse_day(to_text);
+    if (from < 0 || to < 0 || to < from) {
+        printf("\nInvalid date range!\n");
+        pause_system();
+        return;
+    }
+    to += 24 * 60 * 60 - 1;     // through the end of the last day
+    
+    for (char* p = type_text; *p; p++) *p = toupper((unsigned char)*p);
+    int type = strcmp(type_text, "ALL") == 0 ? -1 : history_type(type_text);
+    if (type == HISTORY_OTHER) {
+        printf("\nUnknown transaction type!\n");
+        pause_system();
+        return;
+    }
+    const char* counterparty = strcmp(reference, "ALL") == 0 || strcmp(reference, "all") == 0 ? NULL : reference;
+    
+    int count = history_query(current_user, from, to, type, counterparty, NULL, 0);
+    Transaction** entries = count > 0 ? malloc(count * sizeof(Transaction*)) : NULL;
+    if (count > 0 && entries == NULL) {
+        printf("\nError: Out of memory!\n");
+        pause_system();
+        return;
+    }
+    count = history_query(current_user, from, to, type, counterparty, entries, count);
+    
+    printf("\n%-20s %-15s %-12s %-12s %-20s\n", "Date", "Type", "Amount", "Balance", "Description");
+    printf("================================================================================\n");
+    for (int i = 0; i < count; i++) {
+        char amount_text[MONEY_BUFFER_SIZE], balance_text[MONEY_BUFFER_SIZE];
+        printf("%-20s %-15s %-10s %-10s %-20s\n",
+               entries[i]->date, entries[i]->type, format_money(entries[i]->amount, amount_text),
+               format_money(entries[i]->balance_after, balance_text), entries[i]->description);
+    }
+    printf("\n%d transaction(s) from %s to %s\n", count, from_text, to_text);
+    
+    free(entries);
+    pause_system();
+}
+
+void change_password() {
+    char old_password[20], new_password[20], confirm_password[20];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                      CHANGE PASSWORD                        =\n");
+    printf("===============================================================\n");
+    
+    printf("\nEnter current password: ");
+    read_password(old_password, sizeof(old_password));
+    
+    // The current password is checked once, by bank_change_password(): each
+    // check runs the full key derivation
+    printf("\nEnter new password: ");
+    read_password(new_password, sizeof(new_password));
+    
+    printf("\nConfirm new password: ");
+    read_password(confirm_password, sizeof(confirm_password));
+    
+    if (strcmp(new_password, confirm_password) != 0) {
+        printf("\n\nNew passwords don't match!\n");
+        pause_system();
+        return;
+    }
+    
+    if (bank_change_password(current_user, old_password, new_password) != BANK_OK) {
+        printf("\n\nIncorrect current password!\n");
+        pause_system();
+        return;
+    }
+    journal_commit();
+    
+    printf("\n\n✓ Password changed successfully!\n");
+    pause_system();
+}
+
+static const Money* listing_balances;
+static const unsigned char* listing_flags;
+
+// Highest balance first
+static int compare_by_balance(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    if (listing_balances[x] != listing_balances[y]) return listing_balances[x] > listing_balances[y] ? -1 : 1;
+    return x - y;
+}
+
+// Blocked accounts first
+static int compare_by_status(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    int active_x = listing_flags[x] & ACCOUNT_ACTIVE, active_y = listing_flags[y] & ACCOUNT_ACTIVE;
+    return active_x != active_y ? active_x - active_y : x - y;
+}
+
+// Lists the accounts a page at a time. The listing is ordered once, over a
+// snapshot, so paging back and forth neither skips nor repeats accounts.
+// Accounts are stored in the order they were created in, so that order is
+// the account id.
+void admin_view_all_accounts() {
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                       ALL ACCOUNTS                          =\n");
+    printf("===============================================================\n");
+    
+    if (total_accounts == 0) {
+        printf("\nNo accounts found!\n");
+        pause_system();
+        return;
+    }
+    
+    int order = 1;
+    printf("\nSort by [1] Created date  [2] Balance  [3] Status: ");
+    scanf("%d", &order);
+    
+    Money* balances = NULL;
+    unsigned char* flags = NULL;
+    int count = snapshot_columns(&balances, &flags);
+    int* ids = count >= 0 ? malloc((count + 1) * sizeof(int)) : NULL;
+    if (ids == NULL) {
+        free(balances);
+        free(flags);
+        printf("\nNot enough memory for the listing!\n");
+        pause_system();
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        ids[i] = i;
+    }
+    listing_balances = balances;
+    listing_flags = flags;
+    if (order == 2) qsort(ids, count, sizeof(int), compare_by_balance);
+    if (order == 3) qsort(ids, count, sizeof(int), compare_by_status);
+    
+    int first = 0;
+    for (;;) {
+        int last = first + LIST_PAGE_SIZE < count ? first + LIST_PAGE_SIZE : count;
+        clear_screen();
+        printf("===============================================================\n");
+        printf("=                       ALL ACCOUNTS                          =\n");
+        printf("===============================================================\n");
+        printf("\n%-15s %-20s %-15s %-12s %-8s\n", "Account No", "Name", "Type", "Balance", "Status");
+        printf("========================================================================\n");
+        for (int i = first; i < last; i++) {
+            BankAccount* account = &ACCOUNT(ids[i]);
+            char balance_text[MONEY_BUFFER_SIZE];
+            printf("%-15s %-20s %-15s %-10s %-8s\n", account->account_number, account->name,
+                   account_type_name(flags[ids[i]] & ACCOUNT_TYPE_MASK),
+                   format_money(balances[ids[i]], balance_text),
+                   (flags[ids[i]] & ACCOUNT_ACTIVE) ? "ACTIVE" : "BLOCKED");
+        }
+        printf("\nAccounts %d-%d of %d. [N] Next, [P] Previous, [F] First, [L] Last, any other key to return: ",
+               first + 1, last, count);
+        
+        int ch = tolower(read_key());
+        if (ch == 'n') {
+            if (last < count) first = last;
+        } else if (ch == 'p') {
+            first = first > LIST_PAGE_SIZE ? first - LIST_PAGE_SIZE : 0;
+        } else if (ch == 'f') {
+            first = 0;
+        } else if (ch == 'l') {
+            first = (count - 1) / LIST_PAGE_SIZE * LIST_PAGE_SIZE;
+        } else {
+            break;
+        }
+    }
+    free(ids);
+    free(balances);
+    free(flags);
+}
+
+static const char* export_account_fields[] = {
+    "account_number", "name", "username", "email", "mobile", "dob", "type", "balance", "status",
+    "created_date"
+};
+static const char* export_transaction_fields[] = {
+    "account_number", "date", "timestamp", "type", "amount", "balance_after", "description",
+    "reference_account"
+};
+
+// A text field: quoted in CSV only if it holds a comma, quote or line
+// break, always quoted and escaped in JSON
+static char* export_text(char* out, const char* text, int format) {
+    if (format == EXPORT_CSV && strpbrk(text, ",\"\r\n") == NULL) {
+        size_t length = strlen(text);
+        memcpy(out, text, length);
+        return out + length;
+    }
+    *out++ = '"';
+    for (; *text; text++) {
+        unsigned char c = *text;
+        if (format == EXPORT_CSV) {
+            if (c == '"') *out++ = '"';
+            *out++ = c;
+        } else if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = c;
+        } else if (c < 0x20) {
+            out += sprintf(out, "\\u%04x", c);
+        } else {
+            *out++ = c;
+        }
+    }
+    *out++ = '"';
+    return out;
+}
+
+static char* export_number(char* out, unsigned long long value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+// Rupees with two decimals, a number in both formats
+static char* export_money(char* out, Money amount) {
+    unsigned long long magnitude = amount < 0 ? -(unsigned long long)amount : (unsigned long long)amount;
+    if (amount < 0) *out++ = '-';
+    out = export_number(out, magnitude / MINOR_UNITS);
+    *out++ = '.';
+    *out++ = (char)('0' + magnitude % MINOR_UNITS / 10);
+    *out++ = (char)('0' + magnitude % 10);
+    return out;
+}
+
+// The separator before a field and, in JSON, its name
+static char* export_key(char* out, const char* name, int format, int first) {
+    if (format == EXPORT_CSV) {
+        if (!first) *out++ = ',';
+        return out;
+    }
+    *out++ = first ? '{' : ',';
+    *out++ = '"';
+    size_t length = strlen(name);
+    memcpy(out, name, length);
+    out += length;
+    *out++ = '"';
+    *out++ = ':';
+    return out;
+}
+
+static char* export_end(char* out, int format) {
+    if (format == EXPORT_JSONL) *out++ = '}';
+    *out++ = '\n';
+    return out;
+}
+
+static char* export_account(char* out, int id, Money balance, unsigned char flags, int format) {
+    BankAccount* account = &ACCOUNT(id);
+    const char** name = export_account_fields;
+    out = export_text(export_key(out, *name++, format, 1), account->account_number, format);
+    out = export_text(export_key(out, *name++, format, 0), account->name, format);
+    out = export_text(export_key(out, *name++, format, 0), account->username, format);
+    out = export_text(export_key(out, *name++, format, 0), account->email, format);
+    out = export_text(export_key(out, *name++, format, 0), account->mobile, format);
+    out = export_text(export_key(out, *name++, format, 0), account->dob, format);
+    out = export_text(export_key(out, *name++, format, 0), account_type_name(flags & ACCOUNT_TYPE_MASK), format);
+    out = export_money(export_key(out, *name++, format, 0), balance);
+    out = export_text(export_key(out, *name++, format, 0), flags & ACCOUNT_ACTIVE ? "ACTIVE" : "BLOCKED", format);
+    out = export_text(export_key(out, *name++, format, 0), account->created_date, format);
+    return export_end(out, format);
+}
+
+static char* export_transaction(char* out, BankAccount* account, const Transaction* trans, int format) {
+    const char** name = export_transaction_fields;
+    out = export_text(export_key(out, *name++, format, 1), account->account_number, format);
+    out = export_text(export_key(out, *name++, format, 0), trans->date, format);
+    out = export_number(export_key(out, *name++, format, 0), trans->timestamp);
+    out = export_text(export_key(out, *name++, format, 0), trans->type, format);
+    out = export_money(export_key(out, *name++, format, 0), trans->amount);
+    out = export_money(export_key(out, *name++, format, 0), trans->balance_after);
+    out = export_text(export_key(out, *name++, format, 0), trans->description, format);
+    out = export_text(export_key(out, *name++, format, 0), trans->reference_account, format);
+    return export_end(out, format);
+}
+
+static void export_flush(ExportWriter* writer) {
+    if (writer->position > 0 && fwrite(writer->buffer, 1, writer->position, writer->fp) != writer->position) {
+        writer->failed = 1;
+    }
+    writer->position = 0;
+}
+
+// Where the next row goes; there is room for EXPORT_ROW_MAX bytes
+static char* export_row(ExportWriter* writer) {
+    if (writer->position + EXPORT_ROW_MAX > EXPORT_BUFFER_SIZE) export_flush(writer);
+    return writer->buffer + writer->position;
+}
+
+static void export_row_done(ExportWriter* writer, char* end) {
+    size_t length = end - (writer->buffer + writer->position);
+    writer->position += length;
+    writer->total += length;
+}
+
+// Writes an account's history oldest first, as it stands when reached: the
+// newest segment and its count are read under the stripe lock, and entries
+// already in the history never change. Returns the rows written, or -1
+// when out of memory.
+static long long export_history(ExportWriter* writer, int id, int format, LedgerSegment*** segments,
+                                int* capacity) {
+    BankAccount* account = &ACCOUNT(id);
+    lock_account(account);
+    LedgerSegment* head = HISTORY(id).head;
+    int head_count = head != NULL ? head->count : 0;
+    unlock_account(account);
+    
+    int count = 0;
+    for (LedgerSegment* segment = head; segment != NULL; segment = segment->prev) {
+        if (count == *capacity) {
+            int grown = *capacity ? *capacity * 2 : 16;
+            LedgerSegment** larger = realloc(*segments, grown * sizeof(LedgerSegment*));
+            if (larger == NULL) return -1;
+            *segments = larger;
+            *capacity = grown;
+        }
+        (*segments)[count++] = segment;
+    }
+    
+    long long rows = 0;
+    for (int s = count - 1; s >= 0; s--) {
+        int entries = s == 0 ? head_count : (*segments)[s]->count;
+        for (int i = 0; i < entries; i++) {
+            export_row_done(writer, export_transaction(export_row(writer), account, &(*segments)[s]->entries[i],
+                                                       format));
+        }
+        rows += entries;
+    }
+    return rows;
+}
+
+static THREAD_FUNC export_worker(void* arg) {
+    ExportShard* shard = arg;
+    ExportWriter writer = {NULL, NULL, 0, 0, 0};
+    SnapshotChunk* chunk = NULL;
+    LedgerSegment** segments = NULL;
+    int capacity = 0;
+    
+    writer.fp = fopen(shard->path, "wb");
+    writer.buffer = malloc(EXPORT_BUFFER_SIZE);
+    if (shard->what == EXPORT_ACCOUNTS) chunk = malloc(sizeof(SnapshotChunk));
+    shard->ok = writer.fp != NULL && writer.buffer != NULL && (shard->what != EXPORT_ACCOUNTS || chunk != NULL);
+    if (shard->ok) {
+        // Rows go out in whole buffers, so stdio buffering would only copy them again
+        setvbuf(writer.fp, NULL, _IONBF, 0);
+        if (shard->format == EXPORT_CSV) {
+            const char** fields = shard->what == EXPORT_ACCOUNTS ? export_account_fields : export_transaction_fields;
+            int count = shard->what == EXPORT_ACCOUNTS ? 10 : 8;
+            char* out = export_row(&writer);
+            for (int f = 0; f < count; f++) {
+                if (f > 0) *out++ = ',';
+                out = export_text(out, fields[f], EXPORT_CSV);
+            }
+            *out++ = '\n';
+            export_row_done(&writer, out);
+        }
+    }
+    
+    for (int c = shard->first_chunk; c < shard->last_chunk && shard->ok; c++) {
+        if (shard->what == EXPORT_ACCOUNTS) {
+            int length = snapshot_read(shard->snapshot, c, chunk);
+            for (int i = 0; i < length; i++) {
+                export_row_done(&writer, export_account(export_row(&writer), c * ACCOUNT_CHUNK_SIZE + i,
+                                                        chunk->balances[i], chunk->flags[i], shard->format));
+            }
+            shard->rows += length;
+            continue;
+        }
+        int end = (c + 1) * ACCOUNT_CHUNK_SIZE < shard->account_count ? (c + 1) * ACCOUNT_CHUNK_SIZE
+                                                                       : shard->account_count;
+        for (int id = c * ACCOUNT_CHUNK_SIZE; id < end && shard->ok; id++) {
+            long long rows = export_history(&writer, id, shard->format, &segments, &capacity);
+            if (rows < 0) shard->ok = 0;
+            else shard->rows += rows;
+        }
+    }
+    
+    if (writer.fp != NULL) {
+        export_flush(&writer);
+        if (fclose(writer.fp) != 0 || writer.failed) shard->ok = 0;
+    }
+    shard->bytes = writer.total;
+    free(writer.buffer);
+    free(chunk);
+    free(segments);
+    return 0;
+}
+
+// With several shards, shard k goes to path with ".k" before its extension
+static void export_shard_path(const char* path, int shard, int shards, char* out) {
+    const char* dot = strrchr(path, '.');
+    const char* slash = strrchr(path, '/');
+    const char* backslash = strrchr(path, '\\');
+    if (backslash > slash) slash = backslash;
+    if (shards == 1) {
+        snprintf(out, EXPORT_PATH_MAX, "%s", path);
+    } else if (dot == NULL || (slash != NULL && dot < slash)) {
+        snprintf(out, EXPORT_PATH_MAX, "%s.%d", path, shard);
+    } else {
+        snprintf(out, EXPORT_PATH_MAX, "%.*s.%d%s", (int)(dot - path), path, shard, dot);
+    }
+}
+
+// Writes every account (EXPORT_ACCOUNTS) or every transaction to path as
+// CSV or JSON lines, split into the given number of shards written in
+// parallel. Accounts are exported from a snapshot, transactions account by
+// account. Returns 0 if a file could not be written; *rows and *bytes
+// receive the totals either way.
+int export_data(const char* path, int what, int format, int shards, long long* rows, long long* bytes) {
+    int chunks = (total_accounts + ACCOUNT_CHUNK_SIZE - 1) >> ACCOUNT_CHUNK_SHIFT;
+    if (shards > chunks) shards = chunks;
+    if (shards > EXPORT_MAX_SHARDS) shards = EXPORT_MAX_SHARDS;
+    if (shards < 1) shards = 1;
+    *rows = *bytes = 0;
+    
+    bank_thread* handles = malloc(shards * sizeof(bank_thread));
+    ExportShard* parts = calloc(shards, sizeof(ExportShard));
+    AccountSnapshot* snapshot = NULL;
+    if (handles != NULL && parts != NULL && what == EXPORT_ACCOUNTS) snapshot = snapshot_begin();
+    if (handles == NULL || parts == NULL || (what == EXPORT_ACCOUNTS && snapshot == NULL)) {
+        free(handles);
+        free(parts);
+        return 0;
+    }
+    if (what == EXPORT_TRANSACTIONS) ledger_ensure_loaded();
+    
+    int started = 0;
+    for (int i = 0; i < shards; i++) {
+        parts[i].what = what;
+        parts[i].format = format;
+        parts[i].first_chunk = (int)((long long)chunks * i / shards);
+        parts[i].last_chunk = (int)((long long)chunks * (i + 1) / shards);
+        parts[i].account_count = snapshot != NULL ? snapshot->account_count : total_accounts;
+        parts[i].snapshot = snapshot;
+        export_shard_path(path, i, shards, parts[i].path);
+        if (shards == 1 || !thread_start(&handles[started], export_worker, &parts[i])) {
+            export_worker(&parts[i]);
+        } else {
+            started++;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        thread_join(handles[i]);
+    }
+    if (snapshot != NULL) snapshot_end(snapshot);
+    
+    int ok = 1;
+    for (int i = 0; i < shards; i++) {
+        *rows += parts[i].rows;
+        *bytes += parts[i].bytes;
+        ok = ok && parts[i].ok;
+    }
+    free(handles);
+    free(parts);
+    return ok;
+}
+
+void admin_export_data() {
+    int what = 0, format = 0, shards = 0;
+    char path[EXPORT_PATH_MAX];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                        EXPORT DATA                          =\n");
+    printf("===============================================================\n");
+    
+    printf("\nExport [1] Accounts  [2] Transactions: ");
+    scanf("%d", &what);
+    printf("Format [1] CSV  [2] JSON lines: ");
+    scanf("%d", &format);
+    printf("File name: ");
+    scanf("%511s", path);
+    printf("Files to write in parallel (1 for a single file): ");
+    scanf("%d", &shards);
+    if (what < 1 || what > 2 || format < 1 || format > 2 || shards < 1) {
+        printf("\nInvalid choice!\n");
+        pause_system();
+        return;
+    }
+    
+    long long rows, bytes;
+    double start = now_seconds();
+    int ok = export_data(path, what == 1 ? EXPORT_ACCOUNTS : EXPORT_TRANSACTIONS,
+                         format == 1 ? EXPORT_CSV : EXPORT_JSONL, shards, &rows, &bytes);
+    double seconds = now_seconds() - start;
+    
+    if (!ok) {
+        printf("\nUnable to write %s!\n", path);
+    } else {
+        printf("\n✓ %lld %s exported to %s: %.1f MB in %.2f s\n", rows, what == 1 ? "accounts" : "transactions",
+               path, bytes / 1e6, seconds);
+    }
+    pause_system();
+}
+
+void admin_block_account() {
+    char account_number[15];
+    
+    printf("\nEnter account number to block: ");
+    scanf("%s", account_number);
+    
+    BankAccount* account = find_account_by_number(account_number);
+    if (account == NULL) {
+        printf("Account not found!\n");
+        pause_system();
+        return;
+    }
+    
+    bank_set_active(account, 0);
+    journal_commit();
+    
+    printf("Account %s has been blocked!\n", account_number);
+    pause_system();
+}
+
+void admin_unblock_account() {
+    char account_number[15];
+    
+    printf("\nEnter account number to unblock: ");
+    scanf("%s", account_number);
+    
+    BankAccount* account = find_account_by_number(account_number);
+    if (account == NULL) {
+        printf("Account not found!\n");
+        pause_system();
+        return;
+    }
+    
+    bank_set_active(account, 1);
+    journal_commit();
+    
+    printf("Account %s has been unblocked!\n", account_number);
+    pause_system();
+}
+
+static const Money stats_bucket_floor[STATS_BUCKETS] = {
+    0, 1000 * MINOR_UNITS, 10000 * MINOR_UNITS, 100000 * MINOR_UNITS,
+    1000000 * MINOR_UNITS, 10000000LL * MINOR_UNITS
+};
+
+static void stats_kernel_scalar(const Money* balances, const unsigned char* flags, int n,
+                                const Money* minimum, BankStats* stats) {
+    for (int i = 0; i < n; i++) {
+        Money balance = balances[i];
+        int type = flags[i] & ACCOUNT_TYPE_MASK;
+        
+        stats->type_count[type]++;
+        stats->type_balance[type] += balance;
+        if (flags[i] & ACCOUNT_ACTIVE) {
+            stats->active_count++;
+            stats->active_balance += balance;
+        }
+        stats->below_minimum += balance < minimum[type];
+        
+        int bucket = 0;
+        for (int b = 1; b < STATS_BUCKETS; b++) {
+            bucket += balance >= stats_bucket_floor[b];
+        }
+        stats->bucket_count[bucket]++;
+    }
+    stats->accounts += n;
+}
+
+#ifdef STATS_AVX2
+static long long sum_lanes(__m256i v) __attribute__((target("avx2")));
+static long long sum_lanes(__m256i v) {
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// Four accounts per step. Every figure is a masked sum: comparisons yield
+// all-ones lanes, which are subtracted to count and ANDed with the balances
+// to total. The histogram counts balances at or above each bucket floor
+// above the first.
+__attribute__((target("avx2")))
+static void stats_kernel_avx2(const Money* balances, const unsigned char* flags, int n,
+                              const Money* minimum, BankStats* stats) {
+    const __m256i type_mask = _mm256_set1_epi64x(ACCOUNT_TYPE_MASK);
+    const __m256i active_bit = _mm256_set1_epi64x(ACCOUNT_ACTIVE);
+    __m256i type_value[STATS_TYPES], type_minimum[STATS_TYPES], floor_below[STATS_BUCKETS];
+    __m256i type_count[STATS_TYPES], type_balance[STATS_TYPES], at_least[STATS_BUCKETS];
+    __m256i active_count = _mm256_setzero_si256(), active_balance = _mm256_setzero_si256();
+    __m256i below_minimum = _mm256_setzero_si256();
+    
+    for (int t = 0; t < STATS_TYPES; t++) {
+        type_value[t] = _mm256_set1_epi64x(t);
+        type_minimum[t] = _mm256_set1_epi64x(minimum[t]);
+        type_count[t] = type_balance[t] = _mm256_setzero_si256();
+    }
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        floor_below[b] = _mm256_set1_epi64x(stats_bucket_floor[b] - 1);
+        at_least[b] = _mm256_setzero_si256();
+    }
+    
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i balance = _mm256_loadu_si256((const __m256i*)(balances + i));
+        int packed;
+        memcpy(&packed, flags + i, sizeof(packed));
+        __m256i flag = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+        __m256i type = _mm256_and_si256(flag, type_mask);
+        __m256i active = _mm256_cmpeq_epi64(_mm256_and_si256(flag, active_bit), active_bit);
+        __m256i account_minimum = _mm256_setzero_si256();
+        
+        for (int t = 0; t < STATS_TYPES; t++) {
+            __m256i match = _mm256_cmpeq_epi64(type, type_value[t]);
+            type_count[t] = _mm256_sub_epi64(type_count[t], match);
+            type_balance[t] = _mm256_add_epi64(type_balance[t], _mm256_and_si256(match, balance));
+            account_minimum = _mm256_or_si256(account_minimum, _mm256_and_si256(match, type_minimum[t]));
+        }
+        active_count = _mm256_sub_epi64(active_count, active);
+        active_balance = _mm256_add_epi64(active_balance, _mm256_and_si256(active, balance));
+        below_minimum = _mm256_sub_epi64(below_minimum, _mm256_cmpgt_epi64(account_minimum, balance));
+        for (int b = 1; b < STATS_BUCKETS; b++) {
+            at_least[b] = _mm256_sub_epi64(at_least[b], _mm256_cmpgt_epi64(balance, floor_below[b]));
+        }
+    }
+    
+    for (int t = 0; t < STATS_TYPES; t++) {
+        stats->type_count[t] += sum_lanes(type_count[t]);
+        stats->type_balance[t] += sum_lanes(type_balance[t]);
+    }
+    stats->active_count += sum_lanes(active_count);
+    stats->active_balance += sum_lanes(active_balance);
+    stats->below_minimum += sum_lanes(below_minimum);
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        long long from = b == 0 ? i : sum_lanes(at_least[b]);
+        long long above = b + 1 < STATS_BUCKETS ? sum_lanes(at_least[b + 1]) : 0;
+        stats->bucket_count[b] += from - above;
+    }
+    stats->accounts += i;
+    
+    stats_kernel_scalar(balances + i, flags + i, n - i, minimum, stats);
+}
+#endif
+
+static StatsKernel stats_kernel() {
+#ifdef STATS_AVX2
+    if (__builtin_cpu_supports("avx2")) return stats_kernel_avx2;
+#endif
+    return stats_kernel_scalar;
+}
+
+static void stats_minimums(Money* minimum) {
+    for (int t = 0; t < STATS_TYPES; t++) {
+        minimum[t] = min_balance_for(t);
+    }
+}
+
+// One pass over the balance and flags columns of a snapshot, so the figures
+// add up even while money moves between accounts. Returns 0 when out of memory.
+int bank_stats(BankStats* stats) {
+    StatsKernel kernel = stats_kernel();
+    Money minimum[STATS_TYPES];
+    
+    stats_minimums(minimum);
+    memset(stats, 0, sizeof(BankStats));
+    SnapshotChunk* chunk = malloc(sizeof(SnapshotChunk));
+    AccountSnapshot* snapshot = chunk != NULL ? snapshot_begin() : NULL;
+    if (snapshot == NULL) {
+        free(chunk);
+        return 0;
+    }
+    for (int c = 0; c < snapshot->chunk_count; c++) {
+        int length = snapshot_read(snapshot, c, chunk);
+        kernel(chunk->balances, chunk->flags, length, minimum, stats);
+    }
+    snapshot_end(snapshot);
+    free(chunk);
+    return 1;
+}
+
+void admin_view_statistics() {
+    BankStats stats;
+    char text[MONEY_BUFFER_SIZE];
+    
+    if (!bank_stats(&stats)) {
+        printf("\nNot enough memory for the report!\n");
+        pause_system();
+        return;
+    }
+    
+    Money total_balance = 0;
+    for (int t = 0; t < STATS_TYPES; t++) {
+        total_balance += stats.type_balance[t];
+    }
+    
+    printf("\nTotal Accounts: %lld\n", stats.accounts);
+    printf("Total Bank Balance: %s\n", format_money(total_balance, text));
+    
+    printf("\n%-15s %10s %18s\n", "Type", "Accounts", "Balance");
+    for (int t = ACCOUNT_SAVINGS; t <= ACCOUNT_PREMIUM; t++) {
+        printf("%-15s %10lld %18s\n", account_type_name(t), stats.type_count[t],
+               format_money(stats.type_balance[t], text));
+    }
+    printf("%-15s %10lld %18s\n", "Active", stats.active_count, format_money(stats.active_balance, text));
+    printf("%-15s %10lld %18s\n", "Blocked", stats.accounts - stats.active_count,
+           format_money(total_balance - stats.active_balance, text));
+    printf("\nBelow minimum balance: %lld\n", stats.below_minimum);
+    
+    printf("\nBalance distribution:\n");
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        if (b + 1 < STATS_BUCKETS) {
+            printf("  %10lld - %-10lld %10lld\n", stats_bucket_floor[b] / MINOR_UNITS,
+                   stats_bucket_floor[b + 1] / MINOR_UNITS - 1, stats.bucket_count[b]);
+        } else {
+            printf("  %10lld and above    %10lld\n", stats_bucket_floor[b] / MINOR_UNITS, stats.bucket_count[b]);
+        }
+    }
+    
+    pause_system();
+}
+
+// Counts and latencies of every operation since the program started, as
+// exported to METRICS_FILE
+void admin_view_metrics() {
+    static MetricShard total;
+    metrics_collect(&total);
+    
+    printf("\n%-12s %10s %8s %10s %10s %10s %10s\n", "Operation", "Calls", "Errors", "Mean us", "p50 us",
+           "p99 us", "p99.9 us");
+    for (int t = 0; t < METRIC_TIMERS; t++) {
+        unsigned long long timed = total.timed[t];
+        printf("%-12s %10llu %8llu %10.1f %10.1f %10.1f %10.1f\n", metric_timer_names[t], total.calls[t],
+               total.errors[t], timed ? total.total_ns[t] / 1e3 / timed : 0.0, metric_percentile(&total, t, 0.5) / 1e3,
+               metric_percentile(&total, t, 0.99) / 1e3, metric_percentile(&total, t, 0.999) / 1e3);
+    }
+    
+    unsigned long long lookups = total.counters[COUNTER_LOOKUPS];
+    printf("\nBytes written: journal %llu, snapshot %llu, ledger %llu\n", total.counters[COUNTER_JOURNAL_BYTES],
+           total.counters[COUNTER_SNAPSHOT_BYTES], total.counters[COUNTER_LEDGER_BYTES]);
+    printf("Account lookups: %llu, %.2f index probes each\n", lookups,
+           lookups ? (double)total.counters[COUNTER_LOOKUP_PROBES] / lookups : 0.0);
+    printf("Latencies of deposits, withdrawals, transfers and history pages are sampled, 1 in %d\n",
+           METRIC_SAMPLE_RATE);
+    printf("Exported to %s every %d seconds\n", METRICS_FILE, METRICS_EXPORT_INTERVAL);
+    
+    pause_system();
+}
+
+// Searches the global transaction log by amount, date, counterparty and
+// type; each filter may be left open
+void admin_audit_query() {
+    char min_text[32], max_text[32], from_text[20], to_text[20], reference[15], type_text[20];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                     TRANSACTION AUDIT                       =\n");
+    printf("===============================================================\n");
+    
+    printf("\nMinimum amount (0 for any): ");
+    scanf("%31s", min_text);
+    printf("Maximum amount (0 for any): ");
+    scanf("%31s", max_text);
+    printf("From date (DD/MM/YYYY, ALL for any): ");
+    scanf("%19s", from_text);
+    printf("To date (DD/MM/YYYY, ALL for any): ");
+    scanf("%19s", to_text);
+    printf("Other account number (ALL for any): ");
+    scanf("%14s", reference);
+    printf("Type (ALL, DEPOSIT, WITHDRAW, TRANSFER_IN, TRANSFER_OUT, INTEREST, FEE): ");
+    scanf("%19s", type_text);
+    
+    Money min_amount, max_amount;
+    if (!parse_money(min_text, &min_amount) || !parse_money(max_text, &max_amount)) {
+        printf("\nInvalid amount!\n");
+        pause_system();
+        return;
+    }
+    if (max_amount == 0) max_amount = MAX_AMOUNT;
+    
+    long long from = 0, to = 0xFFFFFFFFLL;     // every unsigned timestamp
+    if (strcmp(from_text, "ALL") != 0 && strcmp(from_text, "all") != 0) {
+        from = parse_day(from_text);
+    }
+    if (strcmp(to_text, "ALL") != 0 && strcmp(to_text, "all") != 0) {
+        to = parse_day(to_text);
+        if (to >= 0) to += 24 * 60 * 60 - 1;   // through the end of the last day
+    }
+    if (from < 0 || to < 0 || to < from || max_amount < min_amount) {
+        printf("\nInvalid range!\n");
+        pause_system();
+        return;
+    }
+    for (char* p = type_text; *p; p++) *p = toupper((unsigned char)*p);
+    int type = strcmp(type_text, "ALL") == 0 ? -1 : history_type(type_text);
+    if (type == HISTORY_OTHER) {
+        printf("\nUnknown transaction type!\n");
+        pause_system();
+        return;
+    }
+    const char* counterparty = strcmp(reference, "ALL") == 0 || strcmp(reference, "all") == 0 ? NULL : reference;
+    
+    AuditEntry results[AUDIT_DISPLAY_LIMIT];
+    double start = now_seconds();
+    int count = audit_query(min_amount, max_amount, from, to, counterparty, type, results, AUDIT_DISPLAY_LIMIT);
+    double elapsed = now_seconds() - start;
+    
+    printf("\n%-10s %-17s %-14s %-13s %12s %-14s\n", "ID", "Date", "Account", "Type", "Amount", "Other Account");
+    printf("==================================================================================\n");
+    for (int i = 0; i < count && i < AUDIT_DISPLAY_LIMIT; i++) {
+        char amount_text[MONEY_BUFFER_SIZE];
+        Transaction* trans = results[i].entry;
+        printf("%-10llu %-17s %-14s %-13s %12s %-14s\n", results[i].id, trans->date,
+               ACCOUNT(results[i].account).account_number, trans->type, format_money(trans->amount, amount_text),
+               trans->reference_account);
+    }
+    if (count > AUDIT_DISPLAY_LIMIT) {
+        printf("... and %d more\n", count - AUDIT_DISPLAY_LIMIT);
+    }
+    printf("\n%d transaction leg(s) found in %.3f ms\n", count, elapsed * 1000);
+    
+    pause_system();
+}
+
+// Pages through the accounts matching part of a name, username, email or
+// mobile. When nothing matches exactly, close matches are listed instead.
+void admin_search_customers() {
+    char query[SEARCH_MAX_QUERY + 1];
+    
+    clear_screen();
+    printf("===============================================================\n");
+    printf("=                     SEARCH CUSTOMERS                        =\n");
+    printf("===============================================================\n");
+    
+    printf("\nName, username, email or mobile (at least %d characters): ", SEARCH_MIN_QUERY);
+    if (scanf(" %48[^\n]", query) != 1) return;
+    if (!bank_search_usable(query)) {
+        printf("\nEnter at least %d letters or digits to search!\n", SEARCH_MIN_QUERY);
+        pause_system();
+        return;
+    }
+    
+    int fuzzy = 0, shown = 0;
+    int results[SEARCH_PAGE_SIZE + 1];
+    for (;;) {
+        double start = now_seconds();
+        int count = bank_search(query, fuzzy, shown, results, SEARCH_PAGE_SIZE + 1);
+        double elapsed = now_seconds() - start;
+        if (count == 0 && shown == 0 && !fuzzy) {
+            fuzzy = 1;
+            count = bank_search(query, fuzzy, shown, results, SEARCH_PAGE_SIZE + 1);
+            elapsed = now_seconds() - start;
+            if (count > 0) printf("\nNo exact matches. Close matches:\n");
+        }
+        if (count == 0 && shown == 0) {
+            printf("\nNo customers found!\n");
+            pause_system();
+            return;
+        }
+        
+        int more = count > SEARCH_PAGE_SIZE;
+        if (more) count = SEARCH_PAGE_SIZE;
+        printf("\n%-15s %-20s %-15s %-28s %-12s %-8s\n", "Account No", "Name", "Username", "Email", "Mobile",
+               "Status");
+        printf("================================================================================================\n");
+        for (int i = 0; i < count; i++) {
+            BankAccount* account = &ACCOUNT(results[i]);
+            printf("%-15s %-20s %-15s %-28s %-12s %-8s\n", account->account_number, account->name,
+                   account->username, account->email, account->mobile,
+                   account_is_active(account) ? "ACTIVE" : "BLOCKED");
+        }
+        shown += count;
+        
+        if (!more) {
+            printf("\n%d customer(s) found in %.3f ms. Press any key to return: ", shown, elapsed * 1000);
+            read_key();
+            return;
+        }
+        printf("\nShowing 1-%d (page in %.3f ms). [N] Next page, any other key to return: ", shown, elapsed * 1000);
+        int ch = read_key();
+        if (ch != 'n' && ch != 'N') return;
+    }
+}
+
+// Splits a CSV line in place; surrounding spaces are trimmed from each field
+static int split_fields(char* line, char** fields, int max_fields) {
+    int count = 0;
+    char* p = line;
+    
+    while (count < max_fields) {
+        while (*p == ' ' || *p == '\t') p++;
+        fields[count++] = p;
+        char* comma = strchr(p, ',');
+        char* end = comma ? comma : p + strlen(p);
+        while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) end--;
+        if (comma == NULL) {
+            *end = '\0';
+            break;
+        }
+        *end = '\0';
+        p = comma + 1;
+    }
+    return count;
+}
+
+// Applies one batch or server command:
+//   LOGIN,<username>,<password>
+//   DEPOSIT,<account>,<amount>[,<description>]
+//   WITHDRAW,<account>,<amount>[,<description>]
+//   TRANSFER,<from account>,<to account>,<amount>
+//   BLOCK,<account>
+//   UNBLOCK,<account>
+// A batch file is run by the operator and may act on any account; a server
+// session is checked by authorize_command() first.
+int apply_command(char** fields, int count) {
+    Money amount;
+    char description[100];
+    
+    if (count < 2) return BANK_BAD_REQUEST;
+    if (strcmp(fields[0], "LOGIN") == 0) {
+        if (count < 3) return BANK_BAD_REQUEST;
+        BankAccount* user = find_account_by_username(fields[1]);
+        return user != NULL ? bank_login(user, fields[2]) : BANK_AUTH_FAILED;
+    }
+    BankAccount* account = find_account_by_number(fields[1]);
+    
+    if (strcmp(fields[0], "DEPOSIT") == 0 || strcmp(fields[0], "WITHDRAW") == 0) {
+        int deposit = fields[0][0] == 'D';
+        if (count < 3 || !parse_money(fields[2], &amount)) return BANK_BAD_REQUEST;
+        if (account == NULL) return BANK_ACCOUNT_NOT_FOUND;
+        snprintf(description, sizeof(description), "%s",
+                 count > 3 ? fields[3] : (deposit ? "Batch Deposit" : "Batch Withdrawal"));
+        return deposit ? bank_deposit(account, amount, description)
+                       : bank_withdraw(account, amount, description);
+    }
+    if (strcmp(fields[0], "TRANSFER") == 0) {
+        if (count < 4 || !parse_money(fields[3], &amount)) return BANK_BAD_REQUEST;
+        BankAccount* target = find_account_by_number(fields[2]);
+        if (account == NULL || target == NULL) return BANK_ACCOUNT_NOT_FOUND;
+        return bank_transfer(account, target, amount);
+    }
+    if (strcmp(fields[0], "BLOCK") == 0 || strcmp(fields[0], "UNBLOCK") == 0) {
+        if (account == NULL) return BANK_ACCOUNT_NOT_FOUND;
+        return bank_set_active(account, fields[0][0] == 'U');
+    }
+    return BANK_BAD_REQUEST;
+}
+
+// A server session acts for the customer it logged in as (user, NULL before
+// a successful LOGIN): it may deposit to and withdraw from that account and
+// transfer out of it. Blocking and unblocking are left to the admin.
+int authorize_command(char** fields, int count, const BankAccount* user) {
+    if (count < 2) return BANK_BAD_REQUEST;
+    if (strcmp(fields[0], "LOGIN") == 0) return BANK_OK;
+    if (user == NULL) return BANK_LOGIN_REQUIRED;
+    if (strcmp(fields[0], "BLOCK") == 0 || strcmp(fields[0], "UNBLOCK") == 0) return BANK_NOT_PERMITTED;
+    return strcmp(fields[1], user->account_number) == 0 ? BANK_OK : BANK_NOT_PERMITTED;
+}
+
+// Streams commands from path ("-" for stdin) and writes one result line per
+// command ("<line>,<command>,<result>") to log_path or stdout. A line longer
+// than BATCH_LINE_LEN is refused whole. Successful commands are committed
+// BATCH_GROUP_SIZE at a time, and the whole batch is folded into accounts.dat
+// with a single checkpoint at the end. A failed commit stops the batch.
+int run_batch(const char* path, const char* log_path) {
+    FILE* in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Error: Unable to open %s!\n", path);
+        return 0;
+    }
+    FILE* out = log_path ? fopen(log_path, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Error: Unable to open %s!\n", log_path);
+        if (in != stdin) fclose(in);
+        return 0;
+    }
+    setvbuf(in, NULL, _IOFBF, BATCH_BUFFER_SIZE);
+    setvbuf(out, NULL, _IOFBF, BATCH_BUFFER_SIZE);
+    
+    load_accounts();
+    
+    char line[BATCH_LINE_LEN];
+    char* fields[BATCH_MAX_FIELDS];
+    long line_number = 0, succeeded = 0, failed = 0;
+    int pending = 0, saved = 1;
+    double start = now_seconds();
+    
+    while (fgets(line, sizeof(line), in) != NULL) {
+        line_number++;
+        int complete = strchr(line, '\n') != NULL || feof(in);
+        if (!complete) {
+            int c;
+            while ((c = getc(in)) != '\n' && c != EOF) {}
+        }
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+        if (!complete) {
+            split_fields(line, fields, BATCH_MAX_FIELDS);
+            fprintf(out, "%ld,%s,Line too long\n", line_number, fields[0]);
+            failed++;
+            continue;
+        }
+        
+        int count = split_fields(line, fields, BATCH_MAX_FIELDS);
+        int status = apply_command(fields, count);
+        fprintf(out, "%ld,%s,%s\n", line_number, fields[0], bank_status_message(status));
+        
+        if (status != BANK_OK) {
+            failed++;
+            continue;
+        }
+        succeeded++;
+        if (++pending >= BATCH_GROUP_SIZE) {
+            saved = journal_commit();
+            if (!saved) break;
+            pending = 0;
+        }
+    }
+    
+    saved = saved && journal_commit() && checkpoint();
+    if (!saved) {
+        fprintf(stderr, "Error: Unable to save the batch; operations up to line %ld may be lost!\n",
+                line_number);
+    }
+    
+    double seconds = now_seconds() - start;
+    fprintf(stderr, "Batch %s: %ld succeeded, %ld failed in %.3f s (%.0f ops/s)\n",
+            saved ? "complete" : "stopped", succeeded, failed, seconds, seconds > 0 ? (succeeded + failed) / seconds : 0.0);
+    
+    if (in != stdin) fclose(in);
+    if (out != stdout) fclose(out);
+    else fflush(out);
+    return saved;
+}
+
+// Customer import. The file is read IMPORT_BLOCK_ROWS lines at a time; the
+// lines of a block are split and checked by worker threads, then the rows
+// that passed are opened with one bank_create_accounts() call, which turns
+// away usernames already in the bank or earlier in the file through the
+// username index. Rows are:
+//   <name>,<username>,<email>,<mobile>,<dob>,<type>,<deposit>,<password hash>
+// with the type SAVINGS, CURRENT or PREMIUM and the hash in any format
+// verify_password() accepts, so customers keep their passwords.
+typedef struct {
+    int count;
+    long lines[IMPORT_BLOCK_ROWS];          // line numbers in the file
+    char text[IMPORT_BLOCK_ROWS][IMPORT_LINE_LEN];
+    BankAccount profiles[IMPORT_BLOCK_ROWS];
+    int types[IMPORT_BLOCK_ROWS];
+    Money deposits[IMPORT_BLOCK_ROWS];
+    int statuses[IMPORT_BLOCK_ROWS];
+    const char* problems[IMPORT_BLOCK_ROWS]; // why a row was refused before reaching the bank
+    // The rows that passed, as passed to bank_create_accounts()
+    BankAccount batch_profiles[IMPORT_BLOCK_ROWS];
+    int batch_types[IMPORT_BLOCK_ROWS];
+    Money batch_deposits[IMPORT_BLOCK_ROWS];
+    int batch_statuses[IMPORT_BLOCK_ROWS];
+    int batch_rows[IMPORT_BLOCK_ROWS];
+} ImportBlock;
+
+typedef struct {
+    ImportBlock* block;
+    int first;
+    int last;
+} ImportWorker;
+
+static int import_copy(char* field, size_t size, const char* text) {
+    size_t length = strlen(text);
+    if (length >= size) return 0;
+    memcpy(field, text, length + 1);
+    return 1;
+}
+
+// Splits row i of the block into its profile and checks it as
+// bank_create_account() would, leaving the reason in problems[i] if it fails
+static void import_check_row(ImportBlock* block, int i) {
+    char* fields[IMPORT_FIELDS + 1];
+    BankAccount* profile = &block->profiles[i];
+    memset(profile, 0, sizeof(BankAccount));
+    block->statuses[i] = BANK_BAD_REQUEST;
+    if (block->problems[i] != NULL) return;
+    
+    if (split_fields(block->text[i], fields, IMPORT_FIELDS + 1) != IMPORT_FIELDS) {
+        block->problems[i] = "Expected 8 fields";
+        return;
+    }
+    if (!import_copy(profile->name, sizeof(profile->name), fields[0]) ||
+        !import_copy(profile->username, sizeof(profile->username), fields[1]) ||
+        !import_copy(profile->email, sizeof(profile->email), fields[2]) ||
+        !import_copy(profile->mobile, sizeof(profile->mobile), fields[3]) ||
+        !import_copy(profile->dob, sizeof(profile->dob), fields[4]) ||
+        !import_copy(profile->password_hash, sizeof(profile->password_hash), fields[7])) {
+        block->problems[i] = "Field too long";
+        return;
+    }
+    block->types[i] = -1;
+    for (int type = ACCOUNT_SAVINGS; type <= ACCOUNT_PREMIUM; type++) {
+        if (strcmp(fields[5], account_type_name(type)) == 0) block->types[i] = type;
+    }
+    if (block->types[i] < 0) {
+        block->problems[i] = "Unknown account type";
+    } else if (!parse_money(fields[6], &block->deposits[i])) {
+        block->problems[i] = "Invalid deposit";
+    } else if (!valid_password_hash(profile->password_hash)) {
+        block->problems[i] = "Invalid password hash";
+    } else if ((block->problems[i] = profile_problem(profile)) == NULL) {
+        block->statuses[i] = check_new_account(profile, block->types[i], block->deposits[i]);
+    }
+}
+
+static THREAD_FUNC import_worker(void* arg) {
+    ImportWorker* worker = arg;
+    for (int i = worker->first; i < worker->last; i++) {
+        import_check_row(worker->block, i);
+    }
+    return 0;
+}
+
+// Fills the block with the next lines of in, skipping blank lines, comments
+// and a header line. Returns how many rows it read.
+static int import_read_block(FILE* in, ImportBlock* block, long* line_number) {
+    block->count = 0;
+    while (block->count < IMPORT_BLOCK_ROWS) {
+        char* text = block->text[block->count];
+        if (fgets(text, IMPORT_LINE_LEN, in) == NULL) break;
+        ++*line_number;
+        block->problems[block->count] = NULL;
+        if (strchr(text, '\n') == NULL && !feof(in)) {
+            int c;
+            while ((c = getc(in)) != '\n' && c != EOF) {}
+            block->problems[block->count] = "Line too long";
+        } else if (text[0] == '#' || text[0] == '\n' || text[0] == '\r' ||
+                   (*line_number == 1 && strncmp(text, "name,", 5) == 0)) {
+            continue;
+        }
+        block->lines[block->count++] = *line_number;
+    }
+    return block->count;
+}
+
+// Imports the customers in path ("-" for stdin), writing one line per
+// refused row ("<line>,<username>,<reason>") to rejects. The journal is off
+// during the import and everything accepted is written by one checkpoint at
+// the end, so an import that does not finish leaves the bank as it was.
+int import_customers(const char* path, FILE* rejects, int workers, long* accepted, long* rejected) {
+    *accepted = *rejected = 0;
+    FILE* in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    ImportBlock* block = in != NULL ? malloc(sizeof(ImportBlock)) : NULL;
+    bank_thread* threads = block != NULL ? malloc(workers * sizeof(bank_thread)) : NULL;
+    ImportWorker* worker_ranges = threads != NULL ? malloc(workers * sizeof(ImportWorker)) : NULL;
+    if (worker_ranges == NULL) {
+        if (in != NULL && in != stdin) fclose(in);
+        free(block);
+        free(threads);
+        return 0;
+    }
+    setvbuf(in, NULL, _IOFBF, BATCH_BUFFER_SIZE);
+    
+    int journal_was_enabled = journal_enabled;
+    journal_enabled = 0;
+    long line_number = 0;
+    while (import_read_block(in, block, &line_number) > 0) {
+        int count = block->count;
+        int used = workers < count ? workers : count;
+        for (int w = 0; w < used; w++) {
+            worker_ranges[w].block = block;
+            worker_ranges[w].first = (int)((long long)count * w / used);
+            worker_ranges[w].last = (int)((long long)count * (w + 1) / used);
+            if (used == 1 || !thread_start(&threads[w], import_worker, &worker_ranges[w])) {
+                import_worker(&worker_ranges[w]);
+                worker_ranges[w].block = NULL;
+            }
+        }
+        for (int w = 0; w < used; w++) {
+            if (worker_ranges[w].block != NULL) thread_join(threads[w]);
+        }
+        
+        int passed = 0;
+        for (int i = 0; i < count; i++) {
+            if (block->statuses[i] != BANK_OK) continue;
+            block->batch_profiles[passed] = block->profiles[i];
+            block->batch_types[passed] = block->types[i];
+            block->batch_deposits[passed] = block->deposits[i];
+            block->batch_rows[passed++] = i;
+        }
+        *accepted += bank_create_accounts(block->batch_profiles, block->batch_types, block->batch_deposits, passed,
+                                          block->batch_statuses, NULL);
+        for (int k = 0; k < passed; k++) {
+            block->statuses[block->batch_rows[k]] = block->batch_statuses[k];
+        }
+        
+        for (int i = 0; i < count; i++) {
+            if (block->statuses[i] == BANK_OK) continue;
+            fprintf(rejects, "%ld,%s,%s\n", block->lines[i], block->profiles[i].username,
+                    block->problems[i] != NULL ? block->problems[i] : bank_status_message(block->statuses[i]));
+            ++*rejected;
+        }
+    }
+    
+    int ok = !ferror(in) && checkpoint();
+    journal_enabled = journal_was_enabled;
+    if (in != stdin) fclose(in);
+    free(block);
+    free(threads);
+    free(worker_ranges);
+    return ok;
+}
+
+int run_import(const char* path, const char* rejects_path, int workers) {
+    FILE* out = rejects_path ? fopen(rejects_path, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Error: Unable to open %s!\n", rejects_path);
+        return 0;
+    }
+    setvbuf(out, NULL, _IOFBF, BATCH_BUFFER_SIZE);
+    load_accounts();
+    
+    long accepted, rejected;
+    double start = now_seconds();
+    int ok = import_customers(path, out, workers, &accepted, &rejected);
+    double seconds = now_seconds() - start;
+    if (out != stdout) fclose(out);
+    else fflush(out);
+    if (!ok) {
+        fprintf(stderr, "Error: Unable to import %s; the bank is unchanged!\n", path);
+        return 0;
+    }
+    fprintf(stderr, "Import complete: %ld accepted, %ld rejected in %.3f s (%.0f rows/s)\n",
+            accepted, rejected, seconds, seconds > 0 ? (accepted + rejected) / seconds : 0.0);
+    return 1;
+}
+
+// End-of-day job. Savings and premium accounts earn a day's interest on
+// their balance; current accounts below their minimum balance pay the
+// maintenance fee. Accounts are split into contiguous ranges, one per
+// thread; all postings of a business date are closed by one JOURNAL_EOD
+// record and made durable by a single commit, and a date is only run once.
+// An account is posted at most once per date even when a run is cut short
+// and the date is run again: its history records the dates it was posted for.
+typedef struct {
+    int first;
+    int last;                   // one past the last account of the range
+    int business_date;
+    const Money* balances;      // of all accounts, as of the start of the run
+    const unsigned char* flags;
+    long long interest_count;
+    long long fee_count;
+    Money interest_total;
+    Money fee_total;
+} EodWorker;
+
+int interest_rate_for(int type) {
+    switch (type) {
+        case ACCOUNT_SAVINGS: return EOD_SAVINGS_RATE;
+        case ACCOUNT_PREMIUM: return EOD_PREMIUM_RATE;
+        default: return 0;
+    }
+}
+
+// The YYYY-MM-DD business date an interest or fee entry was posted for,
+// which ends its description; NULL for any other entry. Dates in this form
+// compare with strcmp().
+static const char* posting_date(const Transaction* trans) {
+    size_t length = strlen(trans->description);
+    if ((strcmp(trans->type, "INTEREST") != 0 && strcmp(trans->type, "FEE") != 0) || length < 10) {
+        return NULL;
+    }
+    return trans->description + length - 10;
+}
+
+// The newest business date the account has a posting for, or NULL. Caller
+// holds the stripe lock.
+static const char* last_posted_date(BankAccount* account) {
+    for (LedgerSegment* segment = HISTORY(account->id).head; segment != NULL; segment = segment->prev) {
+        for (int i = segment->count - 1; i >= 0; i--) {
+            const char* date = posting_date(&segment->entries[i]);
+            if (date != NULL) return date;
+        }
+    }
+    return NULL;
+}
+
+// Applies a posting under the account lock, unless the account already has
+// one for the business date (YYYY-MM-DD) or the interest would take it past
+// LIVE_BALANCE_LIMIT. Unlike a withdrawal a fee may take the balance under
+// the minimum, but never below zero. Returns whether it was posted.
+static int eod_post(BankAccount* account, const char* business_date, const char* type, Money change,
+                    const char* description) {
+    lock_account(account);
+    const char* posted = last_posted_date(account);
+    unsigned long long old;
+    int allowed = posted == NULL || strcmp(posted, business_date) < 0;
+    if (allowed && change > 0) {
+        allowed = live_credit(account, change, &old);
+    } else if (allowed) {
+        old = __atomic_fetch_add(&LIVE(account->id), LIVE_STEP + change, __ATOMIC_ACQ_REL);
+    }
+    if (!allowed) {
+        unlock_account(account);
+        return 0;
+    }
+    ring_catch_up(account, LIVE_SEQ(old));
+    record_change(account, type, change > 0 ? change : -change, LIVE_BALANCE(old) + change, description, NULL, 0);
+    ring_skip(account, LIVE_SEQ(old));
+    journal_log_posting(account);
+    unlock_account(account);
+    return 1;
+}
+
+static char* format_business_date(int date, char* text) {
+    sprintf(text, "%04d-%02d-%02d", date / 10000, date / 100 % 100, date % 100);
+    return text;
+}
+
+static THREAD_FUNC eod_worker(void* arg) {
+    EodWorker* worker = arg;
+    char date_text[16], interest_text[100], fee_text[100];
+    format_business_date(worker->business_date, date_text);
+    sprintf(interest_text, "Interest %s", date_text);
+    sprintf(fee_text, "Maintenance fee %s", date_text);
+    
+    for (int id = worker->first; id < worker->last; id++) {
+        BankAccount* account = &ACCOUNT(id);
+        int type = worker->flags[id] & ACCOUNT_TYPE_MASK;
+        Money balance = worker->balances[id];
+        
+        Money interest = balance * interest_rate_for(type) / (10000LL * EOD_DAYS_PER_YEAR);
+        if (interest > 0) {
+            if (eod_post(account, date_text, "INTEREST", interest, interest_text)) {
+                worker->interest_count++;
+                worker->interest_total += interest;
+            }
+        } else if (type == ACCOUNT_CURRENT && balance < min_balance_for(type) && balance > 0) {
+            Money fee = balance < EOD_MAINTENANCE_FEE ? balance : EOD_MAINTENANCE_FEE;
+            if (eod_post(account, date_text, "FEE", -fee, fee_text)) {
+                worker->fee_count++;
+                worker->fee_total += fee;
+            }
+        }
+    }
+    return 0;
+}
+
+// Runs the postings of one business date over all accounts with the given
+// number of threads, then commits them. Interest and fees are worked out
+// from a snapshot, so money moving between accounts during the run is
+// counted exactly once. Returns 0 if the date has already been run, memory
+// ran out or the commit failed; totals are summed into *result. The date
+// only counts as run once its commit succeeds.
+static int eod_post_all(int business_date, int threads, EodWorker* result) {
+    mutex_lock(&eod_lock);
+    if (business_date <= eod_business_date) {
+        mutex_unlock(&eod_lock);
+        return 0;
+    }
+    
+    bank_thread* handles = malloc(threads * sizeof(bank_thread));
+    EodWorker* workers = calloc(threads, sizeof(EodWorker));
+    Money* balances = NULL;
+    unsigned char* flags = NULL;
+    int count = handles != NULL && workers != NULL ? snapshot_columns(&balances, &flags) : -1;
+    if (count < 0) {
+        free(handles);
+        free(workers);
+        mutex_unlock(&eod_lock);
+        return 0;
+    }
+    
+    // Histories must be in memory before the threads append to them
+    ledger_ensure_loaded();
+    
+    int per_thread = (count + threads - 1) / threads;
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i].first = i * per_thread < count ? i * per_thread : count;
+        workers[i].last = workers[i].first + per_thread < count ? workers[i].first + per_thread : count;
+        workers[i].business_date = business_date;
+        workers[i].balances = balances;
+        workers[i].flags = flags;
+        if (!thread_start(&handles[started], eod_worker, &workers[i])) {
+            eod_worker(&workers[i]);
+        } else {
+            started++;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        thread_join(handles[i]);
+    }
+    
+    memset(result, 0, sizeof(EodWorker));
+    for (int i = 0; i < threads; i++) {
+        result->interest_count += workers[i].interest_count;
+        result->interest_total += workers[i].interest_total;
+        result->fee_count += workers[i].fee_count;
+        result->fee_total += workers[i].fee_total;
+    }
+    free(handles);
+    free(workers);
+    free(balances);
+    free(flags);
+    
+    journal_log_eod(business_date);
+    int ok = journal_commit();
+    if (ok) {
+        eod_business_date = business_date;
+    }
+    mutex_unlock(&eod_lock);
+    return ok;
+}
+
+// Parses YYYY-MM-DD into YYYYMMDD, or 0 for a date that does not exist;
+// "today" is the local date
+static int parse_business_date(const char* text) {
+    int year, month, day;
+    
+    if (strcmp(text, "today") == 0) {
+        time_t now = time(NULL);
+        struct tm local;
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        return (local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday;
+    }
+    if (sscanf(text, "%4d-%2d-%2d", &year, &month, &day) != 3 ||
+        year < 1900 || month < 1 || month > 12 || day < 1 || day > 31) {
+        return 0;
+    }
+    
+    // mktime() rolls 2026-02-31 over into March; the date exists only if it
+    // comes back unchanged. Noon keeps a DST change from moving the day.
+    struct tm local = {0};
+    local.tm_year = year - 1900;
+    local.tm_mon = month - 1;
+    local.tm_mday = day;
+    local.tm_hour = 12;
+    local.tm_isdst = -1;
+    if (mktime(&local) == (time_t)-1 ||
+        local.tm_year != year - 1900 || local.tm_mon != month - 1 || local.tm_mday != day) {
+        return 0;
+    }
+    return year * 10000 + month * 100 + day;
+}
+
+int run_eod(const char* business_date, int threads) {
+    int date = parse_business_date(business_date);
+    if (date == 0) {
+        fprintf(stderr, "Error: Invalid business date %s (expected YYYY-MM-DD)!\n", business_date);
         return 0;
     }
-    
-    fwrite(&total_accounts, sizeof(int), 1, fp);
-    fwrite(accounts, sizeof(BankAccount), total_accounts, fp);
-    fclose(fp);
-    return 1;
+    
+    load_accounts();
+    
+    char date_text[16], last_text[16];
+    format_business_date(date, date_text);
+    if (date <= eod_business_date) {
+        printf("End of day %s already run (last business date %s), nothing posted\n",
+               date_text, format_business_date(eod_business_date, last_text));
+        return 1;
+    }
+    
+    EodWorker totals;
+    double start = now_seconds();
+    if (!eod_post_all(date, threads, &totals)) return 0;
+    double seconds = now_seconds() - start;
+    checkpoint();
+    
+    char interest_text[MONEY_BUFFER_SIZE], fee_text[MONEY_BUFFER_SIZE];
+    printf("End of day %s: %lld interest postings (%s), %lld fees (%s)\n", date_text,
+           totals.interest_count, format_money(totals.interest_total, interest_text),
+           totals.fee_count, format_money(totals.fee_total, fee_text));
+    printf("%d accounts in %.3f s with %d threads (%.0f accounts/s)\n", total_accounts, seconds, threads,
+           seconds > 0 ? total_accounts / seconds : 0.0);
+    return 1;
+}
+
+// Times end-of-day runs over EOD_BENCH_ACCOUNTS accounts created in memory,
+// with 1, 2, 4 ... max_threads threads and one business date per run. The
+// journal is off, so no file is touched.
+int run_eod_bench(int max_threads) {
+    journal_enabled = 0;
+    ledger_loaded = 1;
+    
+    for (int i = 0; i < EOD_BENCH_ACCOUNTS; i++) {
+        BankAccount profile = {0};
+        sprintf(profile.account_number, "EOD%08d", i);
+        Money balance = (Money)(i % 1000 + 1) * 100 * MINOR_UNITS;
+        if (append_account(&profile, i % 3 | ACCOUNT_ACTIVE, balance) == NULL) return 0;
+    }
+    
+    // An untimed first run gives every history its first ledger segment
+    EodWorker totals;
+    int date = 20260101;
+    eod_post_all(date++, 1, &totals);
+    
+    printf("%d accounts\n", EOD_BENCH_ACCOUNTS);
+    printf("%-8s %16s\n", "Threads", "Accounts/s");
+    
+    for (int count = 1; ; count *= 2) {
+        if (count > max_threads) count = max_threads;
+        
+        double start = now_seconds();
+        eod_post_all(date++, count, &totals);
+        printf("%-8d %16.0f\n", count, EOD_BENCH_ACCOUNTS / (now_seconds() - start));
+        fflush(stdout);
+        
+        if (count == max_threads) break;
+    }
+    return 1;
+}
+
+// Seconds on a monotonic clock, for timing operations
+double now_seconds() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// Peak resident set size of the process in KB, or -1 where it is not known
+long peak_rss_kb() {
+#ifdef _WIN32
+    return -1;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+int cpu_count() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+// Server mode. Each session has a thread that reads command lines (the
+// --batch format) and queues them as one batch; a pool of workers executes
+// the queued batches under the account stripe locks and commits the journal
+// once per group of batches before the session sends the results back, one
+// line each. A batch runs on one worker in the order it was sent.
+
+typedef struct {
+    char line[BATCH_LINE_LEN];
+    BankAccount* user;          // the session's customer; a LOGIN leaves the one it logged in
+    int status;
+} ServerJob;
+
+typedef struct ServerBatch {
+    ServerJob* jobs;
+    int count;
+    int done;
+    bank_cond* done_cond;
+    struct ServerBatch* next;
+} ServerBatch;
+
+typedef struct {
+    bank_socket listener;
+    int port;
+    int worker_count;
+    bank_thread* workers;
+    bank_thread acceptor;
+    bank_mutex lock;            // guards everything below
+    bank_cond work;
+    ServerBatch* head;
+    ServerBatch* tail;
+    int sessions;               // open sessions
+    int stopping;
+    int failed;                 // a journal commit failed; nothing more is executed
+} Server;
+
+typedef struct {
+    Server* server;
+    bank_socket fd;
+    bank_cond done;
+} ServerSession;
+
+static int send_all(bank_socket fd, const char* data, size_t length) {
+    while (length > 0) {
+        int n = send(fd, data, (int)length, 0);
+        if (n <= 0) return 0;
+        data += n;
+        length -= n;
+    }
+    return 1;
+}
+
+static bank_socket connect_local(int port) {
+    bank_socket fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) return INVALID_SOCKET;
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        closesocket(fd);
+        return INVALID_SOCKET;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+    return fd;
+}
+
+// Queues a session's jobs as one batch and waits until a worker has
+// executed them
+static void server_execute(Server* server, ServerJob* jobs, int count, bank_cond* done) {
+    ServerBatch batch = {jobs, count, 0, done, NULL};
+    
+    mutex_lock(&server->lock);
+    if (server->tail != NULL) {
+        server->tail->next = &batch;
+    } else {
+        server->head = &batch;
+    }
+    server->tail = &batch;
+    cond_broadcast(&server->work);
+    while (!batch.done) {
+        cond_wait(done, &server->lock);
+    }
+    mutex_unlock(&server->lock);
+}
+
+static THREAD_FUNC server_worker(void* arg) {
+    Server* server = arg;
+    ServerBatch* group[SERVER_GROUP_SIZE];
+    char* fields[BATCH_MAX_FIELDS];
+    
+    mutex_lock(&server->lock);
+    for (;;) {
+        while (server->head == NULL && !(server->stopping && server->sessions == 0)) {
+            cond_wait(&server->work, &server->lock);
+        }
+        if (server->head == NULL) break;
+        
+        // Whole batches only, so that no session's commands are split
+        // between workers; a batch never holds more than SERVER_GROUP_SIZE
+        int count = 0, jobs = 0;
+        while (server->head != NULL && jobs + server->head->count <= SERVER_GROUP_SIZE) {
+            jobs += server->head->count;
+            group[count++] = server->head;
+            server->head = server->head->next;
+        }
+        if (server->head == NULL) {
+            server->tail = NULL;
+        }
+        int failed = server->failed;
+        mutex_unlock(&server->lock);
+        
+        for (int b = 0; b < count && !failed; b++) {
+            for (int i = 0; i < group[b]->count; i++) {
+                ServerJob* job = &group[b]->jobs[i];
+                int n = split_fields(job->line, fields, BATCH_MAX_FIELDS);
+                int status = authorize_command(fields, n, job->user);
+                if (status == BANK_OK) status = apply_command(fields, n);
+                if (strcmp(fields[0], "LOGIN") == 0) {
+                    job->user = status == BANK_OK ? find_account_by_username(fields[1]) : NULL;
+                }
+                job->status = status;
+            }
+        }
+        
+        // Once the journal cannot be synced nothing is acknowledged: not
+        // this group, whose records may be lost, nor any later one
+        if (!failed && !journal_commit()) {
+            failed = 1;
+        }
+        if (failed) {
+            for (int b = 0; b < count; b++) {
+                for (int i = 0; i < group[b]->count; i++) {
+                    group[b]->jobs[i].status = BANK_NOT_SAVED;
+                }
+            }
+        } else if (journal_records >= JOURNAL_CHECKPOINT_RECORDS) {
+            // Checked without the lock; rechecked once every account is locked
+            lock_all_accounts();
+            checkpoint_if_needed();
+            unlock_all_accounts();
+        }
+        
+        mutex_lock(&server->lock);
+        server->failed |= failed;
+        for (int i = 0; i < count; i++) {
+            group[i]->done = 1;
+            cond_broadcast(group[i]->done_cond);
+        }
+    }
+    mutex_unlock(&server->lock);
+    return 0;
 }
 
-void main_menu() {
-    int choice;
+static THREAD_FUNC server_session(void* arg) {
+    ServerSession* session = arg;
+    Server* server = session->server;
+    char buffer[SESSION_BUFFER_SIZE];
+    char reply[SERVER_GROUP_SIZE * 40];
+    ServerJob jobs[SERVER_GROUP_SIZE];
+    BankAccount* user = NULL;
+    size_t used = 0;
     
-    load_accounts();
+    for (;;) {
+        // Every complete line received so far goes to the workers at once,
+        // except that a LOGIN ends the group: the lines after it run as the
+        // customer it logs in
+        int count = 0;
+        size_t start = 0;
+        char* newline;
+        while (count < SERVER_GROUP_SIZE &&
+               (newline = memchr(buffer + start, '\n', used - start)) != NULL) {
+            size_t length = newline - (buffer + start);
+            if (length >= BATCH_LINE_LEN) length = BATCH_LINE_LEN - 1;
+            memcpy(jobs[count].line, buffer + start, length);
+            jobs[count].line[length] = '\0';
+            jobs[count].user = user;
+            count++;
+            start = newline - buffer + 1;
+            
+            const char* command = jobs[count - 1].line + strspn(jobs[count - 1].line, " \t");
+            if (strncmp(command, "LOGIN", 5) == 0) break;
+        }
+        used -= start;
+        memmove(buffer, buffer + start, used);
+        
+        if (count > 0) {
+            server_execute(server, jobs, count, &session->done);
+            user = jobs[count - 1].user;
+            size_t length = 0;
+            for (int i = 0; i < count; i++) {
+                length += sprintf(reply + length, "%s\n", bank_status_message(jobs[i].status));
+            }
+            if (!send_all(session->fd, reply, length)) break;
+            continue;
+        }
+        if (used == sizeof(buffer)) break;      // no line break in sight
+        
+        int n = recv(session->fd, buffer + used, (int)(sizeof(buffer) - used), 0);
+        if (n <= 0) break;
+        used += n;
+    }
     
-    while (1) {
-        clear_screen();
-        printf("===============================================================\n");
-        printf("=                    SARNATH ADVANCED BANK                    =\n");
-        printf("=                   Professional Banking System               =\n");
-        printf("===============================================================\n");
-        printf("=  [1] Admin Login                                            =\n");
-        printf("=  [2] User Login                                             =\n");
-        printf("=  [3] Create New Account                                     =\n");
-        printf("=  [4] Exit                                                   =\n");
-        printf("===============================================================\n");
-        printf("\nEnter your choice: ");
+    closesocket(session->fd);
+    cond_destroy(&session->done);
+    free(session);
+    
+    mutex_lock(&server->lock);
+    server->sessions--;
+    cond_broadcast(&server->work);
+    mutex_unlock(&server->lock);
+    return 0;
+}
+
+static THREAD_FUNC server_acceptor(void* arg) {
+    Server* server = arg;
+    
+    for (;;) {
+        bank_socket fd = accept(server->listener, NULL, NULL);
         
-        scanf("%d", &choice);
+        mutex_lock(&server->lock);
+        int stopping = server->stopping;
+        if (!stopping && fd != INVALID_SOCKET) {
+            server->sessions++;
+        }
+        mutex_unlock(&server->lock);
         
-        switch (choice) {
-            case 1:
-                admin_panel();
-                break;
-            case 2:
-                user_login();
-                break;
-            case 3:
-                create_account();
-                break;
-            case 4:
-                printf("\nThank you for using Sarnath Bank!\n");
-                save_accounts();
-                exit(0);
-            default:
-                printf("Invalid choice! Please try again.\n");
-                pause_system();
+        if (stopping) {
+            if (fd != INVALID_SOCKET) closesocket(fd);
+            break;
+        }
+        if (fd == INVALID_SOCKET) continue;
+        
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+        
+        ServerSession* session = malloc(sizeof(ServerSession));
+        bank_thread thread;
+        if (session != NULL) {
+            session->server = server;
+            session->fd = fd;
+            cond_init(&session->done);
         }
+        if (session == NULL || !thread_start(&thread, server_session, session)) {
+            closesocket(fd);
+            free(session);
+            mutex_lock(&server->lock);
+            server->sessions--;
+            cond_broadcast(&server->work);
+            mutex_unlock(&server->lock);
+            continue;
+        }
+        thread_detach(thread);
     }
+    return 0;
 }
 
-void admin_panel() {
-    char username[20], password[20];
+// Listens on 127.0.0.1:port (0 picks a free port, stored in server->port)
+// and starts the acceptor and worker_count workers. Accounts must be loaded.
+int server_start(Server* server, int port, int worker_count) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return 0;
+#else
+    // A client that hangs up mid-reply fails that session's send() instead
+    // of killing the process
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    memset(server, 0, sizeof(Server));
+    mutex_init(&server->lock);
+    cond_init(&server->work);
+    server->worker_count = worker_count;
     
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                        ADMIN LOGIN                          =\n");
-    printf("===============================================================\n");
+    server->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listener == INVALID_SOCKET) return 0;
     
-    printf("\nEnter Admin Username: ");
-    scanf("%s", username);
+    int one = 1;
+    setsockopt(server->listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(server->listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(server->listener, SERVER_BACKLOG) != 0 ||
+        getsockname(server->listener, (struct sockaddr*)&addr, &addr_len) != 0) {
+        closesocket(server->listener);
+        return 0;
+    }
+    server->port = ntohs(addr.sin_port);
     
-    printf("Enter Admin Password: ");
-    // Hide password input
-    int i = 0;
-    char ch;
-    while ((ch = getch()) != '\r' && i < 19) {
-        if (ch == '\b' && i > 0) {
-            printf("\b \b");
-            i--;
-        } else if (ch != '\b') {
-            password[i++] = ch;
-            printf("*");
+    // Lazy state must be built before threads share it
+    ledger_ensure_loaded();
+    index_ensure_ready();
+    
+    server->workers = malloc(worker_count * sizeof(bank_thread));
+    if (server->workers == NULL) {
+        closesocket(server->listener);
+        return 0;
+    }
+    for (int i = 0; i < worker_count; i++) {
+        if (!thread_start(&server->workers[i], server_worker, server)) {
+            server->worker_count = i;
+            break;
         }
     }
-    password[i] = '\0';
-    
-    if (strcmp(username, admin.admin_username) == 0 && 
-        strcmp(password, admin.admin_password) == 0) {
-        
-        int choice;
-        while (1) {
-            clear_screen();
-            printf("===============================================================\n");
-            printf("=                      ADMIN DASHBOARD                        =\n");
-            printf("===============================================================\n");
-            printf("\n[1] View All Accounts\n");
-            printf("[2] Block Account\n");
-            printf("[3] Unblock Account\n");
-            printf("[4] View System Statistics\n");
-            printf("[5] Back to Main Menu\n");
-            printf("\nEnter choice: ");
-            
-            scanf("%d", &choice);
-            
-            switch (choice) {
-                case 1:
-                    admin_view_all_accounts();
-                    break;
-                case 2:
-                    admin_block_account();
-                    break;
-                case 3:
-                    admin_unblock_account();
-                    break;
-                case 4:
-                    printf("\nTotal Accounts: %d\n", total_accounts);
-                    double total_balance = 0;
-                    for (int i = 0; i < total_accounts; i++) {
-                        total_balance += accounts[i].balance;
-                    }
-                    printf("Total Bank Balance: %.2f\n", total_balance);
-                    pause_system();
-                    break;
-                case 5:
-                    return;
-                default:
-                    printf("Invalid choice!\n");
-                    pause_system();
-            }
+    if (server->worker_count == 0 || !thread_start(&server->acceptor, server_acceptor, server)) {
+        mutex_lock(&server->lock);
+        server->stopping = 1;
+        cond_broadcast(&server->work);
+        mutex_unlock(&server->lock);
+        for (int i = 0; i < server->worker_count; i++) {
+            thread_join(server->workers[i]);
         }
-    } else {
-        printf("\n\nInvalid admin credentials!\n");
-        pause_system();
+        free(server->workers);
+        closesocket(server->listener);
+        return 0;
     }
+    return 1;
 }
 
-void user_login() {
-    char username[20], password[20];
+// Stops accepting, waits for open sessions to end, then stops the workers
+void server_stop(Server* server) {
+    mutex_lock(&server->lock);
+    server->stopping = 1;
+    cond_broadcast(&server->work);
+    mutex_unlock(&server->lock);
     
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                        USER LOGIN                           =\n");
-    printf("===============================================================\n");
+    // accept() has no portable timeout; wake it with a connection instead
+    bank_socket wake = connect_local(server->port);
+    if (wake != INVALID_SOCKET) closesocket(wake);
+    thread_join(server->acceptor);
+    closesocket(server->listener);
     
-    printf("\nEnter Username: ");
-    scanf("%s", username);
+    for (int i = 0; i < server->worker_count; i++) {
+        thread_join(server->workers[i]);
+    }
+    free(server->workers);
+    cond_destroy(&server->work);
+}
+
+// Runs until the process is killed. Every reply is sent after its journal
+// record is synced, so nothing acknowledged is lost on restart.
+int run_server(int port, int workers) {
+    load_accounts();
     
-    printf("Enter Password: ");
-    // Hide password input
-    int i = 0;
-    char ch;
-    while ((ch = getch()) != '\r' && i < 19) {
-        if (ch == '\b' && i > 0) {
-            printf("\b \b");
-            i--;
-        } else if (ch != '\b') {
-            password[i++] = ch;
-            printf("*");
+    Server server;
+    if (!server_start(&server, port, workers)) {
+        fprintf(stderr, "Error: Unable to listen on port %d!\n", port);
+        return 0;
+    }
+    printf("Listening on 127.0.0.1:%d with %d workers\n", server.port, workers);
+    fflush(stdout);
+    metrics_start_export();
+    thread_join(server.acceptor);
+    return 1;
+}
+
+// Forgets every account and returns the history segments to the pool, so
+// a benchmark can load another bank or the same one again
+static void unload_accounts() {
+    for (int i = 0; i < total_accounts; i++) {
+        TransactionHistory* history = &HISTORY(i);
+        while (history->head != NULL) {
+            LedgerSegment* prev = history->head->prev;
+            history->head->prev = segment_free_list;
+            segment_free_list = history->head;
+            history->head = prev;
+        }
+        history->transaction_count = 0;
+        
+        // A ring counts from the live balance word, which the next load resets
+        free(RING(i));
+        RING(i) = NULL;
+        if (HISTORY_INDEX(i) != NULL) {
+            history_index_free(HISTORY_INDEX(i));
+            HISTORY_INDEX(i) = NULL;
         }
     }
-    password[i] = '\0';
-    
-    BankAccount* account = find_account_by_username(username);
+    total_accounts = 0;
+    audit_log.count = audit_log.persisted = audit_log.indexed = 0;
+    audit_log.next_id = 1;
+    index_ready = 0;
+    search_reset();
+    if (journal_fp != NULL) {
+        fclose(journal_fp);
+        journal_fp = NULL;
+    }
     
-    if (account == NULL) {
-        printf("\n\nAccount not found!\n");
-        pause_system();
-        return;
+    // Mapped chunks go back to zeroed heap memory, as a load into a fresh
+    // process would find them, and the file is closed
+    if (storage_mode == STORAGE_MAPPED) {
+        for (int c = 0; c < account_chunk_count; c++) {
+            if (c >= mapped_base_chunks) unmap_file_region(account_chunks[c]->data, MAP_CHUNK_STRIDE);
+            account_chunks[c]->data = calloc(1, sizeof(AccountChunkData));
+            if (account_chunks[c]->data == NULL) {
+                printf("Error: Out of memory!\n");
+                exit(1);
+            }
+        }
+        if (mapped_base != NULL) unmap_file_region(mapped_base, (size_t)mapped_base_chunks * MAP_CHUNK_STRIDE);
+        mapped_base = NULL;
+        mapped_base_chunks = 0;
+        close(mapped_fd);
+        mapped_fd = -1;
+        storage_mode = STORAGE_SNAPSHOT;
+    }
+}
+
+static void remove_data_files() {
+    const char* files[] = {ACCOUNTS_FILE, ACCOUNTS_FILE ".tmp", JOURNAL_FILE, LEDGER_FILE, LEDGER_FILE ".tmp"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        remove(files[i]);
+    }
+}
+
+// Creates a directory from path, a name ending in XXXXXX, and moves into it,
+// so tests and benchmarks never touch the real data files
+static int enter_scratch_directory(char* path) {
+#ifdef _WIN32
+    return _mktemp_s(path, strlen(path) + 1) == 0 && _mkdir(path) == 0 && _chdir(path) == 0;
+#else
+    return mkdtemp(path) != NULL && chdir(path) == 0;
+#endif
+}
+
+static void leave_scratch_directory(const char* path) {
+    remove_data_files();
+#ifdef _WIN32
+    if (_chdir("..") == 0) _rmdir(path);
+#else
+    if (chdir("..") == 0) rmdir(path);
+#endif
+}
+
+// Load generator: one session logs in as a customer of its own, then makes
+// random deposits to and withdrawals from that account and transfers out of
+// it. Sessions start their operations together, once all have logged in.
+typedef struct {
+    int port;
+    int account;                // the customer the session logs in as
+    unsigned int seed;
+    double* latencies;
+    int completed;
+    int* ready;                 // sessions logged in so far
+    int* go;                    // set once every session is ready
+} LoadClient;
+
+static unsigned int next_random(unsigned int* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Reads one reply line; returns 0 if the connection closed first
+static int receive_line(bank_socket fd, char* reply, int size) {
+    int received = 0;
+    while (received == 0 || reply[received - 1] != '\n') {
+        int n = recv(fd, reply + received, size - received - 1, 0);
+        if (n <= 0) return 0;
+        received += n;
     }
+    reply[received] = '\0';
+    return 1;
+}
+
+static THREAD_FUNC loadgen_client(void* arg) {
+    LoadClient* client = arg;
+    char request[BATCH_LINE_LEN];
+    char reply[BATCH_LINE_LEN];
     
-    if (!account->is_active) {
-        printf("\n\nAccount is blocked! Contact administrator.\n");
-        pause_system();
-        return;
+    bank_socket fd = connect_local(client->port);
+    const char* from = ACCOUNT(client->account).account_number;
+    int logged_in = 0;
+    if (fd != INVALID_SOCKET) {
+        int length = sprintf(request, "LOGIN,%s,%s\n", ACCOUNT(client->account).username, LOADGEN_PASSWORD);
+        logged_in = send_all(fd, request, length) && receive_line(fd, reply, sizeof(reply)) &&
+                    strncmp(reply, "OK\n", 3) == 0;
+    }
+    __atomic_fetch_add(client->ready, 1, __ATOMIC_ACQ_REL);
+    while (!__atomic_load_n(client->go, __ATOMIC_ACQUIRE)) {
+        thread_yield();
     }
     
-    if (strcmp(account->password_hash, hash_password(password)) != 0) {
-        account->failed_attempts++;
-        if (account->failed_attempts >= 3) {
-            account->is_active = 0;
-            printf("\n\nAccount blocked due to multiple failed attempts!\n");
+    for (int i = 0; logged_in && i < LOADGEN_OPS; i++) {
+        unsigned int r = next_random(&client->seed);
+        int target = next_random(&client->seed) % total_accounts;
+        if (target == client->account) target = (target + 1) % total_accounts;
+        const char* to = ACCOUNT(target).account_number;
+        int length;
+        if (r % 4 < 2) {
+            length = sprintf(request, "DEPOSIT,%s,10\n", from);
+        } else if (r % 4 == 2) {
+            length = sprintf(request, "WITHDRAW,%s,5\n", from);
         } else {
-            printf("\n\nInvalid password! Attempts remaining: %d\n", 3 - account->failed_attempts);
+            length = sprintf(request, "TRANSFER,%s,%s,5\n", from, to);
         }
-        save_accounts();
-        pause_system();
-        return;
+        
+        double start = now_seconds();
+        if (!send_all(fd, request, length) || !receive_line(fd, reply, sizeof(reply))) break;
+        client->latencies[client->completed++] = now_seconds() - start;
+    }
+    if (fd != INVALID_SOCKET) closesocket(fd);
+    return 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Runs the same client load against an in-process server with 1, 2, 4, ...
+// up to max_workers workers and reports throughput and latency for each.
+// The server works on LOADGEN_ACCOUNTS accounts opened in a scratch
+// directory, which is removed afterwards, so the real bank is never touched.
+int run_loadgen(int max_workers) {
+    char directory[] = "loadgen-XXXXXX";
+    if (!enter_scratch_directory(directory)) {
+        fprintf(stderr, "Error: Unable to create a scratch directory!\n");
+        return 0;
     }
+    load_accounts();
     
-    account->failed_attempts = 0;
-    current_user = account;
+    // Every account shares one password hash, so the KDF runs once
+    BankAccount profile = {0};
+    strcpy(profile.name, "Loadgen Customer");
+    hash_password(LOADGEN_PASSWORD, profile.password_hash);
+    strcpy(profile.dob, "01/01/1990");
+    int ok = 1;
+    for (int i = 0; i < LOADGEN_ACCOUNTS && ok; i++) {
+        sprintf(profile.username, "loadgen%05d", i);
+        sprintf(profile.mobile, "9%09d", i);
+        sprintf(profile.email, "loadgen%05d@example.com", i);
+        ok = bank_create_account(&profile, ACCOUNT_SAVINGS, BENCH_INITIAL_DEPOSIT, NULL) == BANK_OK;
+    }
+    journal_commit();
     
-    int choice;
-    while (1) {
-        clear_screen();
-        printf("===============================================================\n");
-        printf("=                    WELCOME %s%-20s                          =\n", "", current_user->name);
-        printf("=                      USER DASHBOARD                         =\n");
-        printf("===============================================================\n");
-        printf("\n[1] View Account Details\n");
-        printf("[2] Deposit Money\n");
-        printf("[3] Withdraw Money\n");
-        printf("[4] Transfer Money\n");
-        printf("[5] Transaction History\n");
-        printf("[6] Change Password\n");
-        printf("[7] Logout\n");
-        printf("\nCurrent Balance: %.2f\n", current_user->balance);
-        printf("\nEnter choice: ");
+    LoadClient clients[LOADGEN_CLIENTS];
+    bank_thread threads[LOADGEN_CLIENTS];
+    double* latencies = malloc((size_t)LOADGEN_CLIENTS * LOADGEN_OPS * sizeof(double));
+    if (!ok || latencies == NULL) {
+        fprintf(stderr, "Error: Unable to open the load generator's accounts!\n");
+        free(latencies);
+        unload_accounts();
+        leave_scratch_directory(directory);
+        return 0;
+    }
+    
+    printf("%d sessions x %d operations\n", LOADGEN_CLIENTS, LOADGEN_OPS);
+    printf("%-8s %12s %10s %10s\n", "Workers", "Ops/s", "p50 ms", "p99 ms");
+    
+    for (int workers = 1; ; workers *= 2) {
+        if (workers > max_workers) workers = max_workers;
         
-        scanf("%d", &choice);
+        Server server;
+        if (!server_start(&server, 0, workers)) {
+            fprintf(stderr, "Error: Unable to start server!\n");
+            ok = 0;
+            break;
+        }
         
-        switch (choice) {
-            case 1:
-                view_account_details();
-                break;
-            case 2:
-                deposit_money();
-                break;
-            case 3:
-                withdraw_money();
-                break;
-            case 4:
-                transfer_money();
-                break;
-            case 5:
-                view_transaction_history();
-                break;
-            case 6:
-                change_password();
-                break;
-            case 7:
-                current_user = NULL;
-                return;
-            default:
-                printf("Invalid choice!\n");
-                pause_system();
+        int started = 0;
+        int ready = 0, go = 0;
+        for (int i = 0; i < LOADGEN_CLIENTS; i++) {
+            clients[i].port = server.port;
+            clients[i].account = i * (LOADGEN_ACCOUNTS / LOADGEN_CLIENTS);
+            clients[i].seed = 2463534242u + i * 7919u;
+            clients[i].latencies = latencies + (size_t)i * LOADGEN_OPS;
+            clients[i].completed = 0;
+            clients[i].ready = &ready;
+            clients[i].go = &go;
+            if (thread_start(&threads[started], loadgen_client, &clients[i])) {
+                started++;
+            }
+        }
+        while (__atomic_load_n(&ready, __ATOMIC_ACQUIRE) < started) {
+            thread_yield();
+        }
+        double start = now_seconds();
+        __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+        for (int i = 0; i < started; i++) {
+            thread_join(threads[i]);
+        }
+        double elapsed = now_seconds() - start;
+        server_stop(&server);
+        
+        // Pack the samples of all sessions together before sorting
+        int total = 0;
+        for (int i = 0; i < LOADGEN_CLIENTS; i++) {
+            memmove(latencies + total, clients[i].latencies, clients[i].completed * sizeof(double));
+            total += clients[i].completed;
+        }
+        if (total == 0) {
+            fprintf(stderr, "Error: No operations completed!\n");
+            ok = 0;
+            break;
+        }
+        qsort(latencies, total, sizeof(double), compare_doubles);
+        printf("%-8d %12.0f %10.3f %10.3f\n", workers, total / elapsed,
+               latencies[total / 2] * 1000, latencies[(int)(total * 0.99)] * 1000);
+        fflush(stdout);
+        
+        if (workers == max_workers) break;
+    }
+    
+    free(latencies);
+    unload_accounts();
+    leave_scratch_directory(directory);
+    return ok;
+}
+
+static const char* search_bench_first[] = {
+    "Aarav", "Aditi", "Amit", "Ananya", "Arjun", "Deepa", "Divya", "Farhan", "Gaurav", "Isha",
+    "Jaya", "John", "Kabir", "Kavya", "Lakshmi", "Manoj", "Meera", "Neha", "Nikhil", "Pooja",
+    "Priya", "Rahul", "Rajesh", "Ravi", "Rohan", "Sanjay", "Sara", "Sneha", "Suresh", "Tanvi",
+    "Varun", "Vikram"
+};
+static const char* search_bench_last[] = {
+    "Agarwal", "Bansal", "Bhat", "Chopra", "Das", "Desai", "Gupta", "Iyer", "Joshi", "Kapoor",
+    "Khan", "Kulkarni", "Kumar", "Mehta", "Menon", "Mishra", "Nair", "Pandey", "Patel", "Pillai",
+    "Rao", "Reddy", "Saxena", "Shah", "Sharma", "Singh", "Smith", "Srinivasan", "Thomas", "Varma",
+    "Verma", "Yadav"
+};
+static const char* search_bench_domains[] = {"gmail.com", "yahoo.co.in", "outlook.com", "sarnath.in"};
+#define SEARCH_BENCH_NAMES(list) ((int)(sizeof(list) / sizeof(list[0])))
+
+// Creates accounts in memory with generated names, emails and mobiles, for
+// the benchmarks, each opened with the given balance. The journal is turned
+// off, so no file is touched.
+static int bench_customers(int accounts, Money balance, unsigned int* seed) {
+    journal_enabled = 0;
+    ledger_loaded = 1;
+    
+    BankAccount profile = {0};
+    strcpy(profile.dob, "01/01/1990");
+    strcpy(profile.created_date, "01/01/2026 09:00");
+    for (int i = 0; i < accounts; i++) {
+        const char* first = search_bench_first[next_random(seed) % SEARCH_BENCH_NAMES(search_bench_first)];
+        const char* last = search_bench_last[next_random(seed) % SEARCH_BENCH_NAMES(search_bench_last)];
+        sprintf(profile.account_number, "SAR%010d", i);
+        sprintf(profile.name, "%s %s", first, last);
+        sprintf(profile.username, "%.8s%07d", first, i);
+        sprintf(profile.email, "%s.%s%d@%s", first, last, (int)(next_random(seed) % 1000),
+                search_bench_domains[next_random(seed) % SEARCH_BENCH_NAMES(search_bench_domains)]);
+        for (char* c = profile.email; *c; c++) *c = tolower((unsigned char)*c);
+        sprintf(profile.mobile, "%d%09u", 6 + (int)(next_random(seed) % 4), next_random(seed) % 1000000000u);
+        if (append_account(&profile, (i % 3) | ACCOUNT_ACTIVE, balance) == NULL) {
+            printf("Error: Cannot allocate %d accounts!\n", accounts);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Contention benchmark: threads deposit into CONTENTION_ACCOUNTS hot
+// accounts (merchants receiving payments), once with the stripe lock held
+// around each deposit and once through the lock-free path, on accounts
+// created in memory.
+typedef struct {
+    int locked;
+    unsigned int seed;
+} ContentionWorker;
+
+static THREAD_FUNC contention_worker(void* arg) {
+    ContentionWorker* worker = arg;
+    for (int i = 0; i < CONTENTION_OPS; i++) {
+        BankAccount* account = &ACCOUNT(next_random(&worker->seed) % CONTENTION_ACCOUNTS);
+        if (worker->locked) {
+            change_locked(account, "DEPOSIT", MINOR_UNITS, "Payment");
+        } else {
+            bank_deposit(account, MINOR_UNITS, "Payment");
         }
     }
+    return 0;
 }
 
-void create_account() {
-    if (total_accounts >= MAX_ACCOUNTS) {
-        printf("Sorry, maximum account limit reached!\n");
-        pause_system();
-        return;
+int run_contention(int max_threads) {
+    unsigned int seed = 2463534242u;
+    if (!bench_customers(CONTENTION_ACCOUNTS, 0, &seed)) return 0;
+    
+    bank_thread* threads = malloc(max_threads * sizeof(bank_thread));
+    ContentionWorker* workers = malloc(max_threads * sizeof(ContentionWorker));
+    if (threads == NULL || workers == NULL) {
+        free(threads);
+        free(workers);
+        return 0;
     }
     
-    BankAccount new_account = {0};
-    char confirm_password[20];
+    printf("%d hot accounts, %d deposits per thread\n", CONTENTION_ACCOUNTS, CONTENTION_OPS);
+    printf("%-8s %16s %16s\n", "Threads", "Locked ops/s", "Lock-free ops/s");
     
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                    CREATE NEW ACCOUNT                       =\n");
-    printf("===============================================================\n");
+    Money expected = 0;
+    for (int count = 1; ; count *= 2) {
+        if (count > max_threads) count = max_threads;
+        
+        double rate[2];
+        for (int locked = 1; locked >= 0; locked--) {
+            int started = 0;
+            double start = now_seconds();
+            for (int i = 0; i < count; i++) {
+                workers[i].locked = locked;
+                workers[i].seed = 2463534242u + i * 7919u;
+                if (thread_start(&threads[started], contention_worker, &workers[i])) {
+                    started++;
+                }
+            }
+            for (int i = 0; i < started; i++) {
+                thread_join(threads[i]);
+            }
+            rate[locked] = (double)started * CONTENTION_OPS / (now_seconds() - start);
+            expected += (long long)started * CONTENTION_OPS;
+        }
+        printf("%-8d %16.0f %16.0f\n", count, rate[1], rate[0]);
+        fflush(stdout);
+        
+        if (count == max_threads) break;
+    }
     
-    // Generate account number
-    generate_account_number(new_account.account_number);
+    // Every deposit must be in both the balances and the histories
+    Money live = 0, recorded = 0;
+    long long transactions = 0;
+    for (int i = 0; i < CONTENTION_ACCOUNTS; i++) {
+        live += LIVE_BALANCE(LIVE(i));
+        recorded += BALANCE(i);
+        transactions += HISTORY(i).transaction_count;
+    }
+    expected *= MINOR_UNITS;
+    printf("Balances %s, histories %s\n",
+           live == expected && recorded == expected ? "consistent" : "INCONSISTENT",
+           transactions * MINOR_UNITS == expected ? "complete" : "INCOMPLETE");
     
-    printf("\nEnter Full Name: ");
-    scanf(" %[^\n]", new_account.name);
+    free(threads);
+    free(workers);
+    return live == expected && recorded == expected;
+}
+
+// Times the statistics report over synthetic balance and flags columns of the
+// given size: the old sum-only loop, the scalar kernel and, where the CPU
+// has it, the AVX2 kernel. Nothing is loaded or written.
+int run_stats_bench(int accounts) {
+    Money* balances = malloc((size_t)accounts * sizeof(Money));
+    unsigned char* flags = malloc(accounts);
+    if (balances == NULL || flags == NULL) {
+        printf("Error: Cannot allocate %d accounts!\n", accounts);
+        free(balances);
+        free(flags);
+        return 0;
+    }
     
-    // Validate name
-    for (int i = 0; new_account.name[i]; i++) {
-        if (!isalpha(new_account.name[i]) && new_account.name[i] != ' ') {
-            printf("Invalid name! Only letters and spaces allowed.\n");
-            pause_system();
-            return;
-        }
+    // Balances spread over every histogram bucket, one account in ten blocked
+    unsigned int seed = 2463534242u;
+    for (int i = 0; i < accounts; i++) {
+        Money magnitude = stats_bucket_floor[1 + next_random(&seed) % (STATS_BUCKETS - 1)];
+        balances[i] = (Money)(next_random(&seed) % (unsigned int)(magnitude / MINOR_UNITS)) * MINOR_UNITS;
+        flags[i] = next_random(&seed) % 3 | (next_random(&seed) % 10 ? ACCOUNT_ACTIVE : 0);
     }
     
-    printf("Enter Username (8-15 characters): ");
-    scanf("%s", new_account.username);
+    Money minimum[STATS_TYPES];
+    stats_minimums(minimum);
     
-    if (strlen(new_account.username) < 8 || strlen(new_account.username) > 15) {
-        printf("Username must be 8-15 characters!\n");
-        pause_system();
-        return;
+    struct {
+        const char* name;
+        StatsKernel kernel;
+    } kernels[] = {
+        {"scalar", stats_kernel_scalar},
+#ifdef STATS_AVX2
+        {"avx2", __builtin_cpu_supports("avx2") ? stats_kernel_avx2 : NULL},
+#endif
+    };
+    int kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+    
+    printf("%d accounts, best of %d passes\n", accounts, STATS_BENCH_ROUNDS);
+    printf("%-12s %12s %14s\n", "Pass", "ms", "accounts/s");
+    
+    // Baseline: the total the statistics menu used to compute
+    double best = 0;
+    volatile Money total = 0;
+    for (int round = 0; round < STATS_BENCH_ROUNDS; round++) {
+        double start = now_seconds();
+        Money sum = 0;
+        for (int i = 0; i < accounts; i++) {
+            sum += balances[i];
+        }
+        total = sum;
+        double elapsed = now_seconds() - start;
+        if (round == 0 || elapsed < best) best = elapsed;
     }
+    printf("%-12s %12.2f %14.0f\n", "sum only", best * 1000, accounts / best);
     
-    if (find_account_by_username(new_account.username) != NULL) {
-        printf("Username already exists!\n");
-        pause_system();
-        return;
+    BankStats reference;
+    int consistent = 1;
+    for (int k = 0; k < kernel_count; k++) {
+        if (kernels[k].kernel == NULL) continue;
+        
+        BankStats stats;
+        for (int round = 0; round < STATS_BENCH_ROUNDS; round++) {
+            memset(&stats, 0, sizeof(stats));
+            double start = now_seconds();
+            kernels[k].kernel(balances, flags, accounts, minimum, &stats);
+            double elapsed = now_seconds() - start;
+            if (round == 0 || elapsed < best) best = elapsed;
+        }
+        printf("%-12s %12.2f %14.0f\n", kernels[k].name, best * 1000, accounts / best);
+        
+        if (k == 0) {
+            reference = stats;
+        } else if (memcmp(&stats, &reference, sizeof(stats)) != 0) {
+            consistent = 0;
+        }
     }
     
-    printf("Enter Email: ");
-    scanf("%s", new_account.email);
+    Money sum = 0;
+    for (int t = 0; t < STATS_TYPES; t++) {
+        sum += reference.type_balance[t];
+    }
+    if (sum != total) consistent = 0;
+    printf("Reports %s\n", consistent ? "match" : "DIFFER");
     
-    if (!validate_email(new_account.email)) {
-        printf("Invalid email format!\n");
-        pause_system();
-        return;
+    free(balances);
+    free(flags);
+    return consistent;
+}
+
+// Logins per second over accounts created in memory, with 1, 2, 4 ...
+// max_threads threads: first with the session-token cache emptied before
+// every login, so each one runs the KDF, then answered from the cache.
+typedef struct {
+    int cached;
+    int logins;
+    int failures;
+    unsigned int seed;
+} LoginWorker;
+
+static THREAD_FUNC login_worker(void* arg) {
+    LoginWorker* worker = arg;
+    for (int i = 0; i < worker->logins; i++) {
+        int id = next_random(&worker->seed) % LOGIN_BENCH_ACCOUNTS;
+        if (!worker->cached) {
+            lock_account(&ACCOUNT(id));
+            auth_cache[id & (AUTH_CACHE_SIZE - 1)].account = -1;
+            unlock_account(&ACCOUNT(id));
+        }
+        if (bank_login(&ACCOUNT(id), "Passw0rd!") != BANK_OK) worker->failures++;
+    }
+    return 0;
+}
+
+int run_login_bench(int max_threads) {
+    unsigned int seed = 2463534242u;
+    if (!bench_customers(LOGIN_BENCH_ACCOUNTS, 0, &seed)) return 0;
+    char hash[50];
+    hash_password("Passw0rd!", hash);
+    for (int i = 0; i < LOGIN_BENCH_ACCOUNTS; i++) {
+        strcpy(ACCOUNT(i).password_hash, hash);
     }
     
-    printf("Enter Mobile Number (10 digits): ");
-    scanf("%s", new_account.mobile);
+    bank_thread* threads = malloc(max_threads * sizeof(bank_thread));
+    LoginWorker* workers = malloc(max_threads * sizeof(LoginWorker));
+    if (threads == NULL || workers == NULL) {
+        free(threads);
+        free(workers);
+        return 0;
+    }
     
-    if (!validate_mobile(new_account.mobile)) {
-        printf("Invalid mobile number!\n");
-        pause_system();
-        return;
+    printf("PBKDF2-HMAC-SHA256, %ld iterations per login\n", 1L << PASSWORD_KDF_COST);
+    printf("%-8s %14s %18s %16s\n", "Threads", "KDF logins/s", "per thread", "Cached logins/s");
+    
+    int failures = 0;
+    for (int count = 1; ; count *= 2) {
+        if (count > max_threads) count = max_threads;
+        
+        double rate[2];
+        for (int cached = 0; cached <= 1; cached++) {
+            if (cached) {
+                for (int i = 0; i < LOGIN_BENCH_ACCOUNTS; i++) {
+                    bank_login(&ACCOUNT(i), "Passw0rd!");
+                }
+            }
+            int started = 0;
+            double start = now_seconds();
+            for (int i = 0; i < count; i++) {
+                workers[i].cached = cached;
+                workers[i].logins = cached ? LOGIN_BENCH_CACHED_LOGINS : LOGIN_BENCH_KDF_LOGINS;
+                workers[i].failures = 0;
+                workers[i].seed = 2463534242u + i * 7919u;
+                if (thread_start(&threads[started], login_worker, &workers[i])) {
+                    started++;
+                }
+            }
+            for (int i = 0; i < started; i++) {
+                thread_join(threads[i]);
+                failures += workers[i].failures;
+            }
+            rate[cached] = (double)started * workers[0].logins / (now_seconds() - start);
+        }
+        printf("%-8d %14.1f %18.1f %16.0f\n", count, rate[0], rate[0] / count, rate[1]);
+        fflush(stdout);
+        
+        if (count == max_threads) break;
+    }
+    if (failures > 0) {
+        printf("%d logins FAILED\n", failures);
     }
     
-    printf("Enter Date of Birth (DD/MM/YYYY): ");
-    scanf("%s", new_account.dob);
+    free(threads);
+    free(workers);
+    return failures == 0;
+}
+
+// Latency of audit queries through the indexes against a full scan of the
+// log, over transactions generated in memory: deposits, withdrawals and
+// transfers spread over a year, amounts over several orders of magnitude.
+typedef struct {
+    const char* name;
+    Money min_amount;
+    Money max_amount;
+    long long from;
+    long long to;
+    const char* reference;
+    int type;
+} AuditBenchQuery;
+
+static int audit_scan(const AuditBenchQuery* query) {
+    int found = 0;
+    for (int i = 0; i < audit_log.count; i++) {
+        found += audit_matches(&audit_log.entries[i], query->min_amount, query->max_amount,
+                               query->from, query->to, query->reference, query->type);
+    }
+    return found;
+}
+
+int run_audit_bench(int transactions) {
+    unsigned int seed = 2463534242u;
+    if (!bench_customers(AUDIT_BENCH_ACCOUNTS, 0, &seed)) return 0;
     
-    printf("Enter Password: ");
-    char password[20];
-    int i = 0;
-    char ch;
-    while ((ch = getch()) != '\r' && i < 19) {
-        if (ch == '\b' && i > 0) {
-            printf("\b \b");
-            i--;
-        } else if (ch != '\b') {
-            password[i++] = ch;
-            printf("*");
+    double start = now_seconds();
+    long long base = 1700000000;
+    int legs = 0;
+    while (legs < transactions) {
+        int account = next_random(&seed) % AUDIT_BENCH_ACCOUNTS;
+        int kind = next_random(&seed) % 3;
+        Money magnitude = 10;
+        for (int m = next_random(&seed) % 5; m > 0; m--) magnitude *= 10;
+        Money amount = (1 + next_random(&seed) % magnitude) * MINOR_UNITS;
+        unsigned int timestamp = (unsigned int)(base + (long long)legs * AUDIT_BENCH_SPAN / transactions);
+        
+        int other = -1;             // credited account of a transfer
+        if (kind == 2) {
+            other = (account + 1 + (int)(next_random(&seed) % (AUDIT_BENCH_ACCOUNTS - 1))) % AUDIT_BENCH_ACCOUNTS;
+        }
+        unsigned long long id = 0;
+        for (int leg = 0; leg < (other >= 0 ? 2 : 1); leg++) {
+            int owner = leg == 0 ? account : other;
+            Transaction* trans = ledger_append(&HISTORY(owner));
+            if (trans == NULL) {
+                printf("Error: Out of memory after %d transactions!\n", legs);
+                return 0;
+            }
+            trans->timestamp = timestamp;
+            trans->amount = amount;
+            strcpy(trans->type, other < 0 ? (kind ? "WITHDRAW" : "DEPOSIT") : (leg ? "TRANSFER_IN" : "TRANSFER_OUT"));
+            strcpy(trans->reference_account, other < 0 ? "N/A" : ACCOUNT(leg ? account : other).account_number);
+            id = audit_append(owner, trans, id);
+            legs++;
         }
     }
-    password[i] = '\0';
+    printf("%d transaction legs in %d accounts, generated in %.2f s\n", legs, AUDIT_BENCH_ACCOUNTS,
+           now_seconds() - start);
     
-    printf("\nConfirm Password: ");
-    i = 0;
-    while ((ch = getch()) != '\r' && i < 19) {
-        if (ch == '\b' && i > 0) {
-            printf("\b \b");
-            i--;
-        } else if (ch != '\b') {
-            confirm_password[i++] = ch;
-            printf("*");
+    // The first query merges the whole log into the indexes
+    start = now_seconds();
+    audit_query(0, 0, 0, 0, NULL, -1, NULL, 0);
+    printf("Indexes built in %.2f s\n\n", now_seconds() - start);
+    
+    long long day = 24 * 60 * 60;
+    AuditBenchQuery queries[] = {
+        {"amount >= 99000", 99000 * MINOR_UNITS, MAX_AMOUNT, 0, 0xFFFFFFFFLL, NULL, -1},
+        {"one day", 0, MAX_AMOUNT, base + 100 * day, base + 101 * day - 1, NULL, -1},
+        {"one counterparty", 0, MAX_AMOUNT, 0, 0xFFFFFFFFLL, ACCOUNT(12345).account_number, -1},
+        {"large, one week", 50000 * MINOR_UNITS, MAX_AMOUNT, base + 200 * day, base + 207 * day - 1, NULL, -1},
+        {"deposits, one day", 0, MAX_AMOUNT, base + 100 * day, base + 101 * day - 1, NULL, HISTORY_DEPOSIT},
+    };
+    int query_count = sizeof(queries) / sizeof(queries[0]);
+    
+    printf("%-18s %10s %12s %12s %10s\n", "Query", "Matches", "Index ms", "Scan ms", "Speedup");
+    int consistent = 1;
+    for (int q = 0; q < query_count; q++) {
+        AuditBenchQuery* query = &queries[q];
+        double indexed = 0, scanned = 0;
+        int matches = 0, scan_matches = 0;
+        for (int round = 0; round < AUDIT_BENCH_ROUNDS; round++) {
+            start = now_seconds();
+            matches = audit_query(query->min_amount, query->max_amount, query->from, query->to, query->reference,
+                                  query->type, NULL, 0);
+            double elapsed = now_seconds() - start;
+            if (round == 0 || elapsed < indexed) indexed = elapsed;
+            
+            start = now_seconds();
+            scan_matches = audit_scan(query);
+            elapsed = now_seconds() - start;
+            if (round == 0 || elapsed < scanned) scanned = elapsed;
+        }
+        if (matches != scan_matches) consistent = 0;
+        printf("%-18s %10d %12.3f %12.3f %9.0fx\n", query->name, matches, indexed * 1000, scanned * 1000,
+               scanned / (indexed > 0 ? indexed : 1e-9));
+    }
+    printf("Results %s\n", consistent ? "match" : "DIFFER");
+    return consistent;
+}
+
+// Fault injection: a workload of transfers with checkpoints is killed at its
+// first write point, then its second, and so on until it runs to completion.
+// After each crash a fresh process recovers the files and checks that money
+// was neither created nor destroyed, that every account's balance matches
+// its history, that both legs of every transfer survived or neither did,
+// and that every transfer acknowledged before the crash is still there.
+// Each run works in a scratch directory of its own.
+#ifndef _WIN32
+static int crash_test_setup() {
+    load_accounts();
+    BankAccount profile = {0};
+    for (int i = 0; i < CRASH_TEST_ACCOUNTS; i++) {
+        sprintf(profile.account_number, "SAR%010d", i);
+        sprintf(profile.username, "crashuser%d", i);
+        BankAccount* account = append_account(&profile, ACCOUNT_SAVINGS | ACCOUNT_ACTIVE, 1000 * MINOR_UNITS);
+        if (account == NULL) return 0;
+        add_transaction(account, "DEPOSIT", 1000 * MINOR_UNITS, "Initial Deposit", NULL, 0);
+        journal_log_create(account);
+    }
+    return journal_commit() && checkpoint();
+}
+
+// Reports the number of transfers acknowledged so far on fd after each one
+static int crash_test_workload(int fd) {
+    load_accounts();
+    unsigned int seed = 2463534242u;
+    int acknowledged = 0;
+    for (int i = 0; i < CRASH_TEST_TRANSFERS; i++) {
+        BankAccount* from = &ACCOUNT(next_random(&seed) % CRASH_TEST_ACCOUNTS);
+        BankAccount* to = &ACCOUNT(next_random(&seed) % CRASH_TEST_ACCOUNTS);
+        Money amount = (1 + next_random(&seed) % 800) * MINOR_UNITS;
+        if (bank_transfer(from, to, amount) == BANK_OK) {
+            if (!journal_commit()) return 0;
+            acknowledged++;
+            if (write(fd, &acknowledged, sizeof(acknowledged)) != sizeof(acknowledged)) return 0;
         }
+        if ((i + 1) % CRASH_TEST_CHECKPOINT == 0 && !checkpoint()) return 0;
     }
-    confirm_password[i] = '\0';
+    return checkpoint();
+}
+
+static int crash_test_verify(int acknowledged) {
+    load_accounts();
+    ledger_ensure_loaded();
     
-    if (strcmp(password, confirm_password) != 0) {
-        printf("\n\nPasswords don't match!\n");
-        pause_system();
-        return;
+    Money total = 0;
+    int ok = total_accounts == CRASH_TEST_ACCOUNTS;
+    for (int i = 0; i < total_accounts; i++) {
+        Transaction* last = ledger_last(&HISTORY(i));
+        total += BALANCE(i);
+        if (last == NULL || last->balance_after != BALANCE(i)) {
+            printf("  account %d: balance does not match its history\n", i);
+            ok = 0;
+        }
+    }
+    if (total != CRASH_TEST_ACCOUNTS * 1000 * MINOR_UNITS) {
+        printf("  total balance is %lld paise\n", total);
+        ok = 0;
     }
     
-    printf("\n\nSelect Account Type:\n");
-    printf("[1] Savings (Min Balance: 500)\n");
-    printf("[2] Current (Min Balance: 1000)\n");
-    printf("[3] Premium (Min Balance: 5000)\n");
-    printf("Choice: ");
+    // The legs of a transfer are consecutive in the log and share an id
+    int transfers = 0;
+    for (int i = 0; i < audit_log.count; i++) {
+        AuditEntry* leg = &audit_log.entries[i];
+        if (strcmp(leg->entry->type, "TRANSFER_OUT") != 0) continue;
+        AuditEntry* credit = i + 1 < audit_log.count ? &audit_log.entries[i + 1] : NULL;
+        if (credit == NULL || credit->id != leg->id || strcmp(credit->entry->type, "TRANSFER_IN") != 0 ||
+            credit->entry->amount != leg->entry->amount) {
+            printf("  transfer %llu: credit leg missing\n", leg->id);
+            ok = 0;
+        }
+        transfers++;
+    }
+    if (transfers < acknowledged) {
+        printf("  %d transfers acknowledged, %d recovered\n", acknowledged, transfers);
+        ok = 0;
+    }
+    return ok;
+}
+
+// Runs one stage in a child process with the given write point armed and
+// returns its exit status, or -1 if it did not exit
+static int crash_test_run(int stage, int point, int argument, int* acknowledged) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        fault_countdown = point;
+        int ok = stage == 0 ? crash_test_setup() :
+                 stage == 1 ? crash_test_workload(fds[1]) : crash_test_verify(argument);
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
     
-    int acc_type;
-    scanf("%d", &acc_type);
+    close(fds[1]);
+    int value;
+    while (read(fds[0], &value, sizeof(value)) == sizeof(value)) {
+        if (acknowledged != NULL) *acknowledged = value;
+    }
+    close(fds[0]);
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+#endif
+
+int run_crash_test() {
+#ifdef _WIN32
+    printf("Error: --crash-test needs fork() and is not available on Windows!\n");
+    return 0;
+#else
+    char directory[] = "crash-test-XXXXXX";
+    if (!enter_scratch_directory(directory)) {
+        printf("Error: Unable to create a scratch directory!\n");
+        return 0;
+    }
+    printf("%s storage, %d transfers among %d accounts, checkpoint every %d\n",
+           use_mapped_storage ? "Mapped" : "Snapshot", CRASH_TEST_TRANSFERS, CRASH_TEST_ACCOUNTS,
+           CRASH_TEST_CHECKPOINT);
     
-    double min_deposit;
-    switch (acc_type) {
-        case 1:
-            strcpy(new_account.account_type, "SAVINGS");
-            min_deposit = 500;
-            break;
-        case 2:
-            strcpy(new_account.account_type, "CURRENT");
-            min_deposit = 1000;
-            break;
-        case 3:
-            strcpy(new_account.account_type, "PREMIUM");
-            min_deposit = 5000;
+    int failures = 0, point;
+    for (point = 1;; point++) {
+        remove_data_files();
+        if (crash_test_run(0, 0, 0, NULL) != 0) {
+            printf("Error: Unable to set up the test accounts!\n");
+            failures++;
             break;
-        default:
-            printf("Invalid choice!\n");
-            pause_system();
-            return;
+        }
+        int acknowledged = 0;
+        int status = crash_test_run(1, point, 0, &acknowledged);
+        if (status != 0 && status != CRASH_TEST_EXIT) {
+            printf("Write point %d: workload failed (status %d)\n", point, status);
+            failures++;
+        }
+        if (crash_test_run(2, 0, acknowledged, NULL) != 0) {
+            printf("Write point %d: recovery broke an invariant (%d transfers acknowledged)\n",
+                   point, acknowledged);
+            failures++;
+        }
+        if (status != CRASH_TEST_EXIT) break;   // ran to completion: every point covered
     }
     
-    printf("\nEnter initial deposit (Min: %.0f): ", min_deposit);
-    scanf("%lf", &new_account.balance);
-    
-    if (new_account.balance < min_deposit) {
-        printf("Insufficient initial deposit!\n");
-        pause_system();
-        return;
+    leave_scratch_directory(directory);
+    printf("%d write points, %d failures\n", point - 1, failures);
+    return failures == 0;
+#endif
+}
+
+// Size of a file in bytes, -1 if it cannot be opened
+static long long file_size(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return -1;
+    fseek(fp, 0, SEEK_END);
+    long long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+// Rewrites accounts.dat from whatever earlier layout it is in, and ledger.dat
+// with it, in one go rather than at the first checkpoint
+int run_convert() {
+    long long before = file_size(ACCOUNTS_FILE);
+    if (before < 0) {
+        printf("Error: %s not found!\n", ACCOUNTS_FILE);
+        return 0;
     }
+    load_accounts();
+    if (storage_mode == STORAGE_MAPPED) {
+        printf("%s is in the mapped layout, which is kept as it is\n", ACCOUNTS_FILE);
+        return 1;
+    }
+    ledger_ensure_loaded();
+    if (!checkpoint()) return 0;
+    printf("Converted %d accounts: %s %lld -> %lld bytes, %s %lld bytes\n", total_accounts, ACCOUNTS_FILE,
+           before, file_size(ACCOUNTS_FILE), LEDGER_FILE, file_size(LEDGER_FILE));
+    return 1;
+}
+
+// The original layout: a count, then a full memory image of every account
+// with its transaction slots and amounts as doubles
+static int write_legacy_accounts(const char* path) {
+    static LegacyBankAccount legacy;
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return 0;
+    fwrite(&total_accounts, sizeof(int), 1, fp);
+    for (int i = 0; i < total_accounts; i++) {
+        BankAccount* account = &ACCOUNT(i);
+        memset(&legacy, 0, sizeof(legacy));
+        strcpy(legacy.account_number, account->account_number);
+        strcpy(legacy.name, account->name);
+        strcpy(legacy.username, account->username);
+        strcpy(legacy.password_hash, account->password_hash);
+        strcpy(legacy.dob, account->dob);
+        strcpy(legacy.mobile, account->mobile);
+        strcpy(legacy.email, account->email);
+        strcpy(legacy.created_date, account->created_date);
+        strcpy(legacy.account_type, account_type_name(account_type(account)));
+        legacy.balance = (double)BALANCE(i) / MINOR_UNITS;
+        legacy.is_active = account_is_active(account);
+        legacy.failed_attempts = account->failed_attempts;
+        
+        Transaction* first = ledger_last(&HISTORY(i));
+        if (first != NULL) {
+            double amount = (double)first->amount / MINOR_UNITS;
+            double balance_after = (double)first->balance_after / MINOR_UNITS;
+            legacy.transactions[0] = *first;
+            memcpy(&legacy.transactions[0].amount, &amount, sizeof(double));
+            memcpy(&legacy.transactions[0].balance_after, &balance_after, sizeof(double));
+            legacy.transaction_count = 1;
+        }
+        fwrite(&legacy, sizeof(legacy), 1, fp);
+    }
+    return fclose(fp) == 0;
+}
+
+// Version 3: memory images of the header and of each column
+static int write_fixed_snapshot(const char* path) {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return 0;
+    SnapshotHeader header = {SNAPSHOT_MAGIC, 3, total_accounts, eod_business_date, 0};
+    fwrite(&header, sizeof(header), 1, fp);
+    for (int c = 0; c * ACCOUNT_CHUNK_SIZE < total_accounts; c++) {
+        fwrite(account_chunks[c]->data->profiles, sizeof(BankAccount), chunk_length(c), fp);
+    }
+    for (int c = 0; c * ACCOUNT_CHUNK_SIZE < total_accounts; c++) {
+        fwrite(account_chunks[c]->data->balances, sizeof(Money), chunk_length(c), fp);
+    }
+    for (int c = 0; c * ACCOUNT_CHUNK_SIZE < total_accounts; c++) {
+        fwrite(account_chunks[c]->data->flags, sizeof(unsigned char), chunk_length(c), fp);
+    }
+    return fclose(fp) == 0;
+}
+
+static int write_compact_snapshot(const char* path) {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return 0;
+    int ok = save_compact_snapshot(fp);
+    return fclose(fp) == 0 && ok;
+}
+
+// File size and load time of accounts.dat in the legacy layout, the fixed
+// column layout (version 3), the compact one and the mapped one, for
+// accounts generated in memory with one transaction each. Only the legacy
+// layout embeds the history; the others keep it in ledger.dat, which is
+// loaded on first use. After the loads, FORMAT_BENCH_DEPOSITS deposits to
+// random accounts are journaled and saved by one checkpoint, and the bytes
+// that checkpoint writes to accounts.dat are shared out among the deposits.
+// Every layout but the mapped one saves as a compact snapshot.
+int run_format_bench(int accounts) {
+    char directory[] = "format-bench-XXXXXX";
+    if (!enter_scratch_directory(directory)) {
+        printf("Error: Unable to create a scratch directory!\n");
+        return 0;
+    }
+    journal_enabled = 0;
+    ledger_loaded = 1;
     
-    // Set account details
-    strcpy(new_account.password_hash, hash_password(password));
-    new_account.is_active = 1;
-    new_account.failed_attempts = 0;
-    new_account.transaction_count = 0;
-    get_current_date(new_account.created_date);
-    
-    // Add initial deposit transaction
-    add_transaction(&new_account, "DEPOSIT", new_account.balance, "Initial Deposit", NULL);
+    unsigned int seed = 2463534242u;
+    Money total = 0;
+    BankAccount profile = {0};
+    for (int i = 0; i < accounts; i++) {
+        sprintf(profile.account_number, "SAR%010d", i);
+        sprintf(profile.name, "Customer %d", i);
+        sprintf(profile.username, "customer%07d", i);
+        sprintf(profile.password_hash, "$p$%d$%08x%08x$%08x%08x%08x", PASSWORD_KDF_COST, next_random(&seed),
+                next_random(&seed), next_random(&seed), next_random(&seed), next_random(&seed));
+        sprintf(profile.dob, "%02d/%02d/19%02d", 1 + i % 28, 1 + i % 12, 40 + i % 60);
+        sprintf(profile.mobile, "9%09d", i);
+        sprintf(profile.email, "customer%07d@example.com", i);
+        strcpy(profile.created_date, "18/10/2026 10:00");
+        Money balance = (Money)(MIN_BALANCE + next_random(&seed) % 1000000) * MINOR_UNITS;
+        BankAccount* account = append_account(&profile, i % 3 | ACCOUNT_ACTIVE, balance);
+        if (account == NULL) {
+            printf("Error: Cannot allocate %d accounts!\n", accounts);
+            leave_scratch_directory(directory);
+            return 0;
+        }
+        add_transaction(account, "DEPOSIT", balance, "Initial Deposit", NULL, 0);
+        total += balance;
+    }
     
-    // Save account
-    accounts[total_accounts] = new_account;
-    total_accounts++;
+    struct {
+        const char* name;
+        int (*write)(const char* path);
+    } formats[] = {
+        {"legacy", write_legacy_accounts},
+        {"fixed (v3)", write_fixed_snapshot},
+        {"compact (v4)", write_compact_snapshot},
+        {"mapped", write_mapped_accounts},
+    };
+    int format_count = sizeof(formats) / sizeof(formats[0]);
+    static MetricShard before, after;
     
-    save_accounts();
+    printf("%d accounts, best of %d loads, %d deposits per checkpoint\n", accounts, FORMAT_BENCH_ROUNDS,
+           FORMAT_BENCH_DEPOSITS);
+    printf("%-14s %14s %14s %12s %14s\n", "Format", "File bytes", "Bytes/account", "Load ms", "Bytes/deposit");
+    int consistent = 1;
+    for (int f = 0; f < format_count; f++) {
+        if (!formats[f].write(ACCOUNTS_FILE)) {
+            printf("Error: Unable to write the %s layout!\n", formats[f].name);
+            consistent = 0;
+            break;
+        }
+        long long size = file_size(ACCOUNTS_FILE);
+        
+        double best = 0;
+        for (int round = 0; round < FORMAT_BENCH_ROUNDS; round++) {
+            unload_accounts();
+            double start = now_seconds();
+            load_accounts();
+            double elapsed = now_seconds() - start;
+            if (round == 0 || elapsed < best) best = elapsed;
+        }
+        
+        Money loaded = 0;
+        for (int i = 0; i < total_accounts; i++) {
+            loaded += BALANCE(i);
+        }
+        if (total_accounts != accounts || loaded != total) consistent = 0;
+        
+        // Only journaled changes mark mapped pages dirty
+        journal_enabled = 1;
+        seed = 2463534242u;
+        for (int i = 0; i < FORMAT_BENCH_DEPOSITS; i++) {
+            int id = next_random(&seed) % accounts;
+            if (bank_deposit(&ACCOUNT(id), MINOR_UNITS, "Deposit") == BANK_OK) total += MINOR_UNITS;
+        }
+        metrics_collect(&before);
+        if (!checkpoint()) consistent = 0;
+        metrics_collect(&after);
+        journal_enabled = 0;
+        unsigned long long written = after.counters[COUNTER_SNAPSHOT_BYTES] - before.counters[COUNTER_SNAPSHOT_BYTES];
+        
+        printf("%-14s %14lld %14.1f %12.2f %14.0f\n", formats[f].name, size, (double)size / accounts, best * 1000,
+               (double)written / FORMAT_BENCH_DEPOSITS);
+    }
+    printf("Each deposit also appends a %d-byte journal record in every layout\n", (int)sizeof(JournalRecord));
+    printf("Loads %s\n", consistent ? "match" : "DIFFER");
     
-    printf("\n===============================================================\n");
-    printf("=                  ACCOUNT CREATED SUCCESSFULLY!              =\n");
-    printf("===============================================================\n");
-    printf("\nAccount Number: %s\n", new_account.account_number);
-    printf("Account Type: %s\n", new_account.account_type);
-    printf("Initial Balance: %.2f\n", new_account.balance);
-    printf("\nPlease save your account number and login credentials securely!\n");
+    unload_accounts();
+    leave_scratch_directory(directory);
+    return consistent;
+}
+
+// Throughput, latency and bytes written of each core operation, driven
+// through the calls the menus, the batch mode and the server make.
+// Populations of BENCH_MIN_ACCOUNTS, ten times that and so on up to
+// max_accounts are opened with bank_create_account(), saved with
+// checkpoint() and loaded back; then each takes BENCH_OPS operations of
+// every kind, first on accounts picked uniformly and then with
+// BENCH_HOT_SHARE percent of them on the hottest BENCH_HOT_PERCENT percent.
+// The journal is on and committed every BENCH_COMMIT_GROUP operations, and
+// the operation closing a group is charged with the commit. Bytes are those
+// appended to the journal, or written to accounts.dat and ledger.dat by a
+// save. Runs in a scratch directory.
+enum {
+    BENCH_LOOKUP,
+    BENCH_DEPOSIT,
+    BENCH_WITHDRAW,
+    BENCH_TRANSFER,
+    BENCH_HISTORY,
+    BENCH_KINDS
+};
+
+static const char* const bench_names[BENCH_KINDS] = {"lookup", "deposit", "withdraw", "transfer", "history"};
+
+static int bench_pick(unsigned int* seed, int accounts, int skewed) {
+    int hot = accounts / 100 * BENCH_HOT_PERCENT;
+    if (skewed && next_random(seed) % 100 < BENCH_HOT_SHARE) {
+        return next_random(seed) % (hot > 0 ? hot : 1);
+    }
+    return next_random(seed) % accounts;
+}
+
+// Runs one operation of the given kind and keeps total, the money the
+// bank should hold, up to date
+static int bench_operation(int kind, unsigned int* seed, int accounts, int skewed, Money* total) {
+    static Transaction page[HISTORY_PAGE_SIZE];
+    int id = bench_pick(seed, accounts, skewed);   // ACCOUNT() evaluates its argument twice
+    BankAccount* account = &ACCOUNT(id);
+    Money amount = (Money)(1 + next_random(seed) % 100) * MINOR_UNITS;
+    int status;
     
-    pause_system();
+    switch (kind) {
+        case BENCH_LOOKUP:
+            return find_account_by_number(account->account_number) == account ? BANK_OK : BANK_ACCOUNT_NOT_FOUND;
+        case BENCH_DEPOSIT:
+            status = bank_deposit(account, amount, "Bench Deposit");
+            if (status == BANK_OK) *total += amount;
+            return status;
+        case BENCH_WITHDRAW:
+            status = bank_withdraw(account, amount, "Bench Withdrawal");
+            if (status == BANK_OK) *total -= amount;
+            return status;
+        case BENCH_TRANSFER: {
+            int to;
+            do {
+                to = bench_pick(seed, accounts, skewed);
+            } while (to == id && accounts > 1);
+            return bank_transfer(account, &ACCOUNT(to), amount);
+        }
+        default:
+            return bank_history(account, 0, page, HISTORY_PAGE_SIZE) > 0 ? BANK_OK : BANK_ACCOUNT_NOT_FOUND;
+    }
 }
 
-void deposit_money() {
-    double amount;
+static void bench_report(const char* name, double* latencies, int count, double elapsed, long long bytes) {
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    printf("%-20s %12.0f %10.1f %10.1f %10.1f %10.0f\n", name, count / elapsed, latencies[count / 2] * 1e6,
+           latencies[(int)(count * 0.99)] * 1e6, latencies[(int)(count * 0.999)] * 1e6, (double)bytes / count);
+    fflush(stdout);
+}
+
+static Money bench_balance_total() {
+    Money total = 0;
+    for (int i = 0; i < total_accounts; i++) {
+        total += BALANCE(i);
+    }
+    return total;
+}
+
+// One population: returns 0 if it could not be built or its money does not
+// add up
+static int bench_population(int accounts, double* latencies, const char* password_hash) {
+    unsigned int seed = 2463534242u;
+    unload_accounts();
+    remove_data_files();
+    load_accounts();
     
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                        DEPOSIT MONEY                        =\n");
-    printf("===============================================================\n");
+    printf("\n%d accounts (latencies in microseconds)\n", accounts);
+    printf("%-20s %12s %10s %10s %10s %10s\n", "Operation", "Ops/s", "p50", "p99", "p99.9", "Bytes/op");
     
-    printf("\nCurrent Balance: %.2f\n", current_user->balance);
-    printf("Enter amount to deposit: ");
-    scanf("%lf", &amount);
+    // Every account shares one password hash, so the KDF is not measured
+    BankAccount profile = {0};
+    strcpy(profile.name, "Bench Customer");
+    strcpy(profile.password_hash, password_hash);
+    strcpy(profile.dob, "01/01/1990");
+    Money total = 0;
+    unsigned long long lsn = journal_lsn;
+    double start = now_seconds();
+    for (int i = 0; i < accounts; i++) {
+        sprintf(profile.username, "bench%08d", i);
+        sprintf(profile.mobile, "9%09d", i);
+        sprintf(profile.email, "bench%08d@example.com", i);
+        double op_start = now_seconds();
+        int status = bank_create_account(&profile, i % 3, BENCH_INITIAL_DEPOSIT, NULL);
+        if ((i + 1) % BENCH_COMMIT_GROUP == 0) journal_commit();
+        latencies[i] = now_seconds() - op_start;
+        if (status != BANK_OK) {
+            printf("Error: %s after %d accounts!\n", bank_status_message(status), i);
+            return 0;
+        }
+        total += BENCH_INITIAL_DEPOSIT;
+    }
+    journal_commit();
+    bench_report("create", latencies, accounts, now_seconds() - start,
+                 (long long)(journal_lsn - lsn) * sizeof(JournalRecord));
     
-    if (!validate_amount(amount)) {
-        printf("Invalid amount!\n");
-        pause_system();
-        return;
+    start = now_seconds();
+    int saved = checkpoint();
+    latencies[0] = now_seconds() - start;
+    if (!saved) {
+        printf("Error: Unable to save %d accounts!\n", accounts);
+        return 0;
     }
+    bench_report("save", latencies, 1, latencies[0], file_size(ACCOUNTS_FILE) + file_size(LEDGER_FILE));
     
-    current_user->balance += amount;
-    add_transaction(current_user, "DEPOSIT", amount, "Cash Deposit", NULL);
-    save_accounts();
+    unload_accounts();
+    start = now_seconds();
+    load_accounts();
+    ledger_ensure_loaded();
+    latencies[0] = now_seconds() - start;
+    bench_report("load", latencies, 1, latencies[0], 0);
+    int consistent = total_accounts == accounts && bench_balance_total() == total;
     
-    printf("\n✓ Deposit successful!\n");
-    printf("Amount Deposited: %.2f\n", amount);
-    printf("New Balance: %.2f\n", current_user->balance);
+    int refused = 0;
+    for (int skewed = 0; skewed <= 1; skewed++) {
+        for (int kind = 0; kind < BENCH_KINDS; kind++) {
+            lsn = journal_lsn;
+            start = now_seconds();
+            for (int i = 0; i < BENCH_OPS; i++) {
+                double op_start = now_seconds();
+                int status = bench_operation(kind, &seed, accounts, skewed, &total);
+                if ((i + 1) % BENCH_COMMIT_GROUP == 0) journal_commit();
+                latencies[i] = now_seconds() - op_start;
+                if (status != BANK_OK) refused++;
+            }
+            journal_commit();
+            
+            char name[32];
+            sprintf(name, "%s (%s)", bench_names[kind], skewed ? "hot" : "uniform");
+            bench_report(name, latencies, BENCH_OPS, now_seconds() - start,
+                         (long long)(journal_lsn - lsn) * sizeof(JournalRecord));
+        }
+        checkpoint();
+    }
+    if (refused > 0) {
+        printf("%d operations refused\n", refused);
+    }
     
-    pause_system();
+    // What was saved must load back with the same money
+    consistent = consistent && bench_balance_total() == total;
+    unload_accounts();
+    load_accounts();
+    consistent = consistent && total_accounts == accounts && bench_balance_total() == total;
+    printf("Balances %s\n", consistent ? "match" : "DIFFER");
+    return consistent;
 }
 
-void withdraw_money() {
-    double amount;
-    
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                       WITHDRAW MONEY                        =\n");
-    printf("===============================================================\n");
+int run_bench(int max_accounts) {
+    char directory[] = "bench-XXXXXX";
+    if (!enter_scratch_directory(directory)) {
+        printf("Error: Unable to create a scratch directory!\n");
+        return 0;
+    }
+    double* latencies = malloc((size_t)(max_accounts > BENCH_OPS ? max_accounts : BENCH_OPS) * sizeof(double));
+    if (latencies == NULL) {
+        printf("Error: Cannot allocate %d samples!\n", max_accounts);
+        leave_scratch_directory(directory);
+        return 0;
+    }
+    char password_hash[50];
+    hash_password("Bench1234!", password_hash);
     
-    printf("\nCurrent Balance: %.2f\n", current_user->balance);
-    printf("Enter amount to withdraw: ");
-    scanf("%lf", &amount);
+    printf("%d operations of each kind, journal committed every %d, hot accounts: %d%% of them take %d%%\n",
+           BENCH_OPS, BENCH_COMMIT_GROUP, BENCH_HOT_PERCENT, BENCH_HOT_SHARE);
+    int consistent = 1;
+    long long accounts = max_accounts < BENCH_MIN_ACCOUNTS ? max_accounts : BENCH_MIN_ACCOUNTS;
+    for (;;) {
+        if (!bench_population((int)accounts, latencies, password_hash)) {
+            consistent = 0;
+            break;
+        }
+        if (accounts == max_accounts) break;
+        accounts = accounts * 10 < max_accounts ? accounts * 10 : max_accounts;
+    }
     
-    if (!validate_amount(amount)) {
-        printf("Invalid amount!\n");
-        pause_system();
-        return;
+    free(latencies);
+    unload_accounts();
+    leave_scratch_directory(directory);
+    return consistent;
+}
+
+// Opens the given number of accounts in a scratch directory, the first half
+// one at a time with bank_create_account() and the rest in batches of
+// CREATE_BENCH_BATCH with bank_create_accounts(), committing the journal
+// after every BENCH_COMMIT_GROUP accounts or batch. The bank is then saved,
+// loaded back and checked: every number must be unique with a valid check
+// digit, and the next account must continue the sequence.
+int run_create_bench(int accounts) {
+    char directory[] = "create-bench-XXXXXX";
+    if (!enter_scratch_directory(directory)) {
+        printf("Error: Unable to create a scratch directory!\n");
+        return 0;
+    }
+    BankAccount* profiles = calloc(CREATE_BENCH_BATCH, sizeof(BankAccount));
+    int* types = malloc(CREATE_BENCH_BATCH * sizeof(int));
+    Money* deposits = malloc(CREATE_BENCH_BATCH * sizeof(Money));
+    int* statuses = malloc(CREATE_BENCH_BATCH * sizeof(int));
+    if (profiles == NULL || types == NULL || deposits == NULL || statuses == NULL) {
+        printf("Error: Out of memory!\n");
+        free(profiles);
+        free(types);
+        free(deposits);
+        free(statuses);
+        leave_scratch_directory(directory);
+        return 0;
     }
+    load_accounts();
     
-    double min_balance = 500;
-    if (strcmp(current_user->account_type, "CURRENT") == 0) min_balance = 1000;
-    if (strcmp(current_user->account_type, "PREMIUM") == 0) min_balance = 5000;
+    char password_hash[50];
+    hash_password("Bench1234!", password_hash);
+    int single = accounts / 2;
+    int refused = 0;
     
-    if (current_user->balance - amount < min_balance) {
-        printf("Insufficient balance! Minimum balance required: %.0f\n", min_balance);
-        pause_system();
-        return;
+    printf("%d accounts\n", accounts);
+    printf("%-28s %12s\n", "Calls", "Accounts/s");
+    double start = now_seconds();
+    for (int i = 0; i < single; i++) {
+        BankAccount profile = {0};
+        strcpy(profile.name, "Bench Customer");
+        strcpy(profile.password_hash, password_hash);
+        strcpy(profile.dob, "01/01/1990");
+        sprintf(profile.username, "create%08d", i);
+        sprintf(profile.mobile, "9%09d", i);
+        sprintf(profile.email, "create%08d@example.com", i);
+        if (bank_create_account(&profile, i % 3, BENCH_INITIAL_DEPOSIT, NULL) != BANK_OK) refused++;
+        if ((i + 1) % BENCH_COMMIT_GROUP == 0) journal_commit();
     }
+    journal_commit();
+    double seconds = now_seconds() - start;
+    printf("%-28s %12.0f\n", "bank_create_account()", single / seconds);
     
-    current_user->balance -= amount;
-    add_transaction(current_user, "WITHDRAW", amount, "Cash Withdrawal", NULL);
-    save_accounts();
+    start = now_seconds();
+    for (int first = single; first < accounts; first += CREATE_BENCH_BATCH) {
+        int count = accounts - first < CREATE_BENCH_BATCH ? accounts - first : CREATE_BENCH_BATCH;
+        for (int k = 0; k < count; k++) {
+            BankAccount* profile = &profiles[k];
+            strcpy(profile->name, "Bench Customer");
+            strcpy(profile->password_hash, password_hash);
+            strcpy(profile->dob, "01/01/1990");
+            sprintf(profile->username, "create%08d", first + k);
+            sprintf(profile->mobile, "9%09d", first + k);
+            sprintf(profile->email, "create%08d@example.com", first + k);
+            types[k] = (first + k) % 3;
+            deposits[k] = BENCH_INITIAL_DEPOSIT;
+        }
+        refused += count - bank_create_accounts(profiles, types, deposits, count, statuses, NULL);
+        journal_commit();
+    }
+    seconds = now_seconds() - start;
+    char name[32];
+    sprintf(name, "bank_create_accounts(%d)", CREATE_BENCH_BATCH);
+    printf("%-28s %12.0f\n", name, (accounts - single) / seconds);
     
-    printf("\n✓ Withdrawal successful!\n");
-    printf("Amount Withdrawn: %.2f\n", amount);
-    printf("New Balance: %.2f\n", current_user->balance);
+    int ok = refused == 0 && checkpoint();
+    unload_accounts();
+    load_accounts();
+    int sequence = -1;
+    int checked = total_accounts == accounts;
+    for (int id = 0; id < total_accounts && checked; id++) {
+        // A number given out twice would be found at its first account only
+        BankAccount* account = &ACCOUNT(id);
+        int next = account_sequence_of(account->account_number);
+        checked = next > sequence && find_account_by_number(account->account_number) == account;
+        sequence = next;
+    }
+    BankAccount* account = NULL;
+    BankAccount profile = profiles[0];
+    strcpy(profile.username, "createlast");
+    ok = ok && bank_create_account(&profile, ACCOUNT_SAVINGS, BENCH_INITIAL_DEPOSIT, &account) == BANK_OK;
+    checked = checked && ok && account_sequence_of(account->account_number) == sequence + 1;
+    if (refused > 0) printf("%d accounts refused\n", refused);
+    printf("Account numbers %s\n", checked ? "unique and in sequence" : "DIFFER");
     
-    pause_system();
+    free(profiles);
+    free(types);
+    free(deposits);
+    free(statuses);
+    unload_accounts();
+    leave_scratch_directory(directory);
+    return ok && checked;
 }
 
-void transfer_money() {
-    char target_account[15];
-    double amount;
+// --scale-test: accounts opened so far, and what the lookup thread saw
+typedef struct {
+    int opened;                 // accounts 0 .. opened-1 can be looked up
+    int done;
+    long long lookups;
+    long long misses;           // lookups that found no account or the wrong one
+} ScaleLookups;
+
+static THREAD_FUNC scale_lookup_worker(void* arg) {
+    ScaleLookups* shared = arg;
+    unsigned int seed = 2463534242u;
+    while (!__atomic_load_n(&shared->done, __ATOMIC_ACQUIRE)) {
+        int opened = __atomic_load_n(&shared->opened, __ATOMIC_ACQUIRE);
+        if (opened == 0) {
+            thread_yield();
+            continue;
+        }
+        int id = next_random(&seed) % opened;
+        BankAccount* account = &ACCOUNT(id);
+        if (find_account_by_number(account->account_number) != account) shared->misses++;
+        shared->lookups++;
+    }
+    return 0;
+}
+
+// Opens the given number of accounts one at a time in a scratch directory,
+// with the journal off so only the store and its indexes are measured, while
+// another thread looks up accounts already opened. Reports the create
+// latency and the peak resident memory the accounts added, then checks that
+// the first account never moved and every lookup found its account.
+int run_scale_test(int accounts) {
+    char directory[] = "scale-test-XXXXXX";
+    if (!enter_scratch_directory(directory)) {
+        printf("Error: Unable to create a scratch directory!\n");
+        return 0;
+    }
+    double* latencies = malloc(accounts * sizeof(double));
+    if (latencies == NULL) {
+        printf("Error: Out of memory!\n");
+        leave_scratch_directory(directory);
+        return 0;
+    }
+    // Touched now so the latencies are not counted as account memory
+    memset(latencies, 0, accounts * sizeof(double));
+    load_accounts();
+    journal_enabled = 0;
     
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                       TRANSFER MONEY                        =\n");
-    printf("===============================================================\n");
+    char password_hash[50];
+    hash_password("Bench1234!", password_hash);
+    BankAccount profile = {0};
+    strcpy(profile.name, "Scale Customer");
+    strcpy(profile.password_hash, password_hash);
+    strcpy(profile.dob, "01/01/1990");
     
-    printf("\nCurrent Balance: %.2f\n", current_user->balance);
-    printf("Enter target account number: ");
-    scanf("%s", target_account);
+    ScaleLookups shared = {0, 0, 0, 0};
+    bank_thread lookup_thread;
+    int looking = thread_start(&lookup_thread, scale_lookup_worker, &shared);
+    long rss_before = peak_rss_kb();
+    BankAccount* first = NULL;
+    int refused = 0;
     
-    BankAccount* target = find_account_by_number(target_account);
-    if (target == NULL) {
-        printf("Target account not found!\n");
-        pause_system();
-        return;
+    printf("%d accounts (latencies in microseconds, memory is peak RSS)\n", accounts);
+    printf("%-12s %12s %10s %10s %10s %12s\n", "Accounts", "Creates/s", "p50", "p99", "p99.9", "RSS MB");
+    int step = accounts / SCALE_TEST_REPORT > 0 ? accounts / SCALE_TEST_REPORT : 1;
+    double start = now_seconds();
+    double step_start = start;
+    for (int i = 0; i < accounts; i++) {
+        sprintf(profile.username, "scale%09d", i);
+        sprintf(profile.mobile, "9%09d", i);
+        sprintf(profile.email, "scale%09d@example.com", i);
+        BankAccount* account = NULL;
+        double begin = now_seconds();
+        if (bank_create_account(&profile, i % 3, BENCH_INITIAL_DEPOSIT, &account) != BANK_OK) {
+            refused++;
+            break;
+        }
+        latencies[i] = now_seconds() - begin;
+        if (first == NULL) first = account;
+        __atomic_store_n(&shared.opened, i + 1, __ATOMIC_RELEASE);
+        
+        if ((i + 1) % step == 0 || i + 1 == accounts) {
+            int from = i + 1 - ((i + 1) % step == 0 ? step : (i + 1) % step);
+            int count = i + 1 - from;
+            double now = now_seconds();
+            qsort(latencies + from, count, sizeof(double), compare_doubles);
+            long rss = peak_rss_kb();
+            char rss_text[24] = "n/a";
+            if (rss >= 0) snprintf(rss_text, sizeof(rss_text), "%.1f", rss / 1024.0);
+            printf("%-12d %12.0f %10.1f %10.1f %10.1f %12s\n", i + 1, count / (now - step_start),
+                   latencies[from + count / 2] * 1e6, latencies[from + (int)(count * 0.99)] * 1e6,
+                   latencies[from + (int)(count * 0.999)] * 1e6, rss_text);
+            fflush(stdout);
+            step_start = now_seconds();
+        }
     }
+    double seconds = now_seconds() - start;
+    __atomic_store_n(&shared.done, 1, __ATOMIC_RELEASE);
+    if (looking) thread_join(lookup_thread);
+    long rss_after = peak_rss_kb();
     
-    if (!target->is_active) {
-        printf("Target account is blocked!\n");
-        pause_system();
-        return;
+    int opened = total_accounts;
+    qsort(latencies, opened, sizeof(double), compare_doubles);
+    if (opened > 0) {
+        printf("%-12s %12.0f %10.1f %10.1f %10.1f\n", "All", opened / seconds, latencies[opened / 2] * 1e6,
+               latencies[(int)(opened * 0.99)] * 1e6, latencies[(int)(opened * 0.999)] * 1e6);
     }
-    
-    if (strcmp(target->account_number, current_user->account_number) == 0) {
-        printf("Cannot transfer to same account!\n");
-        pause_system();
-        return;
+    if (rss_before >= 0 && rss_after >= 0 && opened > 0) {
+        printf("Peak RSS %.1f MB before, %.1f MB after: %.0f bytes per account (profile %d bytes)\n",
+               rss_before / 1024.0, rss_after / 1024.0, (rss_after - rss_before) * 1024.0 / opened,
+               (int)sizeof(BankAccount));
+    } else {
+        printf("Peak RSS not available on this platform\n");
     }
+    int stable = opened > 0 && first == &ACCOUNT(0);
+    printf("%lld lookups during creation, %lld missed\n", shared.lookups, shared.misses);
+    printf("First account %s\n", stable ? "did not move" : "MOVED");
+    if (refused > 0) printf("Account %d refused\n", opened);
     
-    printf("Target Account Holder: %s\n", target->name);
-    printf("Enter amount to transfer: ");
-    scanf("%lf", &amount);
+    free(latencies);
+    unload_accounts();
+    journal_enabled = 1;
+    leave_scratch_directory(directory);
+    return refused == 0 && stable && shared.misses == 0;
+}
+
+// Cost of the instrumentation on the transfer path: random transfers among
+// accounts created in memory, in slices of METRICS_BENCH_SLICE with the
+// metrics switched off and on in turn, so drift in the machine's speed hits
+// both settings alike. The journal is off, so the in-memory work the
+// metrics are compared with is all there is. As the end-to-end difference
+// is within the noise of a shared machine, the cost of the instrumentation
+// itself is also timed on its own.
+int run_metrics_bench(int transfers) {
+    unsigned int seed = 2463534242u;
+    if (!bench_customers(METRICS_BENCH_ACCOUNTS, BENCH_INITIAL_DEPOSIT, &seed)) return 0;
     
-    if (!validate_amount(amount)) {
-        printf("Invalid amount!\n");
-        pause_system();
-        return;
+    int pairs = (transfers + METRICS_BENCH_SLICE - 1) / METRICS_BENCH_SLICE;
+    double elapsed[2] = {0, 0};
+    for (int slice = 0; slice < 2 * pairs; slice++) {
+        int enabled = (slice + slice / 2) % 2;      // off, on, on, off, off, on ...
+        metrics_enabled = enabled;
+        double start = now_seconds();
+        for (int i = 0; i < METRICS_BENCH_SLICE; i++) {
+            int from = next_random(&seed) % METRICS_BENCH_ACCOUNTS;
+            int to = (from + 1 + next_random(&seed) % (METRICS_BENCH_ACCOUNTS - 1)) % METRICS_BENCH_ACCOUNTS;
+            bank_transfer(&ACCOUNT(from), &ACCOUNT(to), (Money)(1 + next_random(&seed) % 100) * MINOR_UNITS);
+        }
+        elapsed[enabled] += now_seconds() - start;
     }
+    metrics_enabled = 1;
     
-    double min_balance = 500;
-    if (strcmp(current_user->account_type, "CURRENT") == 0) min_balance = 1000;
-    if (strcmp(current_user->account_type, "PREMIUM") == 0) min_balance = 5000;
+    static MetricShard counted;
+    metrics_collect(&counted);
+    long long done = (long long)pairs * METRICS_BENCH_SLICE;
     
-    if (current_user->balance - amount < min_balance) {
-        printf("Insufficient balance! Minimum balance required: %.0f\n", min_balance);
-        pause_system();
-        return;
+    // What metric_start() and metric_finish() add to each call, sampling
+    // included, without the transfer around them
+    double start = now_seconds();
+    for (long long i = 0; i < done; i++) {
+        metric_finish(METRIC_HISTORY, metric_start(METRIC_HISTORY), BANK_OK);
     }
+    double instrumentation = (now_seconds() - start) / done;
+    double transfer = elapsed[0] / done;
     
-    // Process transfer
-    current_user->balance -= amount;
-    target->balance += amount;
-    
-    char desc[100];
-    sprintf(desc, "Transfer to %s", target->name);
-    add_transaction(current_user, "TRANSFER_OUT", amount, desc, target->account_number);
-    
-    sprintf(desc, "Transfer from %s", current_user->name);
-    add_transaction(target, "TRANSFER_IN", amount, desc, current_user->account_number);
-    
-    save_accounts();
-    
-    printf("\n✓ Transfer successful!\n");
-    printf("Amount Transferred: %.2f\n", amount);
-    printf("To: %s (%s)\n", target->name, target->account_number);
-    printf("Your New Balance: %.2f\n", current_user->balance);
+    printf("%lld transfers with metrics off and on, among %d accounts\n", done, METRICS_BENCH_ACCOUNTS);
+    printf("%-12s %12s %12s\n", "Metrics", "ns/transfer", "transfers/s");
+    printf("%-12s %12.1f %12.0f\n", "off", transfer * 1e9, 1 / transfer);
+    printf("%-12s %12.1f %12.0f\n", "on", elapsed[1] * 1e9 / done, done / elapsed[1]);
+    printf("End to end: %+.1f%%; instrumentation alone: %.1f ns a call, %.1f%% of a transfer\n",
+           (elapsed[1] / elapsed[0] - 1) * 100, instrumentation * 1e9, instrumentation / transfer * 100);
+    printf("Transfers recorded: %llu\n", counted.calls[METRIC_TRANSFER]);
     
-    pause_system();
+    Money sum = 0;
+    for (int i = 0; i < METRICS_BENCH_ACCOUNTS; i++) {
+        sum += BALANCE(i);
+    }
+    int consistent = sum == METRICS_BENCH_ACCOUNTS * BENCH_INITIAL_DEPOSIT &&
+                     counted.calls[METRIC_TRANSFER] == (unsigned long long)done;
+    printf("Balances and counts %s\n", consistent ? "match" : "DIFFER");
+    return consistent;
 }
 
-void view_account_details() {
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                     ACCOUNT DETAILS                         =\n");
-    printf("===============================================================\n");
-    
-    printf("\nAccount Number    : %s\n", current_user->account_number);
-    printf("Account Holder    : %s\n", current_user->name);
-    printf("Account Type      : %s\n", current_user->account_type);
-    printf("Username          : %s\n", current_user->username);
-    printf("Email             : %s\n", current_user->email);
-    printf("Mobile            : %s\n", current_user->mobile);
-    printf("Date of Birth     : %s\n", current_user->dob);
-    printf("Account Created   : %s\n", current_user->created_date);
-    printf("Current Balance   : %.2f\n", current_user->balance);
-    printf("Account Status    : %s\n", current_user->is_active ? "ACTIVE" : "BLOCKED");
-    printf("Total Transactions: %d\n", current_user->transaction_count);
-    
-    pause_system();
+// Matches of a query found by checking every account, as the index must
+static int search_scan(const char* query, int fuzzy) {
+    unsigned char symbols[SEARCH_MAX_QUERY + 2];
+    int length = search_query(query, symbols);
+    if (length == 0) return 0;
+    fuzzy = fuzzy && length >= SEARCH_FUZZY_MIN;
+    int found = 0;
+    for (int id = 0; id < total_accounts; id++) {
+        found += search_matches(id, symbols, length, fuzzy);
+    }
+    return found;
 }
 
-void view_transaction_history() {
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                   TRANSACTION HISTORY                       =\n");
-    printf("===============================================================\n");
-    
-    if (current_user->transaction_count == 0) {
-        printf("\nNo transactions found!\n");
-        pause_system();
-        return;
-    }
-    
-    printf("\n%-20s %-15s %-12s %-12s %-20s\n", "Date", "Type", "Amount", "Balance", "Description");
-    printf("================================================================================\n");
-    
-    for (int i = current_user->transaction_count - 1; i >= 0; i--) {
-        Transaction* trans = &current_user->transactions[i];
-        printf("%-20s %-15s %-10.2f %-10.2f %-20s\n",
-               trans->date, trans->type, trans->amount, 
-               trans->balance_after, trans->description);
+// A query of the given kind about a random account
+static void search_bench_query(int kind, unsigned int* seed, char* query) {
+    int id = next_random(seed) % total_accounts;
+    BankAccount* account = &ACCOUNT(id);
+    char* space = strchr(account->name, ' ');
+    switch (kind) {
+        case 0:                     // first two letters of the first name
+            sprintf(query, "%.2s", account->name);
+            break;
+        case 1:                     // surname
+            strcpy(query, space + 1);
+            break;
+        case 2:                     // full name
+            strcpy(query, account->name);
+            break;
+        case 3:                     // part of the email before the domain
+            sprintf(query, "%.*s", (int)(strchr(account->email, '@') - account->email), account->email);
+            break;
+        case 4:                     // five digits from the middle of the mobile
+            sprintf(query, "%.5s", account->mobile + 3);
+            break;
+        default: {                  // full name with one letter changed
+            strcpy(query, account->name);
+            int position = next_random(seed) % strlen(query);
+            query[position] = query[position] == 'x' ? 'y' : 'x';
+            break;
+        }
     }
-    
-    pause_system();
 }
 
-void change_password() {
-    char old_password[20], new_password[20], confirm_password[20];
+// Times first-page customer searches of several kinds over the given number
+// of accounts created in memory, and checks a few of each against a full
+// scan.
+int run_search_bench(int accounts) {
+    static const char* kinds[] = {"2-letter prefix", "surname", "full name", "email", "mobile digits",
+                                  "name with typo"};
+    unsigned int seed = 2463534242u;
+    if (!bench_customers(accounts, BENCH_INITIAL_DEPOSIT, &seed)) return 0;
     
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                      CHANGE PASSWORD                        =\n");
-    printf("===============================================================\n");
+    // The first search builds the index
+    int results[SEARCH_PAGE_SIZE + 1];
+    double start = now_seconds();
+    bank_search("build", 0, 0, results, 0);
+    printf("%d accounts, index built in %.2f s, %.1f MB\n\n", accounts, now_seconds() - start,
+           search_bytes / 1e6);
     
-    printf("\nEnter current password: ");
-    int i = 0;
-    char ch;
-    while ((ch = getch()) != '\r' && i < 19) {
-        if (ch == '\b' && i > 0) {
-            printf("\b \b");
-            i--;
-        } else if (ch != '\b') {
-            old_password[i++] = ch;
-            printf("*");
-        }
+    int* all = malloc((size_t)accounts * sizeof(int));
+    double* times = malloc(SEARCH_BENCH_QUERIES * sizeof(double));
+    if (all == NULL || times == NULL) {
+        free(all);
+        free(times);
+        printf("Error: Out of memory!\n");
+        return 0;
     }
-    old_password[i] = '\0';
     
-    if (strcmp(current_user->password_hash, hash_password(old_password)) != 0) {
-        printf("\n\nIncorrect current password!\n");
-        pause_system();
-        return;
+    printf("%-16s %12s %12s %12s %14s\n", "Query", "Mean ms", "p99 ms", "Max ms", "Mean matches");
+    int consistent = 1;
+    for (int kind = 0; kind < 6; kind++) {
+        int fuzzy = kind == 5;
+        long long matches = 0;
+        for (int q = 0; q < SEARCH_BENCH_QUERIES; q++) {
+            char query[MAX_NAME_LEN];
+            search_bench_query(kind, &seed, query);
+            start = now_seconds();
+            bank_search(query, fuzzy, 0, results, SEARCH_PAGE_SIZE + 1);
+            times[q] = now_seconds() - start;
+            
+            int count = bank_search(query, fuzzy, 0, all, accounts);
+            matches += count;
+            if (q < SEARCH_BENCH_CHECKS && count != search_scan(query, fuzzy)) {
+                printf("Mismatch for \"%s\"\n", query);
+                consistent = 0;
+            }
+        }
+        qsort(times, SEARCH_BENCH_QUERIES, sizeof(double), compare_doubles);
+        double total = 0;
+        for (int q = 0; q < SEARCH_BENCH_QUERIES; q++) {
+            total += times[q];
+        }
+        printf("%-16s %12.4f %12.4f %12.4f %14.0f\n", kinds[kind], total / SEARCH_BENCH_QUERIES * 1000,
+               times[SEARCH_BENCH_QUERIES * 99 / 100] * 1000, times[SEARCH_BENCH_QUERIES - 1] * 1000,
+               (double)matches / SEARCH_BENCH_QUERIES);
     }
+    free(all);
+    free(times);
     
-    printf("\nEnter new password: ");
-    i = 0;
-    while ((ch = getch()) != '\r' && i < 19) {
-        if (ch == '\b' && i > 0) {
-            printf("\b \b");
-            i--;
-        } else if (ch != '\b') {
-            new_password[i++] = ch;
-            printf("*");
+    printf("\n%s\n", consistent ? "Index and scan agree" : "Index and scan DISAGREE");
+    return consistent;
+}
+
+// One row per account through fprintf(), the way exports used to be
+// written, for comparison
+static long long export_with_fprintf(const char* path, Money* balances, unsigned char* flags, int count) {
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) return -1;
+    fprintf(fp, "account_number,name,username,email,mobile,dob,type,balance,status,created_date\n");
+    for (int id = 0; id < count; id++) {
+        BankAccount* account = &ACCOUNT(id);
+        char balance_text[MONEY_BUFFER_SIZE];
+        fprintf(fp, "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n", account->account_number, account->name, account->username,
+                account->email, account->mobile, account->dob, account_type_name(flags[id] & ACCOUNT_TYPE_MASK),
+                format_money(balances[id], balance_text), flags[id] & ACCOUNT_ACTIVE ? "ACTIVE" : "BLOCKED",
+                account->created_date);
+    }
+    long long bytes = ftell(fp);
+    fclose(fp);
+    return bytes;
+}
+
+static void export_bench_remove(const char* path, int shards) {
+    char part[EXPORT_PATH_MAX];
+    for (int i = 0; i < shards; i++) {
+        export_shard_path(path, i, shards, part);
+        remove(part);
+    }
+}
+
+// Times exports of the given number of generated accounts, each with
+// EXPORT_BENCH_HISTORY transactions, in a scratch directory: plain buffered
+// writes of the same number of bytes as the ceiling, one fprintf() per row
+// as the baseline, then each kind of export.
+int run_export_bench(int accounts) {
+    unsigned int seed = 2463534242u;
+    if (!bench_customers(accounts, BENCH_INITIAL_DEPOSIT, &seed)) return 0;
+    for (int id = 0; id < accounts; id++) {
+        Money balance = 0;
+        for (int t = 0; t < EXPORT_BENCH_HISTORY; t++) {
+            Transaction* trans = ledger_append(&HISTORY(id));
+            if (trans == NULL) {
+                printf("Error: Out of memory!\n");
+                return 0;
+            }
+            Money amount = (Money)(1 + next_random(&seed) % 100000) * MINOR_UNITS;
+            balance += amount;
+            strcpy(trans->date, "01/01/2026 09:00");
+            strcpy(trans->type, "DEPOSIT");
+            strcpy(trans->description, "Cash deposit");
+            strcpy(trans->reference_account, "N/A");
+            trans->amount = amount;
+            trans->balance_after = balance;
+            trans->timestamp = 1767258000u + t;
         }
     }
-    new_password[i] = '\0';
     
-    printf("\nConfirm new password: ");
-    i = 0;
-    while ((ch = getch()) != '\r' && i < 19) {
-        if (ch == '\b' && i > 0) {
-            printf("\b \b");
-            i--;
-        } else if (ch != '\b') {
-            confirm_password[i++] = ch;
-            printf("*");
-        }
+    char directory[] = "export-bench-XXXXXX";
+    if (!enter_scratch_directory(directory)) {
+        printf("Error: Unable to create a scratch directory!\n");
+        return 0;
+    }
+    Money* balances = NULL;
+    unsigned char* flags = NULL;
+    char* block = calloc(1, EXPORT_BUFFER_SIZE);
+    if (block == NULL || snapshot_columns(&balances, &flags) < 0) {
+        printf("Error: Out of memory!\n");
+        free(block);
+        leave_scratch_directory(directory);
+        return 0;
     }
-    confirm_password[i] = '\0';
     
-    if (strcmp(new_password, confirm_password) != 0) {
-        printf("\n\nNew passwords don't match!\n");
-        pause_system();
-        return;
+    printf("%d accounts, %d transactions each\n\n", accounts, EXPORT_BENCH_HISTORY);
+    printf("%-28s %10s %10s %10s %10s\n", "Export", "Rows", "MB", "Seconds", "MB/s");
+    int ok = 1;
+    
+    double start = now_seconds();
+    long long baseline = export_with_fprintf("fprintf.csv", balances, flags, accounts);
+    double seconds = now_seconds() - start;
+    remove("fprintf.csv");
+    if (baseline < 0) ok = 0;
+    
+    // Plain writes of as many bytes as the fprintf() export
+    start = now_seconds();
+    FILE* fp = fopen("ceiling.bin", "wb");
+    if (fp == NULL) ok = 0;
+    for (long long written = 0; fp != NULL && written < baseline; written += EXPORT_BUFFER_SIZE) {
+        size_t n = baseline - written < EXPORT_BUFFER_SIZE ? (size_t)(baseline - written) : EXPORT_BUFFER_SIZE;
+        if (fwrite(block, 1, n, fp) != n) ok = 0;
     }
+    if (fp != NULL) fclose(fp);
+    double ceiling = now_seconds() - start;
+    remove("ceiling.bin");
+    printf("%-28s %10s %10.1f %10.3f %10.0f\n", "plain writes (ceiling)", "-", baseline / 1e6, ceiling,
+           baseline / 1e6 / ceiling);
+    printf("%-28s %10d %10.1f %10.3f %10.0f\n", "accounts, fprintf per row", accounts, baseline / 1e6, seconds,
+           baseline / 1e6 / seconds);
     
-    strcpy(current_user->password_hash, hash_password(new_password));
-    save_accounts();
+    static const struct {
+        const char* name;
+        const char* path;
+        int what;
+        int format;
+        int shards;
+    } runs[] = {
+        {"accounts CSV", "accounts.csv", EXPORT_ACCOUNTS, EXPORT_CSV, 1},
+        {"accounts JSONL", "accounts.jsonl", EXPORT_ACCOUNTS, EXPORT_JSONL, 1},
+        {"accounts CSV, sharded", "accounts.csv", EXPORT_ACCOUNTS, EXPORT_CSV, EXPORT_BENCH_SHARDS},
+        {"transactions CSV", "transactions.csv", EXPORT_TRANSACTIONS, EXPORT_CSV, 1},
+        {"transactions JSONL, sharded", "transactions.jsonl", EXPORT_TRANSACTIONS, EXPORT_JSONL, EXPORT_BENCH_SHARDS},
+    };
+    for (int r = 0; r < (int)(sizeof(runs) / sizeof(runs[0])); r++) {
+        long long rows, bytes;
+        start = now_seconds();
+        if (!export_data(runs[r].path, runs[r].what, runs[r].format, runs[r].shards, &rows, &bytes)) ok = 0;
+        seconds = now_seconds() - start;
+        export_bench_remove(runs[r].path, runs[r].shards);
+        printf("%-28s %10lld %10.1f %10.3f %10.0f\n", runs[r].name, rows, bytes / 1e6, seconds,
+               bytes / 1e6 / seconds);
+    }
     
-    printf("\n\n✓ Password changed successfully!\n");
-    pause_system();
+    free(block);
+    free(balances);
+    free(flags);
+    leave_scratch_directory(directory);
+    if (!ok) printf("\nError: An export could not be written!\n");
+    return ok;
 }
 
-void admin_view_all_accounts() {
-    clear_screen();
-    printf("===============================================================\n");
-    printf("=                       ALL ACCOUNTS                          =\n");
-    printf("===============================================================\n");
+// Exports the bank's accounts or transactions; the format follows the
+// extension of path, JSON lines for .jsonl and CSV otherwise
+int run_export(const char* what, const char* path, int shards) {
+    int kind = strcmp(what, "accounts") == 0 ? EXPORT_ACCOUNTS :
+               strcmp(what, "transactions") == 0 ? EXPORT_TRANSACTIONS : -1;
+    if (kind < 0) {
+        printf("Error: Export accounts or transactions, not %s!\n", what);
+        return 0;
+    }
+    const char* dot = strrchr(path, '.');
+    int format = dot != NULL && strcmp(dot, ".jsonl") == 0 ? EXPORT_JSONL : EXPORT_CSV;
+    load_accounts();
     
-    if (total_accounts == 0) {
-        printf("\nNo accounts found!\n");
-        pause_system();
-        return;
+    long long rows, bytes;
+    double start = now_seconds();
+    int ok = export_data(path, kind, format, shards, &rows, &bytes);
+    double seconds = now_seconds() - start;
+    if (!ok) {
+        printf("Error: Unable to write %s!\n", path);
+        return 0;
     }
+    printf("%lld %s exported to %s: %.1f MB in %.2f s (%.0f MB/s)\n", rows, what, path, bytes / 1e6, seconds,
+           seconds > 0 ? bytes / 1e6 / seconds : 0.0);
+    return 1;
+}
+
+// Writes rows generated customers to customers.csv in a scratch directory,
+// one row in IMPORT_BENCH_REJECT_EVERY with an invalid email and another
+// repeating the previous username, and imports them into an empty bank with
+// one worker and then with one per CPU. Each import must accept and refuse
+// exactly the expected rows, and the bank must load back with the accepted
+// ones.
+int run_import_bench(int rows) {
+    char directory[] = "import-bench-XXXXXX";
+    if (!enter_scratch_directory(directory)) {
+        printf("Error: Unable to create a scratch directory!\n");
+        return 0;
+    }
+    FILE* fp = fopen("customers.csv", "w");
+    if (fp == NULL) {
+        printf("Error: Unable to write customers.csv!\n");
+        leave_scratch_directory(directory);
+        return 0;
+    }
+    setvbuf(fp, NULL, _IOFBF, BATCH_BUFFER_SIZE);
     
-    printf("\n%-15s %-20s %-15s %-12s %-8s\n", "Account No", "Name", "Type", "Balance", "Status");
-    printf("========================================================================\n");
+    char password_hash[50];
+    hash_password("Bench1234!", password_hash);
+    unsigned int seed = 2463534242u;
+    long expected_rejects = 0;
+    char username[MAX_USERNAME_LEN] = "";
+    fprintf(fp, "name,username,email,mobile,dob,type,deposit,password_hash\n");
+    for (int i = 0; i < rows; i++) {
+        const char* first = search_bench_first[next_random(&seed) % SEARCH_BENCH_NAMES(search_bench_first)];
+        const char* last = search_bench_last[next_random(&seed) % SEARCH_BENCH_NAMES(search_bench_last)];
+        int spoiled = i % IMPORT_BENCH_REJECT_EVERY == IMPORT_BENCH_REJECT_EVERY - 1;
+        if (i % IMPORT_BENCH_REJECT_EVERY != IMPORT_BENCH_REJECT_EVERY / 2) {
+            sprintf(username, "%.8s%07d", first, i);
+        } else {
+            spoiled = 1;
+        }
+        expected_rejects += spoiled;
+        int type = i % 3;
+        fprintf(fp, "%s %s,%s,%s.%s%d@%s,%d%09u,01/01/1990,%s,%lld,%s\n", first, last, username, first, last,
+                i % 1000, i % IMPORT_BENCH_REJECT_EVERY == IMPORT_BENCH_REJECT_EVERY - 1 ? "invalid" :
+                search_bench_domains[next_random(&seed) % SEARCH_BENCH_NAMES(search_bench_domains)],
+                6 + (int)(next_random(&seed) % 4), next_random(&seed) % 1000000000u, account_type_name(type),
+                min_balance_for(type) / MINOR_UNITS + next_random(&seed) % 100000, password_hash);
+    }
+    int ok = fflush(fp) == 0;
+    fclose(fp);
     
-    for (int i = 0; i < total_accounts; i++) {
-        printf("%-15s %-20s %-15s %-10.2f %-8s\n",
-               accounts[i].account_number, accounts[i].name, 
-               accounts[i].account_type, accounts[i].balance,
-               accounts[i].is_active ? "ACTIVE" : "BLOCKED");
+    printf("%d rows, %ld to be rejected\n", rows, expected_rejects);
+    printf("%-10s %10s %10s %10s %12s\n", "Workers", "Accepted", "Rejected", "Seconds", "Rows/s");
+    int worker_counts[2] = {1, cpu_count()};
+    for (int run = 0; run < 2 && ok; run++) {
+        unload_accounts();
+        remove_data_files();
+        load_accounts();
+        FILE* rejects = fopen("rejects.csv", "w");
+        if (rejects == NULL) {
+            ok = 0;
+            break;
+        }
+        long accepted, rejected;
+        double start = now_seconds();
+        ok = import_customers("customers.csv", rejects, worker_counts[run], &accepted, &rejected);
+        double seconds = now_seconds() - start;
+        fclose(rejects);
+        printf("%-10d %10ld %10ld %10.3f %12.0f\n", worker_counts[run], accepted, rejected, seconds,
+               (accepted + rejected) / seconds);
+        
+        unload_accounts();
+        load_accounts();
+        ok = ok && rejected == expected_rejects && accepted == rows - expected_rejects && total_accounts == accepted;
     }
+    printf("Imported accounts %s\n", ok ? "match" : "DIFFER");
     
-    pause_system();
+    unload_accounts();
+    remove("customers.csv");
+    remove("rejects.csv");
+    leave_scratch_directory(directory);
+    return ok;
 }
 
-void admin_block_account() {
-    char account_number[15];
+static int snapshot_test_running = 0;
+
+static THREAD_FUNC snapshot_test_storm(void* arg) {
+    unsigned int seed = *(unsigned int*)arg;
+    for (int i = 0; i < SNAPSHOT_TEST_TRANSFERS; i++) {
+        int from = next_random(&seed) % SNAPSHOT_TEST_ACCOUNTS;
+        int to = (from + 1 + next_random(&seed) % (SNAPSHOT_TEST_ACCOUNTS - 1)) % SNAPSHOT_TEST_ACCOUNTS;
+        bank_transfer(&ACCOUNT(from), &ACCOUNT(to), (Money)(1 + next_random(&seed) % 1000) * MINOR_UNITS);
+    }
+    __atomic_sub_fetch(&snapshot_test_running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Runs SNAPSHOT_TEST_THREADS threads of transfers among accounts created in
+// memory while the main thread keeps taking the bank total through
+// bank_stats(), which must always equal the money created. The same total
+// summed straight from the live balances is reported for comparison; it may
+// catch a transfer with only one leg recorded.
+int run_snapshot_test() {
+    unsigned int seed = 2463534242u;
+    if (!bench_customers(SNAPSHOT_TEST_ACCOUNTS, BENCH_INITIAL_DEPOSIT, &seed)) return 0;
+    Money expected = (Money)SNAPSHOT_TEST_ACCOUNTS * BENCH_INITIAL_DEPOSIT;
+    printf("%d threads, %d transfers each, among %d accounts\n", SNAPSHOT_TEST_THREADS,
+           SNAPSHOT_TEST_TRANSFERS, SNAPSHOT_TEST_ACCOUNTS);
     
-    printf("\nEnter account number to block: ");
-    scanf("%s", account_number);
+    bank_thread handles[SNAPSHOT_TEST_THREADS];
+    unsigned int seeds[SNAPSHOT_TEST_THREADS];
+    int started = 0;
+    snapshot_test_running = SNAPSHOT_TEST_THREADS;
+    while (started < SNAPSHOT_TEST_THREADS) {
+        seeds[started] = 2463534242u + started * 7919;
+        if (!thread_start(&handles[started], snapshot_test_storm, &seeds[started])) break;
+        started++;
+    }
     
-    BankAccount* account = find_account_by_number(account_number);
-    if (account == NULL) {
-        printf("Account not found!\n");
-        pause_system();
-        return;
+    // A failure stops the reports but still waits for the threads started
+    int failed = started < SNAPSHOT_TEST_THREADS;
+    if (failed) printf("Error: Cannot start threads!\n");
+    long long reports = 0, wrong = 0, torn = 0;
+    double start = now_seconds();
+    while (!failed && __atomic_load_n(&snapshot_test_running, __ATOMIC_ACQUIRE) > 0) {
+        BankStats stats;
+        if (!bank_stats(&stats)) {
+            printf("Error: Not enough memory for a snapshot!\n");
+            failed = 1;
+            break;
+        }
+        Money total = 0;
+        for (int t = 0; t < STATS_TYPES; t++) {
+            total += stats.type_balance[t];
+        }
+        if (total != expected || stats.accounts != SNAPSHOT_TEST_ACCOUNTS) wrong++;
+        
+        Money live = 0;
+        for (int id = 0; id < SNAPSHOT_TEST_ACCOUNTS; id++) {
+            live += __atomic_load_n(&BALANCE(id), __ATOMIC_RELAXED);
+        }
+        if (live != expected) torn++;
+        reports++;
     }
+    for (int i = 0; i < started; i++) {
+        thread_join(handles[i]);
+    }
+    if (failed) return 0;
+    double seconds = now_seconds() - start;
     
-    account->is_active = 0;
-    save_accounts();
+    BankStats stats;
+    Money total = 0;
+    bank_stats(&stats);
+    for (int t = 0; t < STATS_TYPES; t++) {
+        total += stats.type_balance[t];
+    }
+    if (total != expected) wrong++;
     
-    printf("Account %s has been blocked!\n", account_number);
-    pause_system();
+    printf("%lld reports in %.3f s, %lld chunks saved by writers\n", reports, seconds, snapshot_chunks_saved);
+    printf("Live column sums off: %lld\n", torn);
+    printf("%s: %lld snapshot totals off\n", wrong == 0 ? "PASS" : "FAIL", wrong);
+    return wrong == 0;
 }
 
-void admin_unblock_account() {
-    char account_number[15];
+// Built with -DBANK_LIBRARY, bank.c leaves out main(), so the core calls
+// (bank_*(), load_accounts(), checkpoint() ...) can be linked into another
+// program, which calls init_locks() and init_auth() first
+#ifndef BANK_LIBRARY
+int main(int argc, char* argv[]) {
+    const char* batch_path = NULL;
+    const char* import_path = NULL;
+    int import_rows = 0;
+    const char* log_path = NULL;
+    int server_port = -1;
+    int workers = cpu_count();
+    int loadgen_workers = 0;
+    int contention_threads = 0;
+    int stats_accounts = 0;
+    int login_threads = 0;
+    int audit_transactions = 0;
+    int search_accounts = 0;
+    int export_accounts = 0;
+    const char* export_what = NULL;
+    const char* export_path = NULL;
+    int export_shards = 1;
+    int crash_test = 0;
+    int format_accounts = 0;
+    int convert = 0;
+    int bench_accounts = 0;
+    int create_accounts = 0;
+    int metrics_transfers = 0;
+    int scale_accounts = 0;
+    int snapshot_test = 0;
+    const char* eod_date = NULL;
+    int eod_threads = 0;
     
-    printf("\nEnter account number to unblock: ");
-    scanf("%s", account_number);
+    init_locks();
+    init_auth();
     
-    BankAccount* account = find_account_by_number(account_number);
-    if (account == NULL) {
-        printf("Account not found!\n");
-        pause_system();
-        return;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mmap") == 0) {
+            use_mapped_storage = 1;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if (strcmp(argv[i], "--import") == 0 && i + 1 < argc) {
+            import_path = argv[++i];
+        } else if (strcmp(argv[i], "--import-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            import_rows = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            log_path = argv[++i];
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            server_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loadgen") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            loadgen_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--contention") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            contention_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--eod") == 0 && i + 1 < argc) {
+            eod_date = argv[++i];
+        } else if (strcmp(argv[i], "--eod-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            eod_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--login-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            login_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            stats_accounts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--audit-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            audit_transactions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--search-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            search_accounts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--export") == 0 && i + 2 < argc) {
+            export_what = argv[++i];
+            export_path = argv[++i];
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            export_shards = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--export-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            export_accounts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--crash-test") == 0) {
+            crash_test = 1;
+        } else if (strcmp(argv[i], "--format-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            format_accounts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--convert") == 0) {
+            convert = 1;
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 1) {
+            bench_accounts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--create-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 1) {
+            create_accounts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scale-test") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            scale_accounts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--metrics-bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            metrics_transfers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot-test") == 0) {
+            snapshot_test = 1;
+        } else {
+            printf("Usage: %s [--mmap] [--batch <commands.csv> [--log <results.csv>]]\n"
+                   "       [--import <customers.csv> [--log <rejects.csv>] [--workers <n>]]\n"
+                   "       [--server <port> [--workers <n>]] [--loadgen <max workers>]\n"
+                   "       [--contention <max threads>] [--stats-bench <accounts>]\n"
+                   "       [--eod <YYYY-MM-DD|today> [--workers <n>]] [--eod-bench <max threads>]\n"
+                   "       [--login-bench <max threads>] [--audit-bench <transactions>]\n"
+                   "       [--search-bench <accounts>] [--export-bench <accounts>]\n"
+                   "       [--export <accounts|transactions> <file.csv|file.jsonl> [--shards <n>]]\n"
+                   "       [--mmap] --crash-test | --format-bench <accounts> | --convert\n"
+                   "       [--bench <max accounts>] [--metrics-bench <transfers>] [--snapshot-test]\n"
+                   "       [--create-bench <accounts>] [--import-bench <rows>] [--scale-test <accounts>]\n", argv[0]);
+            return 1;
+        }
     }
     
-    account->is_active = 1;
-    account->failed_attempts = 0;
-    save_accounts();
+    if (batch_path != NULL) {
+        return run_batch(batch_path, log_path) ? 0 : 1;
+    }
+    if (import_path != NULL) {
+        return run_import(import_path, log_path, workers) ? 0 : 1;
+    }
+    if (import_rows > 0) {
+        return run_import_bench(import_rows) ? 0 : 1;
+    }
+    if (server_port >= 0) {
+        return run_server(server_port, workers) ? 0 : 1;
+    }
+    if (loadgen_workers > 0) {
+        return run_loadgen(loadgen_workers) ? 0 : 1;
+    }
+    if (contention_threads > 0) {
+        return run_contention(contention_threads) ? 0 : 1;
+    }
+    if (eod_date != NULL) {
+        return run_eod(eod_date, workers) ? 0 : 1;
+    }
+    if (eod_threads > 0) {
+        return run_eod_bench(eod_threads) ? 0 : 1;
+    }
+    if (login_threads > 0) {
+        return run_login_bench(login_threads) ? 0 : 1;
+    }
+    if (stats_accounts > 0) {
+        return run_stats_bench(stats_accounts) ? 0 : 1;
+    }
+    if (audit_transactions > 0) {
+        return run_audit_bench(audit_transactions) ? 0 : 1;
+    }
+    if (search_accounts > 0) {
+        return run_search_bench(search_accounts) ? 0 : 1;
+    }
+    if (export_accounts > 0) {
+        return run_export_bench(export_accounts) ? 0 : 1;
+    }
+    if (export_what != NULL) {
+        return run_export(export_what, export_path, export_shards) ? 0 : 1;
+    }
+    if (crash_test) {
+        return run_crash_test() ? 0 : 1;
+    }
+    if (format_accounts > 0) {
+        return run_format_bench(format_accounts) ? 0 : 1;
+    }
+    if (convert) {
+        return run_convert() ? 0 : 1;
+    }
+    if (bench_accounts > 0) {
+        return run_bench(bench_accounts) ? 0 : 1;
+    }
+    if (create_accounts > 0) {
+        return run_create_bench(create_accounts) ? 0 : 1;
+    }
+    if (scale_accounts > 0) {
+        return run_scale_test(scale_accounts) ? 0 : 1;
+    }
+    if (metrics_transfers > 0) {
+        return run_metrics_bench(metrics_transfers) ? 0 : 1;
+    }
+    if (snapshot_test) {
+        return run_snapshot_test() ? 0 : 1;
+    }
     
-    printf("Account %s has been unblocked!\n", account_number);
-    pause_system();
-}
-
-int main() {
     main_menu();
     return 0;
-}
\ No newline at end of file
+}
+#endif